@@ -0,0 +1,380 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "aead.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define CHACHA_BLOCK 64
+#define POLY_BLOCK 16
+
+// Loads a little-endian 32-bit word
+static uint32_t load32(uint8_t *p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16)
+           | ((uint32_t) p[3] << 24);
+}
+
+// Stores a 32-bit word little-endian
+static void store32(uint8_t *p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+    return;
+}
+
+static uint32_t rotl32(uint32_t v, int n) {
+    return (v << n) | (v >> (32 - n));
+}
+
+#define QUARTER(a, b, c, d)                                                                        \
+    do {                                                                                           \
+        a += b;                                                                                    \
+        d = rotl32(d ^ a, 16);                                                                     \
+        c += d;                                                                                    \
+        b = rotl32(b ^ c, 12);                                                                     \
+        a += b;                                                                                    \
+        d = rotl32(d ^ a, 8);                                                                      \
+        c += d;                                                                                    \
+        b = rotl32(b ^ c, 7);                                                                      \
+    } while (0)
+
+// Sets up the ChaCha20 state for key and nonce, with the block counter at counter
+static void chacha_init(uint32_t state[16], uint8_t *key, uint8_t *nonce, uint32_t counter) {
+    state[0] = 0x61707865; // "expand 32-byte k"
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    for (int i = 0; i < 8; i++) {
+        state[4 + i] = load32(key + 4 * i);
+    }
+    state[12] = counter;
+    for (int i = 0; i < 3; i++) {
+        state[13 + i] = load32(nonce + 4 * i);
+    }
+    return;
+}
+
+// Computes one 64-byte keystream block for state, then steps its counter
+static void chacha_block(uint32_t state[16], uint8_t *out) {
+    uint32_t x[16];
+
+    memcpy(x, state, sizeof(x));
+    for (int i = 0; i < 10; i++) { // 20 rounds, a column round and a diagonal round at a time
+        QUARTER(x[0], x[4], x[8], x[12]);
+        QUARTER(x[1], x[5], x[9], x[13]);
+        QUARTER(x[2], x[6], x[10], x[14]);
+        QUARTER(x[3], x[7], x[11], x[15]);
+        QUARTER(x[0], x[5], x[10], x[15]);
+        QUARTER(x[1], x[6], x[11], x[12]);
+        QUARTER(x[2], x[7], x[8], x[13]);
+        QUARTER(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; i++) {
+        store32(out + 4 * i, x[i] + state[i]);
+    }
+    state[12]++;
+    return;
+}
+
+#if defined(__SSE2__)
+
+#define ROTL128(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+
+#define QUARTER128(a, b, c, d)                                                                     \
+    do {                                                                                           \
+        a = _mm_add_epi32(a, b);                                                                   \
+        d = ROTL128(_mm_xor_si128(d, a), 16);                                                      \
+        c = _mm_add_epi32(c, d);                                                                   \
+        b = ROTL128(_mm_xor_si128(b, c), 12);                                                      \
+        a = _mm_add_epi32(a, b);                                                                   \
+        d = ROTL128(_mm_xor_si128(d, a), 8);                                                       \
+        c = _mm_add_epi32(c, d);                                                                   \
+        b = ROTL128(_mm_xor_si128(b, c), 7);                                                       \
+    } while (0)
+
+// XORs four consecutive keystream blocks into 256 bytes of in, then steps the counter by four
+// Lane j of x[i] holds word i of block j, so each instruction works on all four blocks
+static void chacha_xor4(uint32_t state[16], uint8_t *out, uint8_t *in) {
+    __m128i x[16];
+    __m128i start[16];
+
+    for (int i = 0; i < 16; i++) {
+        start[i] = _mm_set1_epi32((int) state[i]);
+    }
+    start[12] = _mm_add_epi32(start[12], _mm_set_epi32(3, 2, 1, 0));
+    memcpy(x, start, sizeof(x));
+    for (int i = 0; i < 10; i++) {
+        QUARTER128(x[0], x[4], x[8], x[12]);
+        QUARTER128(x[1], x[5], x[9], x[13]);
+        QUARTER128(x[2], x[6], x[10], x[14]);
+        QUARTER128(x[3], x[7], x[11], x[15]);
+        QUARTER128(x[0], x[5], x[10], x[15]);
+        QUARTER128(x[1], x[6], x[11], x[12]);
+        QUARTER128(x[2], x[7], x[8], x[13]);
+        QUARTER128(x[3], x[4], x[9], x[14]);
+    }
+    for (int g = 0; g < 16; g += 4) { // Transpose each group of four words back into blocks
+        __m128i a = _mm_add_epi32(x[g], start[g]);
+        __m128i b = _mm_add_epi32(x[g + 1], start[g + 1]);
+        __m128i c = _mm_add_epi32(x[g + 2], start[g + 2]);
+        __m128i d = _mm_add_epi32(x[g + 3], start[g + 3]);
+        __m128i ab_lo = _mm_unpacklo_epi32(a, b);
+        __m128i cd_lo = _mm_unpacklo_epi32(c, d);
+        __m128i ab_hi = _mm_unpackhi_epi32(a, b);
+        __m128i cd_hi = _mm_unpackhi_epi32(c, d);
+        __m128i rows[4] = { _mm_unpacklo_epi64(ab_lo, cd_lo), _mm_unpackhi_epi64(ab_lo, cd_lo),
+            _mm_unpacklo_epi64(ab_hi, cd_hi), _mm_unpackhi_epi64(ab_hi, cd_hi) };
+        for (int j = 0; j < 4; j++) {
+            uint8_t *at = in + CHACHA_BLOCK * j + 4 * g;
+            __m128i v = _mm_xor_si128(_mm_loadu_si128((__m128i *) at), rows[j]);
+            _mm_storeu_si128((__m128i *) (out + CHACHA_BLOCK * j + 4 * g), v);
+        }
+    }
+    state[12] += 4;
+    return;
+}
+
+#endif
+
+// XORs the keystream of state into len bytes of in, out may be in
+static void chacha_xor(uint32_t state[16], uint8_t *out, uint8_t *in, size_t len) {
+    uint8_t block[CHACHA_BLOCK];
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    for (; i + 4 * CHACHA_BLOCK <= len; i += 4 * CHACHA_BLOCK) {
+        chacha_xor4(state, out + i, in + i);
+    }
+#endif
+    for (; i < len; i += CHACHA_BLOCK) {
+        size_t n = len - i < CHACHA_BLOCK ? len - i : CHACHA_BLOCK;
+        chacha_block(state, block);
+        for (size_t j = 0; j < n; j++) {
+            out[i + j] = in[i + j] ^ block[j];
+        }
+    }
+    return;
+}
+
+// Poly1305 in five 26-bit limbs, so every product fits in 64 bits
+typedef struct {
+    uint32_t r[5];
+    uint32_t h[5];
+    uint32_t pad[4];
+    uint8_t buf[POLY_BLOCK]; // Bytes of a block not yet absorbed
+    size_t buf_len;
+} poly1305;
+
+static void poly_init(poly1305 *poly, uint8_t *key) {
+    poly->r[0] = load32(key) & 0x3ffffff; // r is clamped as the RFC asks
+    poly->r[1] = (load32(key + 3) >> 2) & 0x3ffff03;
+    poly->r[2] = (load32(key + 6) >> 4) & 0x3ffc0ff;
+    poly->r[3] = (load32(key + 9) >> 6) & 0x3f03fff;
+    poly->r[4] = (load32(key + 12) >> 8) & 0x00fffff;
+    for (int i = 0; i < 5; i++) {
+        poly->h[i] = 0;
+    }
+    for (int i = 0; i < 4; i++) {
+        poly->pad[i] = load32(key + 16 + 4 * i);
+    }
+    poly->buf_len = 0;
+    return;
+}
+
+// Absorbs whole 16-byte blocks, len must be a multiple of POLY_BLOCK
+static void poly_blocks(poly1305 *poly, uint8_t *m, size_t len) {
+    uint32_t r0 = poly->r[0], r1 = poly->r[1], r2 = poly->r[2], r3 = poly->r[3], r4 = poly->r[4];
+    uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+    uint32_t h0 = poly->h[0], h1 = poly->h[1], h2 = poly->h[2], h3 = poly->h[3], h4 = poly->h[4];
+
+    for (; len >= POLY_BLOCK; len -= POLY_BLOCK, m += POLY_BLOCK) {
+        h0 += load32(m) & 0x3ffffff;
+        h1 += (load32(m + 3) >> 2) & 0x3ffffff;
+        h2 += (load32(m + 6) >> 4) & 0x3ffffff;
+        h3 += (load32(m + 9) >> 6) & 0x3ffffff;
+        h4 += (load32(m + 12) >> 8) | (1 << 24); // The 2^128 bit of a full block
+
+        uint64_t d0 = (uint64_t) h0 * r0 + (uint64_t) h1 * s4 + (uint64_t) h2 * s3
+                      + (uint64_t) h3 * s2 + (uint64_t) h4 * s1;
+        uint64_t d1 = (uint64_t) h0 * r1 + (uint64_t) h1 * r0 + (uint64_t) h2 * s4
+                      + (uint64_t) h3 * s3 + (uint64_t) h4 * s2;
+        uint64_t d2 = (uint64_t) h0 * r2 + (uint64_t) h1 * r1 + (uint64_t) h2 * r0
+                      + (uint64_t) h3 * s4 + (uint64_t) h4 * s3;
+        uint64_t d3 = (uint64_t) h0 * r3 + (uint64_t) h1 * r2 + (uint64_t) h2 * r1
+                      + (uint64_t) h3 * r0 + (uint64_t) h4 * s4;
+        uint64_t d4 = (uint64_t) h0 * r4 + (uint64_t) h1 * r3 + (uint64_t) h2 * r2
+                      + (uint64_t) h3 * r1 + (uint64_t) h4 * r0;
+
+        // Partial carry, h stays below 2^130 + a little, which is all the next block needs
+        d1 += d0 >> 26;
+        h0 = d0 & 0x3ffffff;
+        d2 += d1 >> 26;
+        h1 = d1 & 0x3ffffff;
+        d3 += d2 >> 26;
+        h2 = d2 & 0x3ffffff;
+        d4 += d3 >> 26;
+        h3 = d3 & 0x3ffffff;
+        h0 += (uint32_t) (d4 >> 26) * 5; // 2^130 is 5 modulo 2^130 - 5
+        h4 = d4 & 0x3ffffff;
+        h1 += h0 >> 26;
+        h0 &= 0x3ffffff;
+    }
+    poly->h[0] = h0;
+    poly->h[1] = h1;
+    poly->h[2] = h2;
+    poly->h[3] = h3;
+    poly->h[4] = h4;
+    return;
+}
+
+static void poly_update(poly1305 *poly, uint8_t *m, size_t len) {
+    if (poly->buf_len > 0) { // Top up a partial block first
+        size_t n = POLY_BLOCK - poly->buf_len < len ? POLY_BLOCK - poly->buf_len : len;
+        memcpy(poly->buf + poly->buf_len, m, n);
+        poly->buf_len += n;
+        m += n;
+        len -= n;
+        if (poly->buf_len < POLY_BLOCK) {
+            return;
+        }
+        poly_blocks(poly, poly->buf, POLY_BLOCK);
+        poly->buf_len = 0;
+    }
+    size_t whole = len - len % POLY_BLOCK;
+    poly_blocks(poly, m, whole);
+    memcpy(poly->buf, m + whole, len - whole);
+    poly->buf_len = len - whole;
+    return;
+}
+
+// Zero pads what has been absorbed so far to a whole block, as the AEAD construction does
+static void poly_pad(poly1305 *poly) {
+    if (poly->buf_len > 0) {
+        memset(poly->buf + poly->buf_len, 0, POLY_BLOCK - poly->buf_len);
+        poly_blocks(poly, poly->buf, POLY_BLOCK);
+        poly->buf_len = 0;
+    }
+    return;
+}
+
+// Reduces h fully modulo 2^130 - 5, adds the pad, and stores the 16-byte tag
+// Everything absorbed must be whole blocks, which the AEAD construction guarantees
+static void poly_finish(poly1305 *poly, uint8_t *tag) {
+    uint32_t h0 = poly->h[0], h1 = poly->h[1], h2 = poly->h[2], h3 = poly->h[3], h4 = poly->h[4];
+    uint32_t g0, g1, g2, g3, g4, c, mask;
+    uint64_t f;
+
+    c = h1 >> 26;
+    h1 &= 0x3ffffff;
+    h2 += c;
+    c = h2 >> 26;
+    h2 &= 0x3ffffff;
+    h3 += c;
+    c = h3 >> 26;
+    h3 &= 0x3ffffff;
+    h4 += c;
+    c = h4 >> 26;
+    h4 &= 0x3ffffff;
+    h0 += c * 5;
+    c = h0 >> 26;
+    h0 &= 0x3ffffff;
+    h1 += c;
+
+    // g = h + 5 - 2^130, used instead of h if it didn't go negative, without branching
+    g0 = h0 + 5;
+    c = g0 >> 26;
+    g0 &= 0x3ffffff;
+    g1 = h1 + c;
+    c = g1 >> 26;
+    g1 &= 0x3ffffff;
+    g2 = h2 + c;
+    c = g2 >> 26;
+    g2 &= 0x3ffffff;
+    g3 = h3 + c;
+    c = g3 >> 26;
+    g3 &= 0x3ffffff;
+    g4 = h4 + c - (1 << 26);
+    mask = (g4 >> 31) - 1;
+    h0 = (h0 & ~mask) | (g0 & mask);
+    h1 = (h1 & ~mask) | (g1 & mask);
+    h2 = (h2 & ~mask) | (g2 & mask);
+    h3 = (h3 & ~mask) | (g3 & mask);
+    h4 = (h4 & ~mask) | (g4 & mask);
+
+    h0 = h0 | (h1 << 26); // Back to four 32-bit words, dropping bits above 2^128
+    h1 = (h1 >> 6) | (h2 << 20);
+    h2 = (h2 >> 12) | (h3 << 14);
+    h3 = (h3 >> 18) | (h4 << 8);
+
+    f = (uint64_t) h0 + poly->pad[0];
+    store32(tag, (uint32_t) f);
+    f = (uint64_t) h1 + poly->pad[1] + (f >> 32);
+    store32(tag + 4, (uint32_t) f);
+    f = (uint64_t) h2 + poly->pad[2] + (f >> 32);
+    store32(tag + 8, (uint32_t) f);
+    f = (uint64_t) h3 + poly->pad[3] + (f >> 32);
+    store32(tag + 12, (uint32_t) f);
+    return;
+}
+
+// Computes the RFC 8439 tag over aad and the ciphertext, keyed by block 0 of the keystream
+static void aead_tag(uint8_t *tag, uint8_t *cipher, size_t len, uint8_t *aad, size_t aad_len,
+    uint8_t *key, uint8_t *nonce) {
+    uint32_t state[16];
+    uint8_t block[CHACHA_BLOCK];
+    uint8_t lengths[16];
+    poly1305 poly;
+
+    chacha_init(state, key, nonce, 0);
+    chacha_block(state, block);
+    poly_init(&poly, block);
+    poly_update(&poly, aad, aad_len);
+    poly_pad(&poly);
+    poly_update(&poly, cipher, len);
+    poly_pad(&poly);
+    store32(lengths, (uint32_t) aad_len);
+    store32(lengths + 4, (uint32_t) ((uint64_t) aad_len >> 32));
+    store32(lengths + 8, (uint32_t) len);
+    store32(lengths + 12, (uint32_t) ((uint64_t) len >> 32));
+    poly_update(&poly, lengths, sizeof(lengths));
+    poly_finish(&poly, tag);
+    memset(block, 0, sizeof(block));
+    return;
+}
+
+// Encrypts len bytes of in into out under key and nonce, and writes the AEAD_TAG_SIZE byte tag
+// aad is authenticated but not encrypted, a nonce must never be used twice with the same key
+void aead_encrypt(uint8_t *out, uint8_t *tag, uint8_t *in, size_t len, uint8_t *aad,
+    size_t aad_len, uint8_t *key, uint8_t *nonce) {
+    uint32_t state[16];
+
+    chacha_init(state, key, nonce, 1);
+    chacha_xor(state, out, in, len);
+    aead_tag(tag, out, len, aad, aad_len, key, nonce);
+    return;
+}
+
+// Checks tag over in and aad, and only if it matches decrypts len bytes of in into out
+// Returns false, leaving out untouched, if the ciphertext or aad was changed
+bool aead_decrypt(uint8_t *out, uint8_t *in, size_t len, uint8_t *tag, uint8_t *aad,
+    size_t aad_len, uint8_t *key, uint8_t *nonce) {
+    uint32_t state[16];
+    uint8_t expected[AEAD_TAG_SIZE];
+    uint8_t diff = 0;
+
+    aead_tag(expected, in, len, aad, aad_len, key, nonce);
+    for (int i = 0; i < AEAD_TAG_SIZE; i++) { // Constant time, where they differ stays hidden
+        diff |= expected[i] ^ tag[i];
+    }
+    if (diff != 0) {
+        return false;
+    }
+    chacha_init(state, key, nonce, 1);
+    chacha_xor(state, out, in, len);
+    return true;
+}
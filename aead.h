@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// ChaCha20-Poly1305 authenticated encryption as in RFC 8439
+// ChaCha20 runs four blocks at a time with SSE2 when the compiler targets it, else one at a time
+
+#define AEAD_KEY_SIZE 32
+#define AEAD_NONCE_SIZE 12
+#define AEAD_TAG_SIZE 16
+
+void aead_encrypt(uint8_t *out, uint8_t *tag, uint8_t *in, size_t len, uint8_t *aad,
+    size_t aad_len, uint8_t *key, uint8_t *nonce);
+
+bool aead_decrypt(uint8_t *out, uint8_t *in, size_t len, uint8_t *tag, uint8_t *aad,
+    size_t aad_len, uint8_t *key, uint8_t *nonce);
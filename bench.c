@@ -0,0 +1,647 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <gmp.h>
+#include <unistd.h>
+#include <time.h>
+#include "numtheory.h"
+#include "randstate.h"
+#include "rsa.h"
+#include "hex.h"
+
+#define OPTIONS "hn:N:w:s:k:o:"
+
+// Modulus size of the key used by the file throughput kernels
+#define BENCH_FILE_BITS 1024
+
+// Signatures checked by each call of the verify kernel, a quarter of a verify batch
+#define BENCH_VERIFY_COUNT 256
+
+// Inputs of one kernel, set up once before its warmup and trials
+typedef struct {
+    uint64_t bits; // Operand size
+    size_t bytes; // Bytes of plaintext per trial for the file kernels, 0 for the others
+    uint64_t seed; // Kernels that draw random numbers reseed from seed and the trial
+    uint64_t trial;
+    mpz_t a, b, n, out;
+    mpz_t p, q, e, d;
+    FILE *in;
+    FILE *out_file;
+    rsa_key_ctx *ctx; // Key context of the hybrid kernels, NULL for the others
+    numtheory_ws *ws; // Workspace of the _ws kernels, NULL for the others
+    mpz_t msgs[MBEXP_LANES], sigs[MBEXP_LANES]; // Messages and signatures of the sign kernels
+    char *hex; // Text of the hex kernels, MBEXP_LANES numbers of bits / 4 digits each
+    mpz_t *verify_m, *verify_s; // BENCH_VERIFY_COUNT pairs of the verify kernel, NULL for the others
+    bool *valid;
+} bench_data;
+
+typedef void (*bench_fn)(bench_data *data);
+
+// One entry of the suite, macro kernels run fewer trials since each one takes much longer
+typedef struct {
+    const char *name;
+    bench_fn setup;
+    bench_fn run;
+    uint64_t bits;
+    size_t bytes;
+    bool macro;
+} bench_kernel;
+
+// Prints out help message when called for in the getopt() loop
+void help_message(void) {
+    printf("SYNOPSIS\n");
+    printf("   Times the number theory and RSA kernels and prints the results as JSON.\n");
+    printf("   Inputs come from a fixed seed, so runs of different builds are comparable.\n");
+    printf("\n");
+    printf("USAGE\n");
+    printf("   ./bench [-h] [-n trials] [-N trials] [-w warmup] [-s seed] [-k filter]\n");
+    printf("           [-o outfile]\n");
+    printf("\n");
+    printf("OPTIONS\n");
+    printf("   -h              Display program help and usage.\n");
+    printf("   -n trials       Timed trials of each micro kernel (default: 21).\n");
+    printf("   -N trials       Timed trials of each macro kernel (default: 5).\n");
+    printf("   -w warmup       Untimed runs before the trials (default: 2).\n");
+    printf("   -s seed         Seed for every input (default: 2024).\n");
+    printf("   -k filter       Only run kernels whose name contains filter.\n");
+    printf("   -o outfile      Output file for the JSON results (default: stdout).\n");
+    exit(0);
+}
+
+// Seeds the random state for the current trial, so every trial sees the same inputs each run
+static void bench_reseed(bench_data *data) {
+    gmp_randseed_ui(state, randstate_derive(data->seed, data->trial));
+    return;
+}
+
+// Sets n to a random odd number of exactly bits bits
+static void bench_odd(mpz_t n, uint64_t bits) {
+    mpz_urandomb(n, state, bits);
+    mpz_setbit(n, bits - 1);
+    mpz_setbit(n, 0);
+    return;
+}
+
+// Random base below an odd modulus and a random exponent of the same size
+static void setup_pow_mod(bench_data *data) {
+    bench_odd(data->n, data->bits);
+    mpz_urandomm(data->a, state, data->n);
+    bench_odd(data->b, data->bits);
+    return;
+}
+
+static void run_pow_mod(bench_data *data) {
+    pow_mod(data->out, data->a, data->b, data->n);
+    return;
+}
+
+// Makes the workspace the _ws kernels share between trials, as a loop over many calls would
+static void bench_ws(bench_data *data) {
+    data->ws = (numtheory_ws *) malloc(sizeof(numtheory_ws));
+    numtheory_ws_init(data->ws, data->bits);
+    return;
+}
+
+static void setup_pow_mod_ws(bench_data *data) {
+    setup_pow_mod(data);
+    bench_ws(data);
+    return;
+}
+
+static void run_pow_mod_ws(bench_data *data) {
+    pow_mod_ws(data->out, data->a, data->b, data->n, data->ws);
+    return;
+}
+
+// A prime of the given size, is_prime has to run every test on it
+static void setup_prime(bench_data *data) {
+    make_prime(data->n, data->bits, PRIME_ITERS_BPSW);
+    return;
+}
+
+// A product of two primes of half the size, it gets past trial division like a hard composite
+static void setup_composite(bench_data *data) {
+    make_prime(data->p, data->bits / 2, PRIME_ITERS_BPSW);
+    make_prime(data->q, data->bits - data->bits / 2, PRIME_ITERS_BPSW);
+    mpz_mul(data->n, data->p, data->q);
+    return;
+}
+
+static void run_is_prime(bench_data *data) {
+    is_prime(data->n, PRIME_ITERS_BPSW);
+    return;
+}
+
+static void setup_composite_ws(bench_data *data) {
+    setup_composite(data);
+    bench_ws(data);
+    return;
+}
+
+static void run_is_prime_ws(bench_data *data) {
+    is_prime_ws(data->n, PRIME_ITERS_BPSW, data->ws);
+    return;
+}
+
+static void setup_none(bench_data *data) {
+    (void) data;
+    return;
+}
+
+static void run_make_prime(bench_data *data) {
+    bench_reseed(data);
+    make_prime(data->out, data->bits, PRIME_ITERS_BPSW);
+    return;
+}
+
+// Two random numbers for gcd, and a prime modulus so mod_inverse always finds an inverse
+static void setup_gcd(bench_data *data) {
+    mpz_urandomb(data->a, state, data->bits);
+    mpz_urandomb(data->b, state, data->bits);
+    make_prime(data->n, data->bits, PRIME_ITERS_BPSW);
+    return;
+}
+
+static void run_gcd(bench_data *data) {
+    gcd(data->out, data->a, data->b);
+    return;
+}
+
+static void run_mod_inverse(bench_data *data) {
+    mod_inverse(data->out, data->a, data->n);
+    return;
+}
+
+// MBEXP_LANES random values below a prime modulus for the batch inverse
+static void setup_inverse_batch(bench_data *data) {
+    make_prime(data->n, data->bits, PRIME_ITERS_BPSW);
+    for (size_t i = 0; i < MBEXP_LANES; i++) {
+        mpz_urandomm(data->msgs[i], state, data->n);
+    }
+    return;
+}
+
+static void run_inverse_batch(bench_data *data) {
+    mod_inverse_batch(data->sigs, data->msgs, MBEXP_LANES, data->n);
+    return;
+}
+
+// MBEXP_LANES random numbers of exactly data->bits bits and their hex digits, a group of
+// ciphertext lines
+static void setup_hex(bench_data *data) {
+    data->hex = (char *) malloc(MBEXP_LANES * data->bits / 4);
+    for (size_t i = 0; i < MBEXP_LANES; i++) {
+        mpz_urandomb(data->msgs[i], state, data->bits);
+        mpz_setbit(data->msgs[i], data->bits - 1);
+        hex_encode(data->hex + i * data->bits / 4, data->msgs[i]);
+    }
+    return;
+}
+
+static void run_hex_encode(bench_data *data) {
+    for (size_t i = 0; i < MBEXP_LANES; i++) {
+        hex_encode(data->hex + i * data->bits / 4, data->msgs[i]);
+    }
+    return;
+}
+
+static void run_hex_decode(bench_data *data) {
+    for (size_t i = 0; i < MBEXP_LANES; i++) {
+        hex_decode(data->sigs[i], data->hex + i * data->bits / 4, data->bits / 4);
+    }
+    return;
+}
+
+static void run_make_pub(bench_data *data) {
+    bench_reseed(data);
+    mpz_set_ui(data->e, 65537);
+    rsa_make_pub(data->p, data->q, data->n, data->e, data->bits, PRIME_ITERS_BPSW);
+    return;
+}
+
+// MBEXP_LANES two-prime keys searched for at once like keygen --count, on one thread
+static void run_make_pub_many(bench_data *data) {
+    mpz_t primes[2 * MBEXP_LANES];
+
+    bench_reseed(data);
+    for (size_t i = 0; i < MBEXP_LANES; i++) {
+        mpz_inits(primes[2 * i], primes[2 * i + 1], NULL);
+        mpz_set_ui(data->sigs[i], 65537);
+    }
+    rsa_make_pub_many(primes, data->msgs, data->sigs, MBEXP_LANES, 2, data->bits,
+        PRIME_ITERS_BPSW, 1, randstate_derive(data->seed, data->trial));
+    for (size_t i = 0; i < MBEXP_LANES; i++) {
+        mpz_clears(primes[2 * i], primes[2 * i + 1], NULL);
+    }
+    return;
+}
+
+// Makes a key of data->bits bits and a temporary file of data->bytes bytes of random plaintext
+static FILE *bench_key_plaintext(bench_data *data) {
+    FILE *plain = tmpfile();
+
+    mpz_set_ui(data->e, 65537);
+    rsa_make_pub(data->p, data->q, data->n, data->e, data->bits, PRIME_ITERS_BPSW);
+    rsa_make_priv(data->d, data->e, data->p, data->q);
+    for (size_t i = 0; i < data->bytes; i++) {
+        fputc(gmp_urandomb_ui(state, 8), plain);
+    }
+    rewind(plain);
+    return plain;
+}
+
+// The encrypt kernel reads the plaintext
+static void setup_encrypt_file(bench_data *data) {
+    data->in = bench_key_plaintext(data);
+    data->out_file = tmpfile();
+    return;
+}
+
+// The decrypt kernel reads the hex ciphertext of the plaintext
+static void setup_decrypt_file(bench_data *data) {
+    FILE *plain = bench_key_plaintext(data);
+
+    data->in = tmpfile();
+    rsa_encrypt_file(plain, data->in, data->n, data->e);
+    fclose(plain);
+    rewind(data->in);
+    data->out_file = tmpfile();
+    return;
+}
+
+static void run_encrypt_file(bench_data *data) {
+    rewind(data->in);
+    rewind(data->out_file);
+    rsa_encrypt_file(data->in, data->out_file, data->n, data->e);
+    fflush(data->out_file);
+    return;
+}
+
+static void run_decrypt_file(bench_data *data) {
+    rewind(data->in);
+    rewind(data->out_file);
+    rsa_decrypt_file(data->in, data->out_file, data->n, data->d);
+    fflush(data->out_file);
+    return;
+}
+
+// The hybrid encrypt kernel reads the plaintext through a public key context
+static void setup_encrypt_hybrid(bench_data *data) {
+    setup_encrypt_file(data);
+    data->ctx = (rsa_key_ctx *) malloc(sizeof(rsa_key_ctx));
+    rsa_ctx_init_pub(data->ctx, data->n, data->e);
+    return;
+}
+
+// The hybrid decrypt kernel reads a hybrid container of the plaintext
+static void setup_decrypt_hybrid(bench_data *data) {
+    FILE *plain = bench_key_plaintext(data);
+
+    data->ctx = (rsa_key_ctx *) malloc(sizeof(rsa_key_ctx));
+    rsa_ctx_init_pub(data->ctx, data->n, data->e);
+    data->in = tmpfile();
+    rsa_ctx_encrypt_file_hybrid(data->ctx, plain, data->in);
+    fflush(data->in);
+    fclose(plain);
+    rsa_ctx_clear(data->ctx);
+    rsa_ctx_init_priv(data->ctx, data->n, data->d);
+    data->out_file = tmpfile();
+    return;
+}
+
+static void run_encrypt_hybrid(bench_data *data) {
+    rewind(data->in);
+    rewind(data->out_file);
+    rsa_ctx_encrypt_file_hybrid(data->ctx, data->in, data->out_file);
+    fflush(data->out_file);
+    return;
+}
+
+static void run_decrypt_hybrid(bench_data *data) {
+    rewind(data->in);
+    rewind(data->out_file);
+    rsa_ctx_decrypt_file_bin(data->ctx, data->in, data->out_file);
+    fflush(data->out_file);
+    return;
+}
+
+// A CRT private key context of the given number of primes and MBEXP_LANES random messages below n
+// Signs the messages as one batch and one at a time and exits if any signature differs, so every
+// run of the suite checks the SIMD lanes against the scalar path
+static void bench_sign_key(bench_data *data, size_t primes) {
+    mpz_t dp, dq, qinv;
+    mpz_t r[RSA_PRIMES_MAX], dr[RSA_EXTRA_PRIMES], tr[RSA_EXTRA_PRIMES];
+
+    mpz_inits(dp, dq, qinv, NULL);
+    for (size_t i = 0; i < RSA_PRIMES_MAX; i++) {
+        mpz_init(r[i]);
+    }
+    for (size_t i = 0; i < RSA_EXTRA_PRIMES; i++) {
+        mpz_inits(dr[i], tr[i], NULL);
+    }
+    mpz_set_ui(data->e, 65537);
+    if (primes > 2) {
+        rsa_make_pub_multi(r, primes, data->n, data->e, data->bits, PRIME_ITERS_BPSW, 1,
+            randstate_derive(data->seed, data->bits));
+        mpz_set(data->p, r[0]);
+        mpz_set(data->q, r[1]);
+        rsa_make_priv_multi(data->d, data->e, r, primes);
+        rsa_make_crt_extra(dr, tr, data->d, r, primes);
+    } else {
+        rsa_make_pub(data->p, data->q, data->n, data->e, data->bits, PRIME_ITERS_BPSW);
+        rsa_make_priv(data->d, data->e, data->p, data->q);
+    }
+    rsa_make_crt(dp, dq, qinv, data->d, data->p, data->q);
+    data->ctx = (rsa_key_ctx *) malloc(sizeof(rsa_key_ctx));
+    rsa_ctx_init_multi(
+        data->ctx, data->n, data->p, data->q, dp, dq, qinv, r + 2, dr, tr, primes - 2);
+    mpz_clears(dp, dq, qinv, NULL);
+    for (size_t i = 0; i < RSA_PRIMES_MAX; i++) {
+        mpz_clear(r[i]);
+    }
+    for (size_t i = 0; i < RSA_EXTRA_PRIMES; i++) {
+        mpz_clears(dr[i], tr[i], NULL);
+    }
+
+    for (size_t i = 0; i < MBEXP_LANES; i++) {
+        mpz_urandomm(data->msgs[i], state, data->n);
+    }
+    rsa_sign_batch(data->sigs, data->msgs, MBEXP_LANES, data->ctx);
+    for (size_t i = 0; i < MBEXP_LANES; i++) {
+        rsa_ctx_sign(data->ctx, data->out, data->msgs[i]);
+        if (mpz_cmp(data->out, data->sigs[i]) != 0) {
+            printf("Batch signature %zu differs from the scalar path.\n", i);
+            exit(1);
+        }
+    }
+    return;
+}
+
+static void setup_sign(bench_data *data) {
+    bench_sign_key(data, 2);
+    return;
+}
+
+static void setup_sign_3primes(bench_data *data) {
+    bench_sign_key(data, 3);
+    return;
+}
+
+static void setup_sign_4primes(bench_data *data) {
+    bench_sign_key(data, 4);
+    return;
+}
+
+static void run_sign_batch(bench_data *data) {
+    rsa_sign_batch(data->sigs, data->msgs, MBEXP_LANES, data->ctx);
+    return;
+}
+
+static void run_sign_each(bench_data *data) {
+    for (size_t i = 0; i < MBEXP_LANES; i++) {
+        rsa_ctx_sign(data->ctx, data->sigs[i], data->msgs[i]);
+    }
+    return;
+}
+
+// Checks that rsa_verify_batch marks exactly the pairs in forged[] invalid, several times since the
+// batch check is randomized, and exits with an error if it doesn't
+static void bench_verify_forged(bench_data *data, size_t forged[], size_t count) {
+    for (size_t i = 0; i < count; i++) { // n - s raises to -m, the sign a batch check can miss
+        mpz_sub(data->verify_s[forged[i]], data->n, data->verify_s[forged[i]]);
+    }
+    for (int run = 0; run < 8; run++) {
+        rsa_verify_batch(data->valid, data->verify_m, data->verify_s, BENCH_VERIFY_COUNT, data->ctx);
+        for (size_t i = 0; i < BENCH_VERIFY_COUNT; i++) {
+            bool bad = false;
+            for (size_t j = 0; j < count; j++) {
+                bad = bad || forged[j] == i;
+            }
+            if (data->valid[i] == bad) {
+                printf("Batch verify got signature %zu wrong with %zu negated.\n", i, count);
+                exit(1);
+            }
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        mpz_sub(data->verify_s[forged[i]], data->n, data->verify_s[forged[i]]);
+    }
+    return;
+}
+
+// Signs BENCH_VERIFY_COUNT messages under a key with an exponent as large as n, where verify uses
+// the batch check, then makes sure negated signatures are caught
+static void setup_verify(bench_data *data) {
+    rsa_key_ctx priv;
+    size_t pair[] = { 0, 1 };
+    size_t single[] = { 100 };
+    size_t spread[] = { 3, 64, 130, 255 };
+
+    mpz_set_ui(data->e, 0);
+    rsa_make_pub(data->p, data->q, data->n, data->e, data->bits, PRIME_ITERS_BPSW);
+    rsa_make_priv(data->d, data->e, data->p, data->q);
+    data->verify_m = (mpz_t *) malloc(BENCH_VERIFY_COUNT * sizeof(mpz_t));
+    data->verify_s = (mpz_t *) malloc(BENCH_VERIFY_COUNT * sizeof(mpz_t));
+    data->valid = (bool *) calloc(BENCH_VERIFY_COUNT, sizeof(bool));
+    for (size_t i = 0; i < BENCH_VERIFY_COUNT; i++) {
+        mpz_inits(data->verify_m[i], data->verify_s[i], NULL);
+        mpz_urandomm(data->verify_m[i], state, data->n);
+    }
+    rsa_ctx_init_priv(&priv, data->n, data->d);
+    rsa_sign_batch(data->verify_s, data->verify_m, BENCH_VERIFY_COUNT, &priv);
+    rsa_ctx_clear(&priv);
+    data->ctx = (rsa_key_ctx *) malloc(sizeof(rsa_key_ctx));
+    rsa_ctx_init_pub(data->ctx, data->n, data->e);
+
+    bench_verify_forged(data, NULL, 0);
+    bench_verify_forged(data, pair, 2);
+    bench_verify_forged(data, single, 1);
+    bench_verify_forged(data, spread, 4);
+    return;
+}
+
+static void run_verify_batch(bench_data *data) {
+    rsa_verify_batch(data->valid, data->verify_m, data->verify_s, BENCH_VERIFY_COUNT, data->ctx);
+    return;
+}
+
+// Returns the nanoseconds from start to stop
+static uint64_t elapsed_ns(struct timespec *start, struct timespec *stop) {
+    return (uint64_t) (stop->tv_sec - start->tv_sec) * 1000000000 + stop->tv_nsec - start->tv_nsec;
+}
+
+static int compare_u64(const void *x, const void *y) {
+    uint64_t a = *(const uint64_t *) x;
+    uint64_t b = *(const uint64_t *) y;
+    return (a > b) - (a < b);
+}
+
+// Runs one kernel and prints its JSON object, with the median and p99 by nearest rank
+static void bench_kernel_run(
+    FILE *outfile, bench_kernel *kernel, int trials, int warmup, uint64_t seed, bool first) {
+    bench_data data;
+    struct timespec start, stop;
+    uint64_t *times = (uint64_t *) calloc(trials, sizeof(uint64_t));
+
+    memset(&data, 0, sizeof(data));
+    data.bits = kernel->bits;
+    data.bytes = kernel->bytes;
+    data.seed = seed;
+    mpz_inits(data.a, data.b, data.n, data.out, data.p, data.q, data.e, data.d, NULL);
+    for (size_t i = 0; i < MBEXP_LANES; i++) {
+        mpz_inits(data.msgs[i], data.sigs[i], NULL);
+    }
+    gmp_randseed_ui(state, randstate_derive(seed, UINT64_MAX)); // Same inputs on every run
+    kernel->setup(&data);
+
+    for (int i = 0; i < warmup; i++) {
+        data.trial = i;
+        kernel->run(&data);
+    }
+    for (int i = 0; i < trials; i++) {
+        data.trial = i; // Warmup and trials see the same sequence of random inputs
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        kernel->run(&data);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        times[i] = elapsed_ns(&start, &stop);
+    }
+    qsort(times, trials, sizeof(uint64_t), compare_u64);
+
+    uint64_t median = times[trials / 2];
+    uint64_t p99 = times[(99 * trials + 99) / 100 - 1];
+    fprintf(outfile, "%s\n    {\"name\": \"%s\", \"trials\": %d, \"median_ns\": %" PRIu64
+                     ", \"p99_ns\": %" PRIu64 ", \"min_ns\": %" PRIu64 ", \"max_ns\": %" PRIu64,
+        first == true ? "" : ",", kernel->name, trials, median, p99, times[0], times[trials - 1]);
+    if (kernel->bytes > 0) { // Throughput at the median, in plaintext bytes
+        fprintf(outfile, ", \"bytes\": %zu, \"median_mb_per_s\": %.3f", kernel->bytes,
+            kernel->bytes * 1e3 / (median > 0 ? median : 1));
+    }
+    fprintf(outfile, "}");
+    fflush(outfile);
+
+    if (data.in != NULL) {
+        fclose(data.in);
+        fclose(data.out_file);
+    }
+    if (data.ctx != NULL) {
+        rsa_ctx_clear(data.ctx);
+        free(data.ctx);
+    }
+    if (data.ws != NULL) {
+        numtheory_ws_clear(data.ws);
+        free(data.ws);
+    }
+    for (size_t i = 0; i < MBEXP_LANES; i++) {
+        mpz_clears(data.msgs[i], data.sigs[i], NULL);
+    }
+    if (data.verify_m != NULL) {
+        for (size_t i = 0; i < BENCH_VERIFY_COUNT; i++) {
+            mpz_clears(data.verify_m[i], data.verify_s[i], NULL);
+        }
+    }
+    mpz_clears(data.a, data.b, data.n, data.out, data.p, data.q, data.e, data.d, NULL);
+    free(data.verify_m);
+    free(data.verify_s);
+    free(data.valid);
+    free(data.hex);
+    free(times);
+    return;
+}
+
+// The fixed suite, names stay the same between releases so results can be compared
+static bench_kernel kernels[] = {
+    { "pow_mod_1024", setup_pow_mod, run_pow_mod, 1024, 0, false },
+    { "pow_mod_2048", setup_pow_mod, run_pow_mod, 2048, 0, false },
+    { "pow_mod_3072", setup_pow_mod, run_pow_mod, 3072, 0, false },
+    { "pow_mod_4096", setup_pow_mod, run_pow_mod, 4096, 0, false },
+    { "pow_mod_ws_2048", setup_pow_mod_ws, run_pow_mod_ws, 2048, 0, false },
+    { "is_prime_prime_1024", setup_prime, run_is_prime, 1024, 0, false },
+    { "is_prime_prime_2048", setup_prime, run_is_prime, 2048, 0, false },
+    { "is_prime_composite_1024", setup_composite, run_is_prime, 1024, 0, false },
+    { "is_prime_composite_2048", setup_composite, run_is_prime, 2048, 0, false },
+    { "is_prime_ws_composite_1024", setup_composite_ws, run_is_prime_ws, 1024, 0, false },
+    { "make_prime_512", setup_none, run_make_prime, 512, 0, true },
+    { "make_prime_1024", setup_none, run_make_prime, 1024, 0, true },
+    { "gcd_2048", setup_gcd, run_gcd, 2048, 0, false },
+    { "mod_inverse_2048", setup_gcd, run_mod_inverse, 2048, 0, false },
+    { "mod_inverse_batch_2048", setup_inverse_batch, run_inverse_batch, 2048, 0, false },
+    { "hex_encode_4096", setup_hex, run_hex_encode, 4096, 0, false },
+    { "hex_decode_4096", setup_hex, run_hex_decode, 4096, 0, false },
+    { "rsa_make_pub_1024", setup_none, run_make_pub, 1024, 0, true },
+    { "rsa_make_pub_2048", setup_none, run_make_pub, 2048, 0, true },
+    { "rsa_make_pub_many_1024", setup_none, run_make_pub_many, 1024, 0, true },
+    { "sign_batch_1024", setup_sign, run_sign_batch, 1024, 0, false },
+    { "sign_batch_2048", setup_sign, run_sign_batch, 2048, 0, false },
+    { "sign_each_2048", setup_sign, run_sign_each, 2048, 0, false },
+    { "verify_batch_1024", setup_verify, run_verify_batch, 1024, 0, true },
+    { "sign_each_4096", setup_sign, run_sign_each, 4096, 0, true },
+    { "sign_each_4096_3primes", setup_sign_3primes, run_sign_each, 4096, 0, true },
+    { "sign_each_4096_4primes", setup_sign_4primes, run_sign_each, 4096, 0, true },
+    { "encrypt_file_4k", setup_encrypt_file, run_encrypt_file, BENCH_FILE_BITS, 4096, false },
+    { "encrypt_file_64k", setup_encrypt_file, run_encrypt_file, BENCH_FILE_BITS, 65536, true },
+    { "encrypt_file_256k", setup_encrypt_file, run_encrypt_file, BENCH_FILE_BITS, 262144, true },
+    { "decrypt_file_4k", setup_decrypt_file, run_decrypt_file, BENCH_FILE_BITS, 4096, false },
+    { "decrypt_file_64k", setup_decrypt_file, run_decrypt_file, BENCH_FILE_BITS, 65536, true },
+    { "decrypt_file_256k", setup_decrypt_file, run_decrypt_file, BENCH_FILE_BITS, 262144, true },
+    { "encrypt_hybrid_256k", setup_encrypt_hybrid, run_encrypt_hybrid, BENCH_FILE_BITS, 262144,
+        false },
+    { "encrypt_hybrid_4m", setup_encrypt_hybrid, run_encrypt_hybrid, BENCH_FILE_BITS, 4194304,
+        false },
+    { "decrypt_hybrid_256k", setup_decrypt_hybrid, run_decrypt_hybrid, BENCH_FILE_BITS, 262144,
+        false },
+    { "decrypt_hybrid_4m", setup_decrypt_hybrid, run_decrypt_hybrid, BENCH_FILE_BITS, 4194304,
+        false },
+};
+
+// Main function that runs the benchmark suite
+int main(int argc, char **argv) {
+    int opt = 0;
+    int trials = 21;
+    int macro_trials = 5;
+    int warmup = 2;
+    uint64_t seed = 2024;
+    char *filter = NULL;
+    FILE *outfile = stdout;
+    bool first = true;
+
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'h': help_message(); return -1;
+        case 'n': trials = atoi(optarg); break;
+        case 'N': macro_trials = atoi(optarg); break;
+        case 'w': warmup = atoi(optarg); break;
+        case 's': seed = strtoull(optarg, NULL, 10); break;
+        case 'k': filter = optarg; break;
+        case 'o': outfile = fopen(optarg, "w"); break;
+        }
+    }
+
+    if (outfile == NULL) {
+        printf("Error opening outfile.\n");
+        return -1;
+    }
+    if (trials < 1 || macro_trials < 1 || warmup < 0) {
+        printf("Trials must be at least 1 and warmup at least 0.\n");
+        return -1;
+    }
+
+    randstate_init(seed);
+    fprintf(outfile, "{\n  \"seed\": %" PRIu64 ",\n  \"warmup\": %d,\n", seed, warmup);
+    fprintf(outfile, "  \"results\": [");
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (filter != NULL && strstr(kernels[i].name, filter) == NULL) {
+            continue;
+        }
+        bench_kernel_run(outfile, &kernels[i], kernels[i].macro == true ? macro_trials : trials,
+            warmup, seed, first);
+        first = false;
+    }
+    fprintf(outfile, "\n  ]\n}\n");
+
+    randstate_clear();
+    fclose(outfile);
+    return 0;
+}
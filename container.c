@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "container.h"
+#include <gmp.h>
+
+// Stores the low bytes bytes of value at out, most significant first
+static void container_put(uint8_t *out, uint64_t value, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--) {
+        out[i] = value & 0xFF;
+        value >>= 8;
+    }
+    return;
+}
+
+// Loads a number stored most significant byte first in bytes bytes at in
+static uint64_t container_get(uint8_t *in, int bytes) {
+    uint64_t value = 0;
+
+    for (int i = 0; i < bytes; i++) {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+// Computes a 64-bit FNV-1a hash of the big-endian bytes of n
+// Identifies which key a container was made for, it is not a security check
+uint64_t container_fingerprint(mpz_t n) {
+    uint64_t hash = 0xcbf29ce484222325; // FNV offset basis
+    size_t count = 0;
+    uint8_t *bytes = (uint8_t *) mpz_export(NULL, &count, 1, sizeof(uint8_t), 1, 0, n);
+
+    for (size_t i = 0; i < count; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3; // FNV prime
+    }
+    free(bytes);
+    return hash;
+}
+
+// Stores the container header in the CONTAINER_HEADER_SIZE bytes at buf
+void container_pack_header(container_header *header, uint8_t *buf) {
+    memset(buf, 0, CONTAINER_HEADER_SIZE);
+    memcpy(buf, CONTAINER_MAGIC, 4);
+    buf[4] = header->version;
+    buf[5] = header->mode;
+    container_put(buf + 8, header->k, 4);
+    container_put(buf + 12, header->width, 4);
+    container_put(buf + 16, header->fingerprint, 8);
+    return;
+}
+
+// Writes the container header to outfile
+void container_write_header(container_header *header, FILE *outfile) {
+    uint8_t buf[CONTAINER_HEADER_SIZE];
+
+    container_pack_header(header, buf);
+    fwrite(buf, sizeof(uint8_t), CONTAINER_HEADER_SIZE, outfile);
+    return;
+}
+
+// Reads a container header out of the CONTAINER_HEADER_SIZE bytes at buf
+// Returns false if the magic or version doesn't match
+bool container_parse_header(container_header *header, uint8_t *buf) {
+    if (memcmp(buf, CONTAINER_MAGIC, 4) != 0 || buf[4] != CONTAINER_VERSION) {
+        return false;
+    }
+    header->version = buf[4];
+    header->mode = buf[5];
+    header->k = container_get(buf + 8, 4);
+    header->width = container_get(buf + 12, 4);
+    header->fingerprint = container_get(buf + 16, 8);
+    return true;
+}
+
+// Reads a container header from infile
+// Returns false if the magic or version doesn't match
+bool container_read_header(container_header *header, FILE *infile) {
+    uint8_t buf[CONTAINER_HEADER_SIZE];
+
+    if (fread(buf, sizeof(uint8_t), CONTAINER_HEADER_SIZE, infile) != CONTAINER_HEADER_SIZE) {
+        return false;
+    }
+    return container_parse_header(header, buf);
+}
+
+// Stores the footer recording the plaintext length in the CONTAINER_FOOTER_SIZE bytes at buf
+void container_pack_footer(uint64_t length, uint8_t *buf) {
+    memset(buf, 0, CONTAINER_FOOTER_SIZE);
+    memcpy(buf, CONTAINER_FOOTER_MAGIC, 4);
+    container_put(buf + 8, length, 8);
+    return;
+}
+
+// Writes the footer recording the plaintext length to outfile
+void container_write_footer(uint64_t length, FILE *outfile) {
+    uint8_t buf[CONTAINER_FOOTER_SIZE];
+
+    container_pack_footer(length, buf);
+    fwrite(buf, sizeof(uint8_t), CONTAINER_FOOTER_SIZE, outfile);
+    return;
+}
+
+// Reads the plaintext length out of the CONTAINER_FOOTER_SIZE bytes at footer
+// Returns false if the footer magic doesn't match
+bool container_parse_footer(uint64_t *length, uint8_t *footer) {
+    if (memcmp(footer, CONTAINER_FOOTER_MAGIC, 4) != 0) {
+        return false;
+    }
+    *length = container_get(footer + 8, 8);
+    return true;
+}
+
+// Reads the footer at the end of a seekable infile, leaving the file position at the end
+// Returns false if the file can't be seeked or doesn't end in a footer
+bool container_read_footer(uint64_t *length, FILE *infile) {
+    uint8_t buf[CONTAINER_FOOTER_SIZE];
+
+    if (fseeko(infile, -CONTAINER_FOOTER_SIZE, SEEK_END) != 0) {
+        return false;
+    }
+    if (fread(buf, sizeof(uint8_t), CONTAINER_FOOTER_SIZE, infile) != CONTAINER_FOOTER_SIZE) {
+        return false;
+    }
+    return container_parse_footer(length, buf);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <gmp.h>
+
+// Binary ciphertext container
+// header | block 0 | block 1 | ... | footer
+// Every block is one ciphertext, big-endian and zero padded to width bytes, so block i
+// starts at CONTAINER_HEADER_SIZE + i * width and holds plaintext bytes [i * (k - 1), (i + 1) * (k - 1))
+
+#define CONTAINER_MAGIC "RSAC"
+#define CONTAINER_FOOTER_MAGIC "RSAE"
+#define CONTAINER_VERSION 1
+#define CONTAINER_HEADER_SIZE 24 // magic, version, mode, 2 reserved, k, width, fingerprint
+#define CONTAINER_FOOTER_SIZE 16 // magic, 4 reserved, plaintext length
+
+// How the payload after the header is encrypted
+typedef enum { CONTAINER_MODE_BLOCKS = 0, CONTAINER_MODE_HYBRID = 1 } container_mode;
+
+// Hybrid payload
+// header | wrapped key | record 0 | record 1 | ... | footer
+// The wrapped key is a random AEAD key encrypted like plaintext, in whole blocks of width bytes
+// Each record is a 4-byte big-endian length, then that many bytes of ChaCha20-Poly1305 ciphertext
+// and the tag. Only the last record has CONTAINER_RECORD_FINAL set in its length, and it is always
+// shorter than CONTAINER_RECORD_SIZE, empty if it has to be
+// Record i is sealed with nonce i and the final flag, and the packed header as additional data,
+// so records can't be reordered, dropped, or cut off without decrypt noticing
+#define CONTAINER_RECORD_SIZE (1 << 16) // Plaintext bytes in every record but the last
+#define CONTAINER_RECORD_FINAL 0x80000000
+
+typedef struct {
+    uint8_t version;
+    uint8_t mode;
+    uint32_t k; // Block size of the key, each block carries k - 1 bytes of plaintext
+    uint32_t width; // Bytes per ciphertext block, enough for any number below n
+    uint64_t fingerprint; // container_fingerprint of n
+} container_header;
+
+uint64_t container_fingerprint(mpz_t n);
+
+void container_pack_header(container_header *header, uint8_t *buf);
+
+void container_write_header(container_header *header, FILE *outfile);
+
+bool container_parse_header(container_header *header, uint8_t *buf);
+
+bool container_read_header(container_header *header, FILE *infile);
+
+void container_pack_footer(uint64_t length, uint8_t *buf);
+
+void container_write_footer(uint64_t length, FILE *outfile);
+
+bool container_parse_footer(uint64_t *length, uint8_t *footer);
+
+bool container_read_footer(uint64_t *length, FILE *infile);
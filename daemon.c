@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "daemon.h"
+
+// Stores the header of a request or response in the DAEMON_HEADER_SIZE bytes at buf
+// code is the op of a request or the status of a response, key is 0 in a response
+void daemon_pack_header(uint8_t *buf, uint32_t length, uint8_t code, uint8_t key) {
+    memset(buf, 0, DAEMON_HEADER_SIZE);
+    for (int i = 3; i >= 0; i--) {
+        buf[i] = length & 0xFF;
+        length >>= 8;
+    }
+    buf[4] = code;
+    buf[5] = key;
+    return;
+}
+
+// Loads the fields of a header packed by daemon_pack_header
+void daemon_parse_header(uint8_t *buf, uint32_t *length, uint8_t *code, uint8_t *key) {
+    *length = 0;
+    for (int i = 0; i < 4; i++) {
+        *length = (*length << 8) | buf[i];
+    }
+    *code = buf[4];
+    *key = buf[5];
+    return;
+}
+
+// Reads exactly len bytes from fd into buf, retrying short reads
+// Returns false if the peer closed the connection first or the read failed
+bool daemon_read_full(int fd, uint8_t *buf, size_t len) {
+    while (len > 0) {
+        ssize_t got = read(fd, buf, len);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        buf += got;
+        len -= got;
+    }
+    return true;
+}
+
+// Writes all len bytes of buf to fd, retrying short writes
+// Returns false if the peer went away or the write failed
+bool daemon_write_full(int fd, uint8_t *buf, size_t len) {
+    while (len > 0) {
+        ssize_t put = write(fd, buf, len);
+        if (put < 0 && errno == EINTR) {
+            continue;
+        }
+        if (put <= 0) {
+            return false;
+        }
+        buf += put;
+        len -= put;
+    }
+    return true;
+}
+
+// Fills in the socket address of path, returns false if path is too long for it
+static bool daemon_address(struct sockaddr_un *address, char *path) {
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        return false;
+    }
+    strcpy(address->sun_path, path);
+    return true;
+}
+
+// Connects to the daemon listening on the socket at path
+// Returns the connected socket, or -1 if nothing is listening there
+int daemon_connect(char *path) {
+    struct sockaddr_un address;
+    int fd;
+
+    if (daemon_address(&address, path) == false || (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Creates a listening socket at path, readable and writable by its owner only like a private key
+// A socket file left behind by a daemon that is gone is replaced, one that still answers isn't
+// Returns the socket, or -1 if another daemon is listening at path or the socket can't be made
+int daemon_listen(char *path) {
+    struct sockaddr_un address;
+    int fd = daemon_connect(path);
+
+    if (fd >= 0) { // Someone is still serving on this path
+        close(fd);
+        return -1;
+    }
+    if (daemon_address(&address, path) == false || (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        return -1;
+    }
+    unlink(path);
+    mode_t mask = umask(077); // The socket is made 0600, there is no moment it's open to others
+    bool bound = bind(fd, (struct sockaddr *) &address, sizeof(address)) == 0;
+    umask(mask);
+    if (bound == false || chmod(path, 0600) != 0 || listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Sends one request on a connected socket and waits for its response
+// On success *answer is a malloc'd buffer of *answer_len bytes, NULL if the answer is empty
+// Returns false if the connection failed or the response was malformed
+bool daemon_request(int fd, daemon_op op, uint8_t key, uint8_t *payload, size_t len,
+    uint8_t *status, uint8_t **answer, size_t *answer_len) {
+    uint8_t header[DAEMON_HEADER_SIZE];
+    uint32_t length;
+    uint8_t unused;
+
+    *answer = NULL;
+    *answer_len = 0;
+    if (len > DAEMON_PAYLOAD_MAX) {
+        return false;
+    }
+    daemon_pack_header(header, len, op, key);
+    if (daemon_write_full(fd, header, DAEMON_HEADER_SIZE) == false
+        || daemon_write_full(fd, payload, len) == false
+        || daemon_read_full(fd, header, DAEMON_HEADER_SIZE) == false) {
+        return false;
+    }
+    daemon_parse_header(header, &length, status, &unused);
+    if (length > DAEMON_PAYLOAD_MAX) {
+        return false;
+    }
+    if (length > 0) {
+        *answer = (uint8_t *) malloc(length);
+        if (daemon_read_full(fd, *answer, length) == false) {
+            free(*answer);
+            *answer = NULL;
+            return false;
+        }
+    }
+    *answer_len = length;
+    return true;
+}
+
+// Counts one request that took ns nanoseconds
+void daemon_histogram_add(daemon_histogram *histogram, uint64_t ns) {
+    uint64_t us = ns / 1000;
+    size_t bucket = 0;
+
+    while (bucket < DAEMON_HISTOGRAM_BUCKETS - 1 && us >= ((uint64_t) 1 << bucket)) {
+        bucket++;
+    }
+    histogram->buckets[bucket] += 1;
+    histogram->count += 1;
+    histogram->total_ns += ns;
+    histogram->max_ns = ns > histogram->max_ns ? ns : histogram->max_ns;
+    return;
+}
+
+// Returns the upper bound in microseconds of the bucket that holds the given fraction of requests
+static uint64_t daemon_histogram_quantile(daemon_histogram *histogram, double fraction) {
+    uint64_t want = (uint64_t) (histogram->count * fraction);
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < DAEMON_HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen > want) {
+            return (uint64_t) 1 << i;
+        }
+    }
+    return (uint64_t) 1 << (DAEMON_HISTOGRAM_BUCKETS - 1);
+}
+
+// Prints the request count, mean, quantiles, and every non-empty bucket of a histogram
+void daemon_histogram_print(daemon_histogram *histogram, char *name, FILE *outfile) {
+    fprintf(outfile, "%s: %" PRIu64 " requests", name, histogram->count);
+    if (histogram->count == 0) {
+        fprintf(outfile, "\n");
+        return;
+    }
+    fprintf(outfile, ", mean %" PRIu64 " us, p50 < %" PRIu64 " us, p99 < %" PRIu64 " us",
+        histogram->total_ns / histogram->count / 1000, daemon_histogram_quantile(histogram, 0.5),
+        daemon_histogram_quantile(histogram, 0.99));
+    fprintf(outfile, ", max %" PRIu64 " us\n", histogram->max_ns / 1000);
+    for (size_t i = 0; i < DAEMON_HISTOGRAM_BUCKETS; i++) {
+        if (histogram->buckets[i] == 0) {
+            continue;
+        }
+        if (i < DAEMON_HISTOGRAM_BUCKETS - 1) {
+            fprintf(outfile, "  < %" PRIu64 " us", (uint64_t) 1 << i);
+        } else {
+            fprintf(outfile, " >= %" PRIu64 " us", (uint64_t) 1 << (i - 1));
+        }
+        fprintf(outfile, ": %" PRIu64 "\n", histogram->buckets[i]);
+    }
+    return;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Protocol between rsad and its clients over a Unix-domain stream socket
+// request:  length (4 bytes, big-endian) | op | key | 2 reserved | length bytes of payload
+// response: length (4 bytes, big-endian) | status | 3 reserved | length bytes of answer
+// A connection carries any number of requests, each is answered before the next one is read
+
+#define DAEMON_SOCKET "rsad.sock"
+#define DAEMON_HEADER_SIZE 8
+#define DAEMON_PAYLOAD_MAX (1 << 26) // Largest payload or answer either side accepts, 64 MiB
+
+typedef enum {
+    DAEMON_OP_DECRYPT = 1, // Payload is a ciphertext in any format decrypt reads, answer plaintext
+    DAEMON_OP_SIGN = 2, // Payload is one message, answer is the signature in hex like sign writes
+    DAEMON_OP_STATS = 3 // No payload, answer is the latency histograms as text
+} daemon_op;
+
+typedef enum {
+    DAEMON_OK = 0,
+    DAEMON_BAD_REQUEST = 1, // Unknown op or a payload over DAEMON_PAYLOAD_MAX
+    DAEMON_BAD_KEY = 2, // The daemon has no key with that index
+    DAEMON_FAILED = 3 // Corrupt ciphertext or one for another key, or a message too long to sign
+} daemon_status;
+
+// Bucket i counts requests answered in under 2^i microseconds, the last bucket everything slower
+#define DAEMON_HISTOGRAM_BUCKETS 24
+
+typedef struct {
+    uint64_t buckets[DAEMON_HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+} daemon_histogram;
+
+void daemon_pack_header(uint8_t *buf, uint32_t length, uint8_t code, uint8_t key);
+
+void daemon_parse_header(uint8_t *buf, uint32_t *length, uint8_t *code, uint8_t *key);
+
+bool daemon_read_full(int fd, uint8_t *buf, size_t len);
+
+bool daemon_write_full(int fd, uint8_t *buf, size_t len);
+
+int daemon_listen(char *path);
+
+int daemon_connect(char *path);
+
+bool daemon_request(int fd, daemon_op op, uint8_t key, uint8_t *payload, size_t len,
+    uint8_t *status, uint8_t **answer, size_t *answer_len);
+
+void daemon_histogram_add(daemon_histogram *histogram, uint64_t ns);
+
+void daemon_histogram_print(daemon_histogram *histogram, char *name, FILE *outfile);
@@ -5,11 +5,21 @@
 #include <stdbool.h>
 #include <gmp.h>
 #include <unistd.h>
+#include <time.h>
+#include <getopt.h>
+#include "daemon.h"
 #include "numtheory.h"
 #include "randstate.h"
 #include "rsa.h"
+#include "stats.h"
 
-#define OPTIONS "hi:o:n:v"
+#define OPTIONS "hi:o:n:t:v"
+
+// Long only options for decrypting part of a binary container and for handing the work to rsad
+static struct option long_options[] = { { "offset", required_argument, NULL, 'O' },
+    { "length", required_argument, NULL, 'L' }, { "daemon", required_argument, NULL, 'D' },
+    { "key", required_argument, NULL, 'K' }, { "stats", no_argument, NULL, 'S' },
+    { NULL, 0, NULL, 0 } };
 
 // Prints out help message when called for in the getopt() loop
 void help_message(void) {
@@ -18,27 +28,134 @@ void help_message(void) {
     printf("   Encrypted data is encrypted by the encrypt program.\n");
     printf("\n");
     printf("USAGE\n");
-    printf("   ./decrypt [-hv] [-i infile] [-o outfile] -n privkey\n");
+    printf("   ./decrypt [-hv] [-t threads] [-i infile] [-o outfile] [--offset n] [--length n] -n privkey\n");
+    printf("   ./decrypt [-hv] [-i infile] [-o outfile] [--key index] [--stats] --daemon socket\n");
     printf("\n");
     printf("OPTIONS\n");
     printf("   -h              Display program help and usage.\n");
-    printf("   -v              Display verbose program output.\n");
+    printf("   -v              Display verbose program output on stderr.\n");
     printf("   -i infile       Input file of data to decrypt (default: stdin).\n");
     printf("   -o outfile      Output file for decrypted data (default: stdout).\n");
     printf("   -n pvfile       Private key file (default: rsa.priv).\n");
+    printf("   -t threads      Worker threads for decrypting blocks (default: 1).\n");
+    printf("   --offset n      Only decrypt plaintext from byte n on (binary infile only).\n");
+    printf("   --length n      Only decrypt n bytes of plaintext (binary infile only).\n");
+    printf("   --daemon socket Send the input to the rsad listening on socket instead of\n");
+    printf("                   reading a key.\n");
+    printf("   --key index     Which of the daemon's keys to decrypt with, 0 to 255\n");
+    printf("                   (default: 0).\n");
+    printf("   --stats         Print the daemon's latency histograms instead of decrypting.\n");
+    printf("   The ciphertext format, bin or hex, is detected from the input.\n");
     exit(0);
 }
 
+// Prints the bytes moved by the last file function and the rate they moved at to stderr, stdout
+// may be carrying the output
+static void print_throughput(rsa_key_ctx *ctx, struct timespec *start, struct timespec *stop) {
+    double seconds = (stop->tv_sec - start->tv_sec) + (stop->tv_nsec - start->tv_nsec) / 1e9;
+
+    seconds = seconds > 0 ? seconds : 1e-9;
+    fprintf(stderr, "read %" PRIu64 " bytes (%.2f MB/s)\n", ctx->bytes_read,
+        ctx->bytes_read / seconds / 1e6);
+    fprintf(stderr, "wrote %" PRIu64 " bytes (%.2f MB/s)\n", ctx->bytes_written,
+        ctx->bytes_written / seconds / 1e6);
+    fprintf(stderr, "took %.3f s\n", seconds);
+    return;
+}
+
+// Reads all of infile into a malloc'd buffer, sets *len to its size
+static uint8_t *read_all(FILE *infile, size_t *len) {
+    size_t cap = 1 << 16;
+    uint8_t *data = (uint8_t *) malloc(cap);
+    size_t got;
+
+    *len = 0;
+    while ((got = fread(data + *len, sizeof(uint8_t), cap - *len, infile)) > 0) {
+        *len += got;
+        if (*len == cap) {
+            cap *= 2;
+            data = (uint8_t *) realloc(data, cap);
+        }
+    }
+    return data;
+}
+
+// Turns the --key argument into a key index of rsad
+// Returns false unless it is a plain number from 0 to 255, so no other key is picked by mistake
+static bool parse_key(char *arg, uint8_t *key) {
+    char *end;
+    unsigned long index = strtoul(arg, &end, 10);
+
+    if (*arg < '0' || *arg > '9' || *end != '\0' || index > UINT8_MAX) {
+        return false;
+    }
+    *key = (uint8_t) index;
+    return true;
+}
+
+// Has the rsad at socket_path decrypt infile with its key number key, or print its statistics
+// Returns 0 on success and -1 after printing what went wrong
+static int decrypt_daemon(
+    char *socket_path, uint8_t key, bool stats, FILE *infile, FILE *outfile) {
+    int fd = daemon_connect(socket_path);
+    uint8_t *payload = NULL;
+    size_t len = 0;
+    uint8_t status;
+    uint8_t *answer;
+    size_t answer_len;
+    bool sent;
+
+    if (fd < 0) {
+        printf("Error connecting to rsad at %s.\n", socket_path);
+        return -1;
+    }
+    if (stats == false) {
+        payload = read_all(infile, &len);
+    }
+    sent = daemon_request(fd, stats == true ? DAEMON_OP_STATS : DAEMON_OP_DECRYPT, key, payload,
+        len, &status, &answer, &answer_len);
+    free(payload);
+    close(fd);
+
+    if (sent == false) {
+        printf("Error talking to rsad, the input may be too large.\n");
+        return -1;
+    } else if (status == DAEMON_BAD_KEY) {
+        printf("rsad has no key %u.\n", key);
+        return -1;
+    } else if (status != DAEMON_OK) {
+        printf("Error decrypting: the ciphertext is corrupt or was made for another key.\n");
+        return -1;
+    }
+    if (answer_len > 0) {
+        fwrite(answer, sizeof(uint8_t), answer_len, outfile);
+    }
+    free(answer);
+    return 0;
+}
+
 // Main function that holds the implementation of decrypting files
 int main(int argc, char **argv) {
     int opt = 0;
+    int threads = 1;
     FILE *infile = stdin;
     FILE *outfile = stdout;
     FILE *pvfile;
     char *pvfile_path = "rsa.priv";
     bool verbose = false; // Set to false, only true if user does "-v"
+    bool crt;
+    rsa_key_ctx ctx;
+    struct timespec start, stop;
+    rsa_format format;
+    bool range = false; // Set if --offset or --length was given
+    uint64_t offset = 0;
+    uint64_t length = UINT64_MAX;
+    bool ok = true;
+    char *daemon_path = NULL; // Set by --daemon, the key then stays with rsad
+    uint8_t daemon_key = 0;
+    bool daemon_stats = false;
 
-    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+    while ((opt = getopt_long(argc, argv, OPTIONS, long_options, NULL)) != -1) {
         switch (opt) {
         case 'h': help_message(); return -1;
         case 'i': infile = fopen(optarg, "r"); break;
@@ -46,10 +163,44 @@ int main(int argc, char **argv) {
             outfile = fopen(optarg, "w");
             break; // Open with "w" so we can write decryption to outfile later in the program
         case 'n': pvfile_path = optarg; break;
+        case 't': threads = atoi(optarg); break;
+        case 'O':
+            offset = strtoull(optarg, NULL, 10);
+            range = true;
+            break;
+        case 'L':
+            length = strtoull(optarg, NULL, 10);
+            range = true;
+            break;
+        case 'D': daemon_path = optarg; break;
+        case 'K':
+            if (parse_key(optarg, &daemon_key) == false) {
+                printf("--key takes a key index from 0 to 255.\n");
+                return -1;
+            }
+            break;
+        case 'S': daemon_stats = true; break;
         case 'v': verbose = true; break;
         }
     }
 
+    if (daemon_path != NULL) { // rsad already holds the key, so none is read here
+        if (range == true) {
+            printf("--offset and --length can't be used with --daemon.\n");
+            return -1;
+        }
+        if (infile == NULL || outfile == NULL) {
+            printf("Error opening infile or outfile.\n");
+            return -1;
+        }
+        int status = decrypt_daemon(daemon_path, daemon_key, daemon_stats, infile, outfile);
+        fclose(infile);
+        fclose(outfile);
+        return status;
+    }
+
+    stats_init(verbose); // Counters and stage timers, or a trace if RSA_TRACE is set
+
     pvfile = fopen(pvfile_path, "r"); // Open private key file
 
     if (pvfile == NULL) {
@@ -57,21 +208,72 @@ int main(int argc, char **argv) {
         return -1;
     }
 
-    mpz_t n, d;
-    mpz_inits(n, d, NULL);
+    mpz_t n, d, p, q, dp, dq, qinv;
+    mpz_inits(n, d, p, q, dp, dq, qinv, NULL);
+    mpz_t r[RSA_EXTRA_PRIMES], dr[RSA_EXTRA_PRIMES], tr[RSA_EXTRA_PRIMES]; // Multi-prime keys
+    size_t extra = 0;
+    for (size_t i = 0; i < RSA_EXTRA_PRIMES; i++) {
+        mpz_inits(r[i], dr[i], tr[i], NULL);
+    }
 
-    rsa_read_priv(n, d, pvfile); // Read in n and d from pvfile
+    crt = rsa_read_priv_crt(n, d, p, q, dp, dq, qinv, pvfile); // Read in the private key
+    if (crt == true) { // A multi-prime key has more primes after the CRT components
+        extra = rsa_read_priv_extra(r, dr, tr, pvfile);
+    }
 
     if (verbose == true) {
-        gmp_printf("n (%d bits) = %Zd\n", mpz_sizeinbase(n, 2), n);
-        gmp_printf("d (%d bits) = %Zd\n", mpz_sizeinbase(d, 2), d);
+        gmp_fprintf(stderr, "n (%d bits) = %Zd\n", mpz_sizeinbase(n, 2), n);
+        gmp_fprintf(stderr, "d (%d bits) = %Zd\n", mpz_sizeinbase(d, 2), d);
+        if (crt == true) {
+            gmp_fprintf(stderr, "p (%d bits) = %Zd\n", mpz_sizeinbase(p, 2), p);
+            gmp_fprintf(stderr, "q (%d bits) = %Zd\n", mpz_sizeinbase(q, 2), q);
+        }
+        for (size_t i = 0; i < extra; i++) {
+            gmp_fprintf(stderr, "r%zu (%d bits) = %Zd\n", i + 3, mpz_sizeinbase(r[i], 2), r[i]);
+        }
     }
 
-    rsa_decrypt_file(infile, outfile, n, d); // Decrypt infile and write it to outfile
+    if (crt == true) { // Keys with CRT components take the faster path
+        rsa_ctx_init_multi(&ctx, n, p, q, dp, dq, qinv, r, dr, tr, extra);
+    } else { // Old two line keys only have n and d
+        rsa_ctx_init_priv(&ctx, n, d);
+    }
+
+    format = rsa_detect_format(infile);
+    if (range == true && format != RSA_FORMAT_BIN) {
+        printf("--offset and --length need a binary ciphertext.\n");
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (range == true) { // Fixed-width blocks let us seek straight to the ones we need
+        ok = rsa_ctx_decrypt_range(&ctx, infile, outfile, offset, length);
+    } else if (threads > 1) { // Spread the blocks over worker threads, output is the same
+        ok = rsa_ctx_decrypt_file_threads(&ctx, infile, outfile, threads, format);
+    } else if (format == RSA_FORMAT_BIN) {
+        ok = rsa_ctx_decrypt_file_bin(&ctx, infile, outfile);
+    } else {
+        ok = rsa_ctx_decrypt_file(&ctx, infile, outfile); // Decrypt infile and write it to outfile
+    }
+    if (ok == false) {
+        printf("Error decrypting: the ciphertext is corrupt or was made for another key.\n");
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    if (verbose == true) { // Throughput of the file functions alone, key setup isn't counted
+        print_throughput(&ctx, &start, &stop);
+        stats_print(stderr);
+    }
+    stats_finish();
+    rsa_ctx_clear(&ctx);
 
     fclose(infile); // Close all the opened files
     fclose(outfile);
     fclose(pvfile);
 
-    mpz_clears(n, d, NULL);
+    mpz_clears(n, d, p, q, dp, dq, qinv, NULL);
+    for (size_t i = 0; i < RSA_EXTRA_PRIMES; i++) {
+        mpz_clears(r[i], dr[i], tr[i], NULL);
+    }
 }
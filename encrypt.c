@@ -4,12 +4,20 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <gmp.h>
+#include <getopt.h>
+#include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include "keystore.h"
 #include "numtheory.h"
 #include "randstate.h"
 #include "rsa.h"
+#include "stats.h"
 
-#define OPTIONS "hi:o:n:v"
+#define OPTIONS "hi:o:n:t:f:u:v"
+
+static struct option long_options[] = { { "keystore", required_argument, NULL, 'K' },
+    { NULL, 0, NULL, 0 } };
 
 // Print out the help message when called in the getopt() loop
 void help_message(void) {
@@ -18,29 +26,59 @@ void help_message(void) {
     printf("   Encrypted data is decrypted by the decrypt program.\n");
     printf("\n");
     printf("USAGE\n");
-    printf("   ./encrypt [-hv] [-i infile] [-o outfile] -n pubkey\n");
+    printf("   ./encrypt [-hv] [-t threads] [-f format] [-i infile] [-o outfile] -n pubkey\n");
+    printf("   ./encrypt [-hv] [-t threads] [-f format] [-i infile] [-o outfile]\n");
+    printf("             --keystore keystore -u user\n");
     printf("\n");
     printf("OPTIONS\n");
     printf("   -h              Display program help and usage.\n");
-    printf("   -v              Display verbose program output.\n");
+    printf("   -v              Display verbose program output on stderr.\n");
     printf("   -i infile       Input file of data to encrypt (default: stdin).\n");
     printf("   -o outfile      Output file for encrypted data (default: stdout).\n");
     printf("   -n pbfile       Public key file (default: rsa.pub).\n");
+    printf("   --keystore file Keystore made by storekeys to take the key from instead.\n");
+    printf("   -u user         User in the keystore to encrypt for.\n");
+    printf("   -t threads      Worker threads for encrypting blocks (default: 1).\n");
+    printf("   -f format       Ciphertext format, hex, bin, or hybrid (default: hex).\n");
+    printf("                   hybrid encrypts only a random key with RSA and the data with\n");
+    printf("                   ChaCha20-Poly1305, which is far faster on large inputs.\n");
     exit(0);
 }
 
+// Prints the bytes moved by the last file function and the rate they moved at to stderr, stdout
+// may be carrying the output
+static void print_throughput(rsa_key_ctx *ctx, struct timespec *start, struct timespec *stop) {
+    double seconds = (stop->tv_sec - start->tv_sec) + (stop->tv_nsec - start->tv_nsec) / 1e9;
+
+    seconds = seconds > 0 ? seconds : 1e-9;
+    fprintf(stderr, "read %" PRIu64 " bytes (%.2f MB/s)\n", ctx->bytes_read,
+        ctx->bytes_read / seconds / 1e6);
+    fprintf(stderr, "wrote %" PRIu64 " bytes (%.2f MB/s)\n", ctx->bytes_written,
+        ctx->bytes_written / seconds / 1e6);
+    fprintf(stderr, "took %.3f s\n", seconds);
+    return;
+}
+
 // Main function that contains the implementation to encrypt a file
 int main(int argc, char **argv) {
     int opt = 0;
+    int threads = 1;
     FILE *infile = stdin;
     FILE *outfile = stdout;
     FILE *pbfile;
     char *pbfile_path = "rsa.pub";
+    char *keystore_path = NULL;
+    char *user = NULL;
+    keystore ks;
     bool verbose = false;
     bool verify;
     char username[32]; // initialize username array to call rsa_read_pub later
+    rsa_key_ctx ctx;
+    struct timespec start, stop;
+    rsa_format format = RSA_FORMAT_HEX; // Existing consumers of encrypt read hex lines
+    bool ok = true;
 
-    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+    while ((opt = getopt_long(argc, argv, OPTIONS, long_options, NULL)) != -1) {
         switch (opt) {
         case 'h': help_message(); return -1;
         case 'i': infile = fopen(optarg, "r"); break; // open if specified
@@ -48,41 +86,114 @@ int main(int argc, char **argv) {
             outfile = fopen(optarg, "w");
             break; // open with "w" to be able to write encryption to outfile
         case 'n': pbfile_path = optarg; break;
+        case 'K': keystore_path = optarg; break;
+        case 'u': user = optarg; break;
+        case 't': threads = atoi(optarg); break;
+        case 'f':
+            if (strcmp(optarg, "hex") == 0) { // Hex lines are kept for older tools
+                format = RSA_FORMAT_HEX;
+            } else if (strcmp(optarg, "bin") == 0) {
+                format = RSA_FORMAT_BIN;
+            } else if (strcmp(optarg, "hybrid") == 0) { // RSA only wraps a ChaCha20-Poly1305 key
+                format = RSA_FORMAT_HYBRID;
+            } else {
+                printf("Unknown format %s, use bin, hex, or hybrid.\n", optarg);
+                return -1;
+            }
+            break;
         case 'v': verbose = true; break;
         }
     }
 
-    pbfile = fopen(pbfile_path, "r"); // open the public key file
-
-    if (pbfile == NULL) {
-        printf("Error opening pbfile.\n");
+    if ((keystore_path == NULL) != (user == NULL)) {
+        printf("--keystore needs -u user, and -u needs --keystore.\n");
         return -1;
     }
 
+    stats_init(verbose); // Counters and stage timers, or a trace if RSA_TRACE is set
+
     mpz_t n, e, s, m;
     mpz_inits(n, e, s, m, NULL);
 
-    rsa_read_pub(n, e, s, username, pbfile); // Reads in n, e, s, and username from pbfile
+    pbfile = NULL;
+    if (keystore_path != NULL) { // The key is looked up in the mapped keystore, nothing is parsed
+        if (keystore_open(&ks, keystore_path) == false) {
+            printf("Error opening keystore %s.\n", keystore_path);
+            return -1;
+        }
+        keystore_record *record = keystore_find_user(&ks, user);
+        if (record == NULL) {
+            printf("No key for user %s in %s.\n", user, keystore_path);
+            return -1;
+        }
+        mpz_t stored_n, stored_e, stored_s;
+        keystore_key(record, stored_n, stored_e, stored_s);
+        mpz_set(n, stored_n);
+        mpz_set(e, stored_e);
+        mpz_set(s, stored_s);
+        strcpy(username, record->username);
+        keystore_close(&ks);
+    } else {
+        pbfile = fopen(pbfile_path, "r"); // open the public key file
+
+        if (pbfile == NULL) {
+            printf("Error opening pbfile.\n");
+            return -1;
+        }
+
+        rsa_read_pub(n, e, s, username, pbfile); // Reads in n, e, s, and username from pbfile
+    }
 
     if (verbose == true) {
-        printf("user = %s\n", username);
-        gmp_printf("s (%d bits) = %Zd\n", mpz_sizeinbase(s, 2), s);
-        gmp_printf("n (%d bits) = %Zd\n", mpz_sizeinbase(n, 2), n);
-        gmp_printf("e (%d bits) = %Zd\n", mpz_sizeinbase(e, 2), e);
+        fprintf(stderr, "user = %s\n", username);
+        gmp_fprintf(stderr, "s (%d bits) = %Zd\n", mpz_sizeinbase(s, 2), s);
+        gmp_fprintf(stderr, "n (%d bits) = %Zd\n", mpz_sizeinbase(n, 2), n);
+        gmp_fprintf(stderr, "e (%d bits) = %Zd\n", mpz_sizeinbase(e, 2), e);
     }
 
+    rsa_ctx_init_pub(&ctx, n, e); // Set up the key once for the signature check and every block
+
     mpz_set_str(m, username, 62); // Converting username
-    verify = rsa_verify(m, s, e, n);
+    verify = rsa_ctx_verify(&ctx, m, s);
     if (verify == false) { // Error handling of verify
         printf("Error while verifying signature.\n");
         return -1;
     }
+    if (verbose == true) {
+        fprintf(stderr, "signature verified\n");
+    }
 
-    rsa_encrypt_file(infile, outfile, n, e);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (threads > 1) { // Spread the blocks over worker threads, output is the same
+        ok = rsa_ctx_encrypt_file_threads(&ctx, infile, outfile, threads, format);
+    } else if (format == RSA_FORMAT_HYBRID) {
+        ok = rsa_ctx_encrypt_file_hybrid(&ctx, infile, outfile);
+    } else if (format == RSA_FORMAT_BIN) {
+        ok = rsa_ctx_encrypt_file_bin(&ctx, infile, outfile);
+    } else {
+        rsa_ctx_encrypt_file(&ctx, infile, outfile);
+    }
+    if (ok == false && format == RSA_FORMAT_HYBRID) {
+        printf("Error drawing a random session key.\n");
+        return -1;
+    } else if (ok == false) {
+        printf("Key is too small for the binary format, use -f hex.\n");
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    if (verbose == true) { // Throughput of the file functions alone, key setup isn't counted
+        print_throughput(&ctx, &start, &stop);
+        stats_print(stderr);
+    }
+    stats_finish();
+    rsa_ctx_clear(&ctx);
 
     fclose(infile); // Close all the opened files
     fclose(outfile);
-    fclose(pbfile);
+    if (pbfile != NULL) {
+        fclose(pbfile);
+    }
 
     mpz_clears(n, e, s, m, NULL);
 }
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "fileio.h"
+
+// Sets up a reader for file, starting at its current position
+// Regular files are memory-mapped, anything else (stdin from a pipe, a terminal) is streamed
+void fileio_reader_init(fileio_reader *reader, FILE *file) {
+    struct stat st;
+    off_t start = ftello(file);
+
+    memset(reader, 0, sizeof(fileio_reader));
+    reader->file = file;
+
+    if (fstat(fileno(file), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 || start < 0) {
+        return;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    if (map == MAP_FAILED) { // Fall back to streaming
+        return;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    reader->map = (uint8_t *) map;
+    reader->map_size = st.st_size;
+    reader->pos = start < st.st_size ? start : st.st_size;
+    return;
+}
+
+// Unmaps the file or frees the streaming buffer
+void fileio_reader_clear(fileio_reader *reader) {
+    if (reader->map != NULL) {
+        munmap(reader->map, reader->map_size);
+    }
+    free(reader->buf);
+    memset(reader, 0, sizeof(fileio_reader));
+    return;
+}
+
+// Returns true if the reader is working out of a memory mapping
+bool fileio_mapped(fileio_reader *reader) {
+    return reader->map != NULL;
+}
+
+// Makes sure the streaming buffer holds want unread bytes, or everything left in the input
+static void fileio_fill(fileio_reader *reader, size_t want) {
+    size_t have = reader->buf_len - reader->buf_pos;
+
+    if (have >= want || reader->eof == true) {
+        return;
+    }
+    if (reader->buf_pos > 0) { // Move the unread bytes to the front
+        memmove(reader->buf, reader->buf + reader->buf_pos, have);
+        reader->buf_len = have;
+        reader->buf_pos = 0;
+    }
+    if (want > reader->buf_cap) {
+        reader->buf_cap = want > FILEIO_BUFFER_SIZE ? want : FILEIO_BUFFER_SIZE;
+        reader->buf = (uint8_t *) realloc(reader->buf, reader->buf_cap);
+    }
+    // Read as much as fits, so small reads don't each become a call into stdio
+    size_t got = fread(reader->buf + reader->buf_len, sizeof(uint8_t),
+        reader->buf_cap - reader->buf_len, reader->file);
+    reader->buf_len += got;
+    if (reader->buf_len - reader->buf_pos < want) {
+        reader->eof = feof(reader->file) || ferror(reader->file);
+        if (reader->eof == false) { // fread stopped early without hitting the end, try again
+            fileio_fill(reader, want);
+        }
+    }
+    return;
+}
+
+// Hands out the next want bytes of input in *data without copying them when the file is mapped
+// The bytes stay valid until the next call on the reader
+// Returns the number of bytes handed out, which is only below want at the end of the input
+size_t fileio_read(fileio_reader *reader, uint8_t **data, size_t want) {
+    size_t got;
+
+    if (reader->map != NULL) {
+        got = reader->map_size - reader->pos < want ? reader->map_size - reader->pos : want;
+        *data = reader->map + reader->pos;
+        reader->pos += got;
+    } else {
+        fileio_fill(reader, want);
+        got = reader->buf_len - reader->buf_pos < want ? reader->buf_len - reader->buf_pos : want;
+        *data = reader->buf + reader->buf_pos;
+        reader->buf_pos += got;
+    }
+    reader->bytes += got;
+    return got;
+}
+
+// Hands out the next line of input in *line, without its newline, and its length in *len
+// The line stays valid until the next call on the reader
+// Returns false once the input has no more lines
+bool fileio_read_line(fileio_reader *reader, uint8_t **line, size_t *len) {
+    uint8_t *start;
+    uint8_t *newline;
+    size_t left;
+
+    if (reader->map != NULL) {
+        start = reader->map + reader->pos;
+        left = reader->map_size - reader->pos;
+    } else {
+        size_t want = FILEIO_BUFFER_SIZE / 2;
+        while (true) { // Grow the window until it holds a whole line
+            fileio_fill(reader, want);
+            start = reader->buf + reader->buf_pos;
+            left = reader->buf_len - reader->buf_pos;
+            if (reader->eof == true || memchr(start, '\n', left) != NULL) {
+                break;
+            }
+            want = 2 * left;
+        }
+    }
+    if (left == 0) {
+        return false;
+    }
+
+    newline = (uint8_t *) memchr(start, '\n', left);
+    *line = start;
+    *len = newline != NULL ? (size_t) (newline - start) : left; // The last line may lack its newline
+    size_t used = newline != NULL ? *len + 1 : left;
+
+    if (reader->map != NULL) {
+        reader->pos += used;
+    } else {
+        reader->buf_pos += used;
+    }
+    reader->bytes += used;
+    return true;
+}
+
+// Sets up a writer for file with an aligned buffer of FILEIO_BUFFER_SIZE bytes
+void fileio_writer_init(fileio_writer *writer, FILE *file) {
+    writer->file = file;
+    writer->buf = (uint8_t *) aligned_alloc(FILEIO_ALIGN, FILEIO_BUFFER_SIZE);
+    writer->len = 0;
+    writer->bytes = 0;
+    return;
+}
+
+// Flushes whatever is left in the buffer and frees it
+void fileio_writer_clear(fileio_writer *writer) {
+    fileio_flush(writer);
+    free(writer->buf);
+    writer->buf = NULL;
+    return;
+}
+
+// Returns a pointer to room for len bytes at the end of the buffer, flushing it first if needed
+// len must not be more than FILEIO_BUFFER_SIZE, fileio_commit says how much was actually used
+uint8_t *fileio_reserve(fileio_writer *writer, size_t len) {
+    if (writer->len + len > FILEIO_BUFFER_SIZE) {
+        fileio_flush(writer);
+    }
+    return writer->buf + writer->len;
+}
+
+// Keeps len bytes written into the space returned by fileio_reserve
+void fileio_commit(fileio_writer *writer, size_t len) {
+    writer->len += len;
+    writer->bytes += len;
+    return;
+}
+
+// Appends len bytes of data to the buffer, large writes go straight to the file
+void fileio_write(fileio_writer *writer, uint8_t *data, size_t len) {
+    if (len > FILEIO_BUFFER_SIZE / 2) {
+        fileio_flush(writer);
+        fwrite(data, sizeof(uint8_t), len, writer->file);
+        writer->bytes += len;
+        return;
+    }
+    memcpy(fileio_reserve(writer, len), data, len);
+    fileio_commit(writer, len);
+    return;
+}
+
+// Writes the buffer out to the file in one call
+void fileio_flush(fileio_writer *writer) {
+    if (writer->len > 0) {
+        fwrite(writer->buf, sizeof(uint8_t), writer->len, writer->file);
+        writer->len = 0;
+    }
+    return;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Bytes in the output buffer of a fileio_writer, and the alignment of that buffer
+#define FILEIO_BUFFER_SIZE (1 << 20)
+#define FILEIO_ALIGN 4096
+
+// Reads a file either straight out of a memory mapping or, for pipes and terminals, through a buffer
+typedef struct {
+    FILE *file;
+    uint8_t *map; // Mapping of the whole file, NULL if the input is streamed
+    size_t map_size;
+    size_t pos; // Offset of the next unread byte in the mapping
+    uint8_t *buf; // Streaming buffer, grown to the largest read asked for
+    size_t buf_cap;
+    size_t buf_len; // Bytes in buf, used by fileio_read_line
+    size_t buf_pos;
+    bool eof; // The streamed input has ended
+    uint64_t bytes; // Bytes handed out so far
+} fileio_reader;
+
+// Collects output in one large aligned buffer and writes it out in bulk
+typedef struct {
+    FILE *file;
+    uint8_t *buf;
+    size_t len;
+    uint64_t bytes; // Bytes written so far, including those still in buf
+} fileio_writer;
+
+void fileio_reader_init(fileio_reader *reader, FILE *file);
+
+void fileio_reader_clear(fileio_reader *reader);
+
+bool fileio_mapped(fileio_reader *reader);
+
+size_t fileio_read(fileio_reader *reader, uint8_t **data, size_t want);
+
+bool fileio_read_line(fileio_reader *reader, uint8_t **line, size_t *len);
+
+void fileio_writer_init(fileio_writer *writer, FILE *file);
+
+void fileio_writer_clear(fileio_writer *writer);
+
+uint8_t *fileio_reserve(fileio_writer *writer, size_t len);
+
+void fileio_commit(fileio_writer *writer, size_t len);
+
+void fileio_write(fileio_writer *writer, uint8_t *data, size_t len);
+
+void fileio_flush(fileio_writer *writer);
@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include "hex.h"
+#include <gmp.h>
+
+#if defined(__x86_64__) && defined(__GNUC__) && GMP_NUMB_BITS == 64
+#define HEX_SIMD 1
+#include <immintrin.h>
+#define HEX_SSSE3 __attribute__((target("ssse3")))
+#define HEX_AVX2 __attribute__((target("avx2")))
+#endif
+
+#define HEX_LIMB_DIGITS (GMP_NUMB_BITS / 4)
+
+static const char hex_digits[] = "0123456789abcdef";
+
+// Returns the value of the hex digit c in either case, or 16 if c isn't one
+static unsigned hex_value(unsigned char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20; // Lowercase
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return 16;
+}
+
+// Returns the vector level the CPU can run: 2 for AVX2, 1 for SSSE3, 0 for neither
+static int hex_level(void) {
+#ifdef HEX_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return 2;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+// Returns the number of bytes hex_encode writes for z
+size_t hex_size(mpz_t z) {
+    return mpz_sizeinbase(z, 16) + (mpz_sgn(z) < 0);
+}
+
+#ifdef HEX_SIMD
+
+// Writes the digits of count whole limbs to out two limbs at a time, starting from the top one
+// Returns the number of limbs left at the bottom for the scalar code
+HEX_SSSE3 static size_t hex_encode_ssse3(char *out, const mp_limb_t *limbs, size_t count) {
+    __m128i digits = _mm_loadu_si128((__m128i *) hex_digits);
+    __m128i reverse = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i low = _mm_set1_epi8(0x0F);
+
+    while (count >= 2) {
+        count -= 2;
+        // Reversing both limbs puts their bytes most significant first
+        __m128i x = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) (limbs + count)), reverse);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), low);
+        __m128i lo = _mm_and_si128(x, low);
+        _mm_storeu_si128((__m128i *) out, _mm_shuffle_epi8(digits, _mm_unpacklo_epi8(hi, lo)));
+        _mm_storeu_si128(
+            (__m128i *) (out + 16), _mm_shuffle_epi8(digits, _mm_unpackhi_epi8(hi, lo)));
+        out += 2 * HEX_LIMB_DIGITS;
+    }
+    return count;
+}
+
+// Same as hex_encode_ssse3 with four limbs at a time, then two at a time for the rest
+HEX_AVX2 static size_t hex_encode_avx2(char *out, const mp_limb_t *limbs, size_t count) {
+    __m256i digits = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) hex_digits));
+    __m256i reverse = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8, 7,
+        6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    __m256i low = _mm256_set1_epi8(0x0F);
+
+    while (count >= 4) {
+        count -= 4;
+        // Limbs from the top down, each with its bytes reversed
+        __m256i x = _mm256_permute4x64_epi64(_mm256_loadu_si256((__m256i *) (limbs + count)), 0x1B);
+        x = _mm256_shuffle_epi8(x, reverse);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), low);
+        __m256i lo = _mm256_and_si256(x, low);
+        // Unpacking works within 128-bit halves, so a has bytes 0-7 and 16-23, b 8-15 and 24-31
+        __m256i a = _mm256_shuffle_epi8(digits, _mm256_unpacklo_epi8(hi, lo));
+        __m256i b = _mm256_shuffle_epi8(digits, _mm256_unpackhi_epi8(hi, lo));
+        _mm256_storeu_si256((__m256i *) out, _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i *) (out + 32), _mm256_permute2x128_si256(a, b, 0x31));
+        out += 4 * HEX_LIMB_DIGITS;
+    }
+    _mm256_zeroupper(); // The SSSE3 code is not VEX encoded, mixing them stalls
+    return hex_encode_ssse3(out, limbs, count);
+}
+
+// Returns the values of 16 hex digits, which must be valid
+HEX_SSSE3 static __m128i hex_values_ssse3(__m128i c) {
+    __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('9')), _mm_set1_epi8(9));
+    return _mm_add_epi8(_mm_and_si128(c, _mm_set1_epi8(0x0F)), letter);
+}
+
+// Sets count whole limbs from the digits that end at end, two limbs at a time from the bottom one
+// Returns the number of limbs left at the top for the scalar code
+HEX_SSSE3 static size_t hex_decode_ssse3(mp_limb_t *limbs, char *end, size_t count) {
+    __m128i reverse = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i weights = _mm_set1_epi16(0x0110); // Two digits make a byte: 16 * first + second
+
+    while (count >= 2) {
+        end -= 2 * HEX_LIMB_DIGITS;
+        __m128i a = hex_values_ssse3(_mm_loadu_si128((__m128i *) end));
+        __m128i b = hex_values_ssse3(_mm_loadu_si128((__m128i *) (end + 16)));
+        __m128i x = _mm_packus_epi16(_mm_maddubs_epi16(a, weights), _mm_maddubs_epi16(b, weights));
+        _mm_storeu_si128((__m128i *) limbs, _mm_shuffle_epi8(x, reverse));
+        limbs += 2;
+        count -= 2;
+    }
+    return count;
+}
+
+// Returns the values of 32 hex digits, which must be valid
+HEX_AVX2 static __m256i hex_values_avx2(__m256i c) {
+    __m256i letter
+        = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('9')), _mm256_set1_epi8(9));
+    return _mm256_add_epi8(_mm256_and_si256(c, _mm256_set1_epi8(0x0F)), letter);
+}
+
+// Same as hex_decode_ssse3 with four limbs at a time, then two at a time for the rest
+HEX_AVX2 static size_t hex_decode_avx2(mp_limb_t *limbs, char *end, size_t count) {
+    __m256i reverse = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8, 7,
+        6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    __m256i weights = _mm256_set1_epi16(0x0110);
+
+    while (count >= 4) {
+        end -= 4 * HEX_LIMB_DIGITS;
+        __m256i a = hex_values_avx2(_mm256_loadu_si256((__m256i *) end));
+        __m256i b = hex_values_avx2(_mm256_loadu_si256((__m256i *) (end + 32)));
+        // Packing works within 128-bit halves, so the limbs come out top, second, third, bottom
+        // as words 0, 2, 1, 3
+        __m256i x = _mm256_packus_epi16(
+            _mm256_maddubs_epi16(a, weights), _mm256_maddubs_epi16(b, weights));
+        x = _mm256_shuffle_epi8(_mm256_permute4x64_epi64(x, 0x27), reverse);
+        _mm256_storeu_si256((__m256i *) limbs, x);
+        limbs += 4;
+        count -= 4;
+    }
+    _mm256_zeroupper(); // The SSSE3 code is not VEX encoded, mixing them stalls
+    return hex_decode_ssse3(limbs, end, count);
+}
+
+// Returns true if all len bytes at text are hex digits, 16 bytes at a time with SSE2
+static bool hex_plain(char *text, size_t len) {
+    __m128i below = _mm_set1_epi8('0' - 1);
+    __m128i above = _mm_set1_epi8('9' + 1);
+    __m128i below_letter = _mm_set1_epi8('a' - 1);
+    __m128i above_letter = _mm_set1_epi8('f' + 1);
+    __m128i lower = _mm_set1_epi8(0x20);
+    size_t i = 0;
+
+    // Bytes from 0x80 up compare as negative, so they fail both ranges
+    for (; i + 16 <= len; i += 16) {
+        __m128i c = _mm_loadu_si128((__m128i *) (text + i));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, below), _mm_cmpgt_epi8(above, c));
+        c = _mm_or_si128(c, lower);
+        __m128i letter
+            = _mm_and_si128(_mm_cmpgt_epi8(c, below_letter), _mm_cmpgt_epi8(above_letter, c));
+        if (_mm_movemask_epi8(_mm_or_si128(digit, letter)) != 0xFFFF) {
+            return false;
+        }
+    }
+    for (; i < len; i++) {
+        if (hex_value(text[i]) == 16) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#else
+
+// Returns true if all len bytes at text are hex digits
+static bool hex_plain(char *text, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (hex_value(text[i]) == 16) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif
+
+// Writes the digits of z to out in lowercase with no leading zeros, the same bytes as %Zx
+// out needs hex_size(z) bytes, no NUL is written
+// Returns the bytes written
+size_t hex_encode(char *out, mpz_t z) {
+    const mp_limb_t *limbs = mpz_limbs_read(z);
+    size_t count = mpz_size(z);
+    char *start = out;
+
+    if (mpz_sgn(z) < 0) {
+        *out++ = '-';
+    }
+    if (count == 0) {
+        *out++ = '0';
+        return out - start;
+    }
+
+    // The top limb has only as many digits as it needs
+    mp_limb_t top = limbs[--count];
+    size_t digits = mpz_sizeinbase(z, 16) - count * HEX_LIMB_DIGITS;
+    for (size_t i = digits; i > 0; i--) {
+        out[i - 1] = hex_digits[top & 0x0F];
+        top >>= 4;
+    }
+    out += digits;
+
+    size_t rest = count;
+#ifdef HEX_SIMD
+    int level = hex_level();
+    if (level == 2) {
+        rest = hex_encode_avx2(out, limbs, count);
+    } else if (level == 1) {
+        rest = hex_encode_ssse3(out, limbs, count);
+    }
+#endif
+    out += (count - rest) * HEX_LIMB_DIGITS;
+    while (rest > 0) {
+        mp_limb_t limb = limbs[--rest];
+        for (size_t i = HEX_LIMB_DIGITS; i > 0; i--) {
+            out[i - 1] = hex_digits[limb & 0x0F];
+            limb >>= 4;
+        }
+        out += HEX_LIMB_DIGITS;
+    }
+    return out - start;
+}
+
+// Sets z to the len hex digits at text, which must all be valid
+static void hex_decode_digits(mpz_t z, char *text, size_t len) {
+    size_t count = (len + HEX_LIMB_DIGITS - 1) / HEX_LIMB_DIGITS;
+    size_t whole = len / HEX_LIMB_DIGITS;
+    mp_limb_t *limbs = mpz_limbs_write(z, count);
+    size_t rest = whole;
+
+#ifdef HEX_SIMD
+    int level = hex_level();
+    if (level == 2) {
+        rest = hex_decode_avx2(limbs, text + len, whole);
+    } else if (level == 1) {
+        rest = hex_decode_ssse3(limbs, text + len, whole);
+    }
+#endif
+    size_t stop = len - (whole - rest) * HEX_LIMB_DIGITS;
+    for (size_t i = whole - rest; i < count; i++) { // The top limb may be short
+        size_t start = stop > HEX_LIMB_DIGITS ? stop - HEX_LIMB_DIGITS : 0;
+        mp_limb_t limb = 0;
+        for (size_t j = start; j < stop; j++) {
+            limb = (limb << 4) | hex_value(text[j]);
+        }
+        limbs[i] = limb;
+        stop = start;
+    }
+    mpz_limbs_finish(z, count); // Drops the limbs left zero by leading zeros
+    return;
+}
+
+// Sets z to the hex digits at text, skipping whitespace between them like mpz_set_str does
+// The text ends at len bytes or at a NUL, whichever comes first
+// Returns false if it holds anything else
+static bool hex_decode_spaced(mpz_t z, char *text, size_t len) {
+    size_t digits = 0;
+    size_t end = 0;
+
+    for (; end < len && text[end] != '\0'; end++) {
+        if (hex_value(text[end]) < 16) {
+            digits += 1;
+        } else if (isspace((unsigned char) text[end]) == 0) {
+            return false;
+        }
+    }
+
+    size_t count = (digits + HEX_LIMB_DIGITS - 1) / HEX_LIMB_DIGITS;
+    mp_limb_t *limbs = mpz_limbs_write(z, count);
+    memset(limbs, 0, count * sizeof(mp_limb_t));
+    digits = 0;
+    for (size_t i = end; i > 0; i--) {
+        unsigned value = hex_value(text[i - 1]);
+        if (value < 16) {
+            mp_limb_t shifted = (mp_limb_t) value << (4 * (digits % HEX_LIMB_DIGITS));
+            limbs[digits / HEX_LIMB_DIGITS] |= shifted;
+            digits += 1;
+        }
+    }
+    mpz_limbs_finish(z, count);
+    return true;
+}
+
+// Sets z to the number written in hex in the len bytes at text, accepting exactly what
+// mpz_set_str accepts in base 16: leading whitespace, a minus sign, digits in either case with
+// whitespace between them, and an early end at a NUL
+// Lines of plain digits, like those hex_encode writes, are converted a vector at a time
+// Returns false if the text isn't a number, z is then unspecified
+bool hex_decode(mpz_t z, char *text, size_t len) {
+    bool negative = false;
+
+    while (len > 0 && isspace((unsigned char) *text) != 0) {
+        text++;
+        len--;
+    }
+    if (len > 0 && *text == '-') {
+        negative = true;
+        text++;
+        len--;
+    }
+    if (len == 0 || hex_value(*text) == 16) { // A digit has to come first
+        return false;
+    }
+
+    if (hex_plain(text, len) == true) {
+        hex_decode_digits(z, text, len);
+    } else if (hex_decode_spaced(z, text, len) == false) {
+        return false;
+    }
+    if (negative == true) {
+        mpz_neg(z, z);
+    }
+    return true;
+}
+
+// Writes z and a newline to file, the same bytes as gmp_fprintf with "%Zx\n"
+// Returns false if the write failed
+bool hex_write(FILE *file, mpz_t z) {
+    char *text = (char *) malloc(hex_size(z) + 1);
+    size_t len = hex_encode(text, z);
+
+    text[len++] = '\n';
+    bool written = fwrite(text, 1, len, file) == len;
+    free(text);
+    return written;
+}
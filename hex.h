@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <gmp.h>
+
+// Hex text of numbers, converted straight between GMP limbs and ASCII
+// hex_encode writes the same bytes as %Zx and mpz_get_str in base 16, and hex_decode accepts
+// exactly what mpz_set_str accepts in base 16
+// Whole limbs go through SSSE3 or AVX2 nibble shuffles when the CPU has them, checked at run time
+
+size_t hex_size(mpz_t z);
+
+size_t hex_encode(char *out, mpz_t z);
+
+bool hex_decode(mpz_t z, char *text, size_t len);
+
+bool hex_write(FILE *file, mpz_t z);
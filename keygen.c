@@ -4,16 +4,48 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <gmp.h>
+#include <string.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <time.h>
+#include <getopt.h>
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
 #include "numtheory.h"
+#include "pool.h"
 #include "randstate.h"
 #include "rsa.h"
+#include "stats.h"
 
-#define OPTIONS "hb:i:n:d:s:v"
+#define OPTIONS "hb:e:i:k:n:d:s:t:v"
+
+// Keys searched for at once in bulk mode, each batch is written out before the next one starts
+#define KEYGEN_BATCH 64
+
+// Long only options, --pool takes p and q from a pool filled by primepool
+// --count and --users make many keys in one run, written to --out-dir
+static struct option long_options[] = { { "pool", required_argument, NULL, 'P' },
+    { "count", required_argument, NULL, 'C' }, { "users", required_argument, NULL, 'U' },
+    { "out-dir", required_argument, NULL, 'O' }, { NULL, 0, NULL, 0 } };
+
+// One batch of bulk mode, shared by the threads that finish and write out its keys
+typedef struct {
+    mpz_t *primes; // per_key primes for each key
+    mpz_t *n;
+    mpz_t *e;
+    size_t per_key;
+    char **names; // Username of each key in the whole run
+    char *dir;
+    bool numbered; // Files are named rsa<index> instead of after the username
+    size_t first; // Index in the whole run of the batch's first key
+    size_t count;
+    pthread_mutex_t lock;
+    size_t next; // Next key of the batch to write, guarded by lock
+    bool failed; // A key file couldn't be written, guarded by lock
+} keygen_bulk;
 
 // Prints out the help message as specified by resources binary
 void help_message(void) {
@@ -21,45 +53,422 @@ void help_message(void) {
     printf("   Generates an RSA public/private key pair.\n");
     printf("\n");
     printf("USAGE\n");
-    printf("   ./keygen [-hv] [-b bits] -n pbfile -d pvfile\n");
+    printf("   ./keygen [-hv] [-b bits] [-e exponent] [-i confidence] [-k primes] [-t threads]\n");
+    printf("            [--pool file] -n pbfile -d pvfile\n");
+    printf("   ./keygen [-hv] [-b bits] [-e exponent] [-i confidence] [-k primes] [-t threads]\n");
+    printf("            --count n | --users file --out-dir dir\n");
     printf("\n");
     printf("OPTIONS\n");
     printf("   -h              Display program help and usage.\n");
     printf("   -v              Display verbose program output.\n");
     printf("   -b bits         Minimum bits needed for public key n (default: 256).\n");
-    printf("   -i confidence   Miller-Rabin iterations for testing primes (default: 50).\n");
+    printf("   -e exponent     Public exponent, odd and at least 3 (default: 65537).\n");
+    printf("                   0 picks a random exponent as large as n.\n");
+    printf("   -i confidence   Primality test: bpsw, fips, or a number of Miller-Rabin rounds\n");
+    printf("                   of at least 1 (default: bpsw).\n");
+    printf("   -k primes       Number of primes in n, 3 or 4 make a multi-prime key that\n");
+    printf("                   decrypts faster (default: 2).\n");
     printf("   -n pbfile       Public key file (default: rsa.pub).\n");
     printf("   -d pvfile       Private key file (default: rsa.priv).\n");
     printf("   -s seed         Random seed for testing.\n");
+    printf("   -t threads      Search for p and q on this many threads (default: 1).\n");
+    printf("   --pool file     Take p and q from a prime pool made by primepool, and search\n");
+    printf("                   for them as usual if it has run out.\n");
+    printf("   --count n       Make n keys for $USER, named rsa0 to rsa<n - 1> in --out-dir.\n");
+    printf("   --users file    Make a key for each username on a line of file, named after\n");
+    printf("                   the username in --out-dir.\n");
+    printf("   --out-dir dir   Directory the keys of --count or --users are written to. Their\n");
+    printf("                   primes are searched for together on -t threads (default: all\n");
+    printf("                   cores).\n");
     exit(0);
 }
 
+// Turns the -i argument into iters for is_prime, bpsw and fips pick a test instead of a count
+// Returns false unless it is bpsw, fips, or a number of rounds of at least 1, 0 would test nothing
+// and is PRIME_ITERS_BPSW besides
+static bool parse_iters(char *arg, uint64_t *iters) {
+    char *end;
+
+    if (strcmp(arg, "bpsw") == 0) {
+        *iters = PRIME_ITERS_BPSW;
+        return true;
+    } else if (strcmp(arg, "fips") == 0) {
+        *iters = PRIME_ITERS_FIPS;
+        return true;
+    }
+    *iters = strtoull(arg, &end, 10);
+    return *arg >= '0' && *arg <= '9' && *end == '\0' && *iters > 0 && *iters != PRIME_ITERS_FIPS;
+}
+
+// Derives the private key and its CRT components from the count primes r of n, signs username
+// with it, and writes the public and private key files
+// d and s are left set for the caller to print
+static void keygen_finish(mpz_t d, mpz_t s, mpz_t r[], int count, mpz_t n, mpz_t e,
+    char *username, FILE *pbfile, FILE *pvfile) {
+    mpz_t m, dp, dq, qinv;
+    mpz_t dr[RSA_EXTRA_PRIMES], tr[RSA_EXTRA_PRIMES];
+    rsa_key_ctx ctx;
+
+    mpz_inits(m, dp, dq, qinv, NULL);
+    for (int i = 0; i < RSA_EXTRA_PRIMES; i++) {
+        mpz_inits(dr[i], tr[i], NULL);
+    }
+
+    if (count > 2) {
+        rsa_make_priv_multi(d, e, r, count);
+        rsa_make_crt_extra(dr, tr, d, r, count);
+    } else {
+        rsa_make_priv(d, e, r[0], r[1]); // make private key
+    }
+    rsa_make_crt(dp, dq, qinv, d, r[0], r[1]); // CRT components for faster decryption and signing
+
+    mpz_set_str(m, username, 62);
+    if (count > 2) { // The signature needs every prime
+        rsa_ctx_init_multi(&ctx, n, r[0], r[1], dp, dq, qinv, r + 2, dr, tr, count - 2);
+        rsa_ctx_sign(&ctx, s, m);
+        rsa_ctx_clear(&ctx);
+    } else {
+        rsa_sign_crt(s, m, r[0], r[1], dp, dq, qinv);
+    }
+
+    rsa_write_pub(n, e, s, username, pbfile); // write out the keys to the specified file
+    rsa_write_priv_crt(n, d, r[0], r[1], dp, dq, qinv, pvfile);
+    rsa_write_priv_extra(r + 2, dr, tr, count - 2, pvfile);
+
+    mpz_clears(m, dp, dq, qinv, NULL);
+    for (int i = 0; i < RSA_EXTRA_PRIMES; i++) {
+        mpz_clears(dr[i], tr[i], NULL);
+    }
+    return;
+}
+
+// Opens the key file of key index of a bulk run with the given extension, in dir
+// The file is named after the username, or rsa<index> with --count
+static FILE *keygen_bulk_open(keygen_bulk *bulk, size_t index, char *extension) {
+    char *name = bulk->names[index];
+    size_t len = strlen(bulk->dir) + strlen(name) + strlen(extension) + 32;
+    char *path = (char *) malloc(len);
+    FILE *file;
+
+    if (bulk->numbered == true) {
+        snprintf(path, len, "%s/rsa%zu%s", bulk->dir, index, extension);
+    } else {
+        snprintf(path, len, "%s/%s%s", bulk->dir, name, extension);
+    }
+    file = fopen(path, "w");
+    if (file == NULL) {
+        printf("Error opening %s.\n", path);
+    }
+    free(path);
+    return file;
+}
+
+// Finishes key i of the batch and writes it to its two files
+// Returns false if either file couldn't be created
+static bool keygen_bulk_write(keygen_bulk *bulk, size_t i) {
+    size_t index = bulk->first + i;
+    FILE *pbfile = keygen_bulk_open(bulk, index, ".pub");
+    FILE *pvfile = pbfile != NULL ? keygen_bulk_open(bulk, index, ".priv") : NULL;
+    mpz_t d, s;
+
+    if (pvfile == NULL) {
+        if (pbfile != NULL) {
+            fclose(pbfile);
+        }
+        return false;
+    }
+    fchmod(fileno(pvfile), 0600);
+    mpz_inits(d, s, NULL);
+    keygen_finish(d, s, bulk->primes + i * bulk->per_key, bulk->per_key, bulk->n[i], bulk->e[i],
+        bulk->names[index], pbfile, pvfile);
+    mpz_clears(d, s, NULL);
+    fclose(pbfile);
+    fclose(pvfile);
+    return true;
+}
+
+// Worker thread of bulk mode, takes the keys of the batch in turn until none are left
+// Deriving, signing, and writing a key doesn't touch the others, so they run on every thread
+static void *keygen_bulk_worker(void *arg) {
+    keygen_bulk *bulk = (keygen_bulk *) arg;
+
+    while (true) {
+        pthread_mutex_lock(&bulk->lock);
+        size_t i = bulk->next++;
+        bool stop = bulk->failed == true || i >= bulk->count;
+        pthread_mutex_unlock(&bulk->lock);
+        if (stop == true) {
+            break;
+        }
+        if (keygen_bulk_write(bulk, i) == false) {
+            pthread_mutex_lock(&bulk->lock);
+            bulk->failed = true;
+            pthread_mutex_unlock(&bulk->lock);
+        }
+    }
+    return NULL;
+}
+
+// Makes a key for each of the total usernames and writes them to dir, KEYGEN_BATCH keys at a time
+// The primes of a batch are searched for together with rsa_make_pub_many on threads threads,
+// from a seed derived from seed and the batch, so the keys don't depend on the number of threads
+// Returns 0, or -1 if a key file couldn't be written
+static int keygen_bulk_run(char **names, size_t total, bool numbered, char *dir, int per_key,
+    mpz_t e, uint64_t nbits, uint64_t iters, int threads, uint64_t seed) {
+    size_t batch = total < KEYGEN_BATCH ? total : KEYGEN_BATCH;
+    pthread_t *workers = (pthread_t *) calloc(threads, sizeof(pthread_t));
+    keygen_bulk bulk;
+
+    memset(&bulk, 0, sizeof(bulk));
+    bulk.primes = (mpz_t *) malloc(batch * per_key * sizeof(mpz_t));
+    bulk.n = (mpz_t *) malloc(batch * sizeof(mpz_t));
+    bulk.e = (mpz_t *) malloc(batch * sizeof(mpz_t));
+    for (size_t i = 0; i < batch * per_key; i++) {
+        mpz_init(bulk.primes[i]);
+    }
+    for (size_t i = 0; i < batch; i++) {
+        mpz_inits(bulk.n[i], bulk.e[i], NULL);
+    }
+    bulk.per_key = per_key;
+    bulk.names = names;
+    bulk.dir = dir;
+    bulk.numbered = numbered;
+    pthread_mutex_init(&bulk.lock, NULL);
+
+    for (size_t first = 0; first < total && bulk.failed == false; first += batch) {
+        bulk.first = first;
+        bulk.count = total - first < batch ? total - first : batch;
+        bulk.next = 0;
+        for (size_t i = 0; i < bulk.count; i++) {
+            mpz_set(bulk.e[i], e);
+        }
+        rsa_make_pub_many(bulk.primes, bulk.n, bulk.e, bulk.count, per_key, nbits, iters, threads,
+            randstate_derive(seed, first / KEYGEN_BATCH));
+
+        int started = (size_t) threads < bulk.count ? threads : (int) bulk.count;
+        for (int i = 0; i < started; i++) {
+            pthread_create(&workers[i], NULL, keygen_bulk_worker, &bulk);
+        }
+        for (int i = 0; i < started; i++) {
+            pthread_join(workers[i], NULL);
+        }
+    }
+
+    pthread_mutex_destroy(&bulk.lock);
+    for (size_t i = 0; i < batch * per_key; i++) {
+        mpz_clear(bulk.primes[i]);
+    }
+    for (size_t i = 0; i < batch; i++) {
+        mpz_clears(bulk.n[i], bulk.e[i], NULL);
+    }
+    free(bulk.primes);
+    free(bulk.n);
+    free(bulk.e);
+    free(workers);
+    return bulk.failed == true ? -1 : 0;
+}
+
+// Compares two usernames for qsort
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+// Reads the usernames of --users, one per line, blank lines are skipped
+// A username is signed as a base 62 number and names the key files, so it may only hold letters
+// and digits, and each may only appear once
+// Returns the usernames and sets *count, or returns NULL if the file can't be read or is invalid
+static char **keygen_read_users(char *path, size_t *count) {
+    FILE *file = fopen(path, "r");
+    char **names = NULL;
+    size_t cap = 0;
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    bool valid = true;
+
+    *count = 0;
+    if (file == NULL) {
+        printf("Error opening %s.\n", path);
+        return NULL;
+    }
+    while (valid == true && (len = getline(&line, &line_cap, file)) >= 0) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+        if (len == 0) {
+            continue;
+        }
+        for (ssize_t i = 0; i < len; i++) {
+            valid = valid && isalnum((unsigned char) line[i]) != 0;
+        }
+        if (valid == false) {
+            printf("Username %s may only hold letters and digits.\n", line);
+            break;
+        }
+        if (*count == cap) {
+            cap = cap == 0 ? 64 : 2 * cap;
+            names = (char **) realloc(names, cap * sizeof(char *));
+        }
+        names[(*count)++] = strdup(line);
+    }
+    free(line);
+    fclose(file);
+
+    if (valid == true && *count > 0) { // Two keys of one user would overwrite each other's files
+        char **sorted = (char **) malloc(*count * sizeof(char *));
+        memcpy(sorted, names, *count * sizeof(char *));
+        qsort(sorted, *count, sizeof(char *), compare_names);
+        for (size_t i = 1; i < *count && valid == true; i++) {
+            if (strcmp(sorted[i - 1], sorted[i]) == 0) {
+                printf("Username %s appears more than once.\n", sorted[i]);
+                valid = false;
+            }
+        }
+        free(sorted);
+    }
+    if (valid == false || *count == 0) {
+        if (valid == true) {
+            printf("No usernames in %s.\n", path);
+        }
+        for (size_t i = 0; i < *count; i++) {
+            free(names[i]);
+        }
+        free(names);
+        return NULL;
+    }
+    return names;
+}
+
 // Main program that contains the implementation of the generation of public and private keys
 int main(int argc, char **argv) {
     int opt = 0;
     int nbits = 256; // default nbits
-    int iters = 50;
+    uint64_t iters = PRIME_ITERS_BPSW;
     char *public_path = "rsa.pub";
     char *private_path = "rsa.priv";
     uint64_t SEED = time(NULL); // specified by asgn6.pdf
     bool verbose = false;
+    int threads = 0; // 0 keeps the original single threaded search
     FILE *pbfile;
     FILE *pvfile;
     char *user = "USER";
+    char *exponent = "65537";
     char *username;
+    char *pool_path = NULL; // Set by --pool
+    FILE *pool = NULL;
+    bool pooled = false; // Set if p and q were taken from the pool
+    int primes = 2; // Primes in n, set by -k
+    size_t count = 0; // Keys made by --count
+    char *users_path = NULL; // Set by --users
+    char *out_dir = NULL; // Set by --out-dir
 
-    while ((opt = getopt(argc, argv, OPTIONS)) != -1) { // Loop through arguments
+    while ((opt = getopt_long(argc, argv, OPTIONS, long_options, NULL)) != -1) { // Loop through args
         switch (opt) {
         case 'h': help_message(); return -1;
         case 'b': nbits = atoi(optarg); break; // using atoi to convert optarg to the right type
-        case 'i': iters = atoi(optarg); break;
+        case 'e': exponent = optarg; break;
+        case 'i':
+            if (parse_iters(optarg, &iters) == false) {
+                printf("-i takes bpsw, fips, or a number of Miller-Rabin rounds of at least 1.\n");
+                return -1;
+            }
+            break;
+        case 'k': primes = atoi(optarg); break;
         case 'n': public_path = optarg; break; // if specified, use new path
         case 'd': private_path = optarg; break;
         case 's': SEED = atoi(optarg); break;
+        case 't': threads = atoi(optarg); break;
+        case 'P': pool_path = optarg; break;
+        case 'C': count = strtoull(optarg, NULL, 10); break;
+        case 'U': users_path = optarg; break;
+        case 'O': out_dir = optarg; break;
         case 'v': verbose = true; break;
         }
     }
 
+    if (primes < 2 || primes > RSA_PRIMES_MAX) {
+        printf("Number of primes must be between 2 and %d.\n", RSA_PRIMES_MAX);
+        return -1;
+    }
+    if (primes > 2 && pool_path != NULL) {
+        printf("The prime pool only holds primes for two-prime keys.\n");
+        return -1;
+    }
+    if (primes > 2 && nbits / primes < 16) { // Tiny primes could run out of distinct ones
+        printf("A key with %d primes needs at least %d bits.\n", primes, 16 * primes);
+        return -1;
+    }
+    if (out_dir != NULL && (count > 0) == (users_path != NULL)) {
+        printf("--out-dir needs either --count or --users.\n");
+        return -1;
+    }
+    if (out_dir == NULL && (count > 0 || users_path != NULL)) {
+        printf("--count and --users need --out-dir.\n");
+        return -1;
+    }
+    if (out_dir != NULL && pool_path != NULL) {
+        printf("Keys made in bulk search for their primes, they can't use --pool.\n");
+        return -1;
+    }
+
+    mpz_t p, q, n, e, d, s;
+    mpz_t r[RSA_PRIMES_MAX]; // All primes of -k
+    mpz_inits(p, q, n, e, d, s, NULL);
+    for (int i = 0; i < RSA_PRIMES_MAX; i++) {
+        mpz_init(r[i]);
+    }
+
+    // e is checked before it is used, an even e or 1 has no inverse modulo the totient
+    if (mpz_set_str(e, exponent, 10) != 0 || mpz_sgn(e) < 0
+        || (mpz_sgn(e) != 0 && (mpz_even_p(e) || mpz_cmp_ui(e, 3) < 0))) {
+        printf("Public exponent must be odd and at least 3, or 0.\n");
+        return -1;
+    }
+
+    stats_init(verbose); // Counters and stage timers, or a trace if RSA_TRACE is set
+    randstate_init(SEED);
+    username = getenv(user);
+
+    if (out_dir != NULL) { // Bulk mode, every key gets its own pair of files in out_dir
+        char **names = NULL;
+        int status = -1;
+        if (users_path != NULL) {
+            names = keygen_read_users(users_path, &count);
+        } else if (username == NULL) {
+            printf("--count signs every key with $USER, which isn't set.\n");
+        } else {
+            names = (char **) malloc(count * sizeof(char *));
+            for (size_t i = 0; i < count; i++) {
+                names[i] = username;
+            }
+        }
+        if (threads <= 0) { // Bulk mode is meant to use the whole machine
+            long cores = sysconf(_SC_NPROCESSORS_ONLN);
+            threads = cores > 0 ? (int) cores : 1;
+        }
+        if (names != NULL && mkdir(out_dir, 0755) != 0 && errno != EEXIST) {
+            printf("Error creating %s.\n", out_dir);
+        } else if (names != NULL) {
+            status = keygen_bulk_run(names, count, users_path == NULL, out_dir, primes, e, nbits,
+                iters, threads, SEED);
+        }
+        if (verbose == true && status == 0) {
+            printf("%zu keys written to %s\n", count, out_dir);
+            stats_print(stdout);
+        }
+        stats_finish();
+        for (size_t i = 0; users_path != NULL && names != NULL && i < count; i++) {
+            free(names[i]);
+        }
+        free(names);
+        randstate_clear();
+        mpz_clears(p, q, n, e, d, s, NULL);
+        for (int i = 0; i < RSA_PRIMES_MAX; i++) {
+            mpz_clear(r[i]);
+        }
+        return status;
+    }
+
     pbfile = fopen(public_path, "w"); // open with "w" so we can write later
     pvfile = fopen(private_path, "w");
 
@@ -72,36 +481,53 @@ int main(int argc, char **argv) {
         printf("Error opening pvfile.\n");
         return -1;
     }
-
-    mpz_t p, q, n, e, d, m, s;
-    mpz_inits(p, q, n, e, d, m, s, NULL);
     fchmod(fileno(pvfile), 0600); // Setting permissions
 
-    randstate_init(SEED);
-
-    rsa_make_pub(p, q, n, e, nbits, iters); // make public key
-    rsa_make_priv(d, e, p, q); // make private key
-
-    username = getenv(user);
-
-    mpz_set_str(m, username, 62);
-    rsa_sign(s, m, d, n);
+    if (pool_path != NULL) { // A missing pool is treated like an empty one
+        pool = pool_open(pool_path, false);
+        pooled = pool != NULL && rsa_make_pub_pool(p, q, n, e, nbits, pool) == true;
+        if (pool != NULL) {
+            fclose(pool);
+        }
+        if (pooled == false && verbose == true) {
+            printf("Prime pool %s is empty, searching for primes.\n", pool_path);
+        }
+    }
+    // Without a pool, or once it has run out, p and q are searched for
+    if (primes > 2) { // Each of the smaller primes is searched for on a thread of its own
+        rsa_make_pub_multi(r, primes, n, e, nbits, iters, threads > 0 ? threads : primes, SEED);
+    } else if (pooled == false && threads > 0) { // The primes depend only on the seed, not on threads
+        rsa_make_pub_threads(p, q, n, e, nbits, iters, threads, SEED);
+    } else if (pooled == false) {
+        rsa_make_pub(p, q, n, e, nbits, iters); // make public key
+    }
+    if (primes == 2) {
+        mpz_set(r[0], p);
+        mpz_set(r[1], q);
+    }
 
-    rsa_write_pub(n, e, s, username, pbfile); // write out the keys to the specified file
-    rsa_write_priv(n, d, pvfile);
+    keygen_finish(d, s, r, primes, n, e, username, pbfile, pvfile);
 
     if (verbose == true) { // Print verbose statistics
         printf("user = %s\n", username);
         gmp_printf("s (%d bits) = %Zd\n", mpz_sizeinbase(s, 2), s);
-        gmp_printf("p (%d bits) = %Zd\n", mpz_sizeinbase(p, 2), p);
-        gmp_printf("q (%d bits) = %Zd\n", mpz_sizeinbase(q, 2), q);
+        gmp_printf("p (%d bits) = %Zd\n", mpz_sizeinbase(r[0], 2), r[0]);
+        gmp_printf("q (%d bits) = %Zd\n", mpz_sizeinbase(r[1], 2), r[1]);
+        for (int i = 2; i < primes; i++) {
+            gmp_printf("r%d (%d bits) = %Zd\n", i + 1, mpz_sizeinbase(r[i], 2), r[i]);
+        }
         gmp_printf("n (%d bits) = %Zd\n", mpz_sizeinbase(n, 2), n);
         gmp_printf("e (%d bits) = %Zd\n", mpz_sizeinbase(e, 2), e);
         gmp_printf("d (%d bits) = %Zd\n", mpz_sizeinbase(d, 2), d);
+        stats_print(stdout);
     }
+    stats_finish();
 
     fclose(pbfile); // Close all the files we opened
     fclose(pvfile);
     randstate_clear();
-    mpz_clears(p, q, n, e, d, m, s, NULL);
+    mpz_clears(p, q, n, e, d, s, NULL);
+    for (int i = 0; i < RSA_PRIMES_MAX; i++) {
+        mpz_clear(r[i]);
+    }
 }
@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "container.h"
+#include "keystore.h"
+#include <gmp.h>
+
+// Computes the FNV-1a hash of a username, which picks its first slot in the username index
+static uint64_t keystore_hash(char *username) {
+    uint64_t hash = 0xcbf29ce484222325; // FNV offset basis
+
+    for (size_t i = 0; username[i] != '\0'; i++) {
+        hash ^= (uint8_t) username[i];
+        hash *= 0x100000001b3; // FNV prime
+    }
+    return hash;
+}
+
+// Returns the bytes of a record with its limbs, rounded up so the next record starts 8 aligned
+size_t keystore_record_size(keystore_record *record) {
+    size_t limbs = (size_t) record->n_limbs + record->e_limbs + record->s_limbs;
+
+    return (sizeof(keystore_record) + limbs * sizeof(mp_limb_t) + 7) & ~(size_t) 7;
+}
+
+// Returns the record at offset in the mapping, or NULL if it doesn't lie whole among the records
+// Offsets come from the file, so every one is checked before it is followed
+static keystore_record *keystore_record_at(keystore *ks, uint64_t offset) {
+    uint64_t end = ks->header->names_offset;
+
+    if (offset < sizeof(keystore_header) || offset % 8 != 0 || offset > end
+        || end - offset < sizeof(keystore_record)) {
+        return NULL;
+    }
+    keystore_record *record = (keystore_record *) (ks->map + offset);
+    if (keystore_record_size(record) > end - offset
+        || memchr(record->username, '\0', KEYSTORE_NAME_MAX) == NULL) {
+        return NULL;
+    }
+    return record;
+}
+
+// Maps the keystore at path read-only into ks
+// Returns false if it can't be opened or isn't a whole keystore written on a machine like this one
+bool keystore_open(keystore *ks, char *path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    memset(ks, 0, sizeof(keystore));
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(keystore_header)) {
+        close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // The mapping keeps the file
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    ks->map = (uint8_t *) map;
+    ks->size = st.st_size;
+    ks->header = (keystore_header *) map;
+
+    keystore_header *header = ks->header;
+    bool valid = memcmp(header->magic, KEYSTORE_MAGIC, 4) == 0
+                 && header->version == KEYSTORE_VERSION
+                 && header->byte_order == KEYSTORE_BYTE_ORDER
+                 && header->limb_bytes == sizeof(mp_limb_t) && header->size == ks->size
+                 && header->buckets > 0 && (header->buckets & (header->buckets - 1)) == 0
+                 && header->buckets / 2 >= header->records
+                 && header->buckets <= ks->size / (2 * sizeof(uint64_t))
+                 && header->names_offset >= sizeof(keystore_header)
+                 && header->names_offset % 8 == 0
+                 && header->fingerprints_offset
+                        == header->names_offset + header->buckets * sizeof(uint64_t)
+                 && header->size
+                        == header->fingerprints_offset + header->buckets * sizeof(uint64_t);
+    if (valid == false) {
+        keystore_close(ks);
+        return false;
+    }
+    return true;
+}
+
+// Unmaps the keystore, records and keys taken from it can't be used after this
+void keystore_close(keystore *ks) {
+    if (ks->map != NULL) {
+        munmap(ks->map, ks->size);
+    }
+    memset(ks, 0, sizeof(keystore));
+    return;
+}
+
+// Looks up the key of username through the username index
+// Returns the record in the mapping, or NULL if the user isn't in the keystore
+keystore_record *keystore_find_user(keystore *ks, char *username) {
+    uint64_t *slots = (uint64_t *) (ks->map + ks->header->names_offset);
+    uint64_t mask = ks->header->buckets - 1;
+    uint64_t i = keystore_hash(username) & mask;
+
+    for (uint64_t probes = 0; probes <= mask && slots[i] != 0; probes++, i = (i + 1) & mask) {
+        keystore_record *record = keystore_record_at(ks, slots[i]);
+
+        if (record != NULL && strcmp(record->username, username) == 0) {
+            return record;
+        }
+    }
+    return NULL;
+}
+
+// Looks up the key with container_fingerprint fingerprint through the fingerprint index
+// Returns the record in the mapping, or NULL if no key in the keystore has it
+keystore_record *keystore_find_fingerprint(keystore *ks, uint64_t fingerprint) {
+    uint64_t *slots = (uint64_t *) (ks->map + ks->header->fingerprints_offset);
+    uint64_t mask = ks->header->buckets - 1;
+    uint64_t i = fingerprint & mask;
+
+    for (uint64_t probes = 0; probes <= mask && slots[i] != 0; probes++, i = (i + 1) & mask) {
+        keystore_record *record = keystore_record_at(ks, slots[i]);
+
+        if (record != NULL && record->fingerprint == fingerprint) {
+            return record;
+        }
+    }
+    return NULL;
+}
+
+// Returns the record after record in the file, the first one if record is NULL, and NULL after
+// the last one or at a damaged record
+keystore_record *keystore_next(keystore *ks, keystore_record *record) {
+    uint64_t offset = sizeof(keystore_header);
+
+    if (record != NULL) {
+        offset = (uint64_t) ((uint8_t *) record - ks->map) + keystore_record_size(record);
+    }
+    return offset < ks->header->names_offset ? keystore_record_at(ks, offset) : NULL;
+}
+
+// Points n, e, and s at the limbs of record in the mapping, nothing is copied or allocated
+// They are read-only, must not be cleared, and last until the keystore is closed
+void keystore_key(keystore_record *record, mpz_t n, mpz_t e, mpz_t s) {
+    mp_limb_t *limbs = (mp_limb_t *) (record + 1);
+
+    mpz_roinit_n(n, limbs, record->n_limbs);
+    mpz_roinit_n(e, limbs + record->n_limbs, record->e_limbs);
+    mpz_roinit_n(s, limbs + record->n_limbs + record->e_limbs, record->s_limbs);
+    return;
+}
+
+// Makes the record of a public key for keystore_write, it is freed with free
+// Returns NULL if the username doesn't fit in a record or a number is negative
+keystore_record *keystore_record_make(mpz_t n, mpz_t e, mpz_t s, char *username) {
+    if (strlen(username) >= KEYSTORE_NAME_MAX || mpz_sgn(n) < 0 || mpz_sgn(e) < 0
+        || mpz_sgn(s) < 0) {
+        return NULL;
+    }
+    keystore_record header = { 0 };
+    header.fingerprint = container_fingerprint(n);
+    header.n_limbs = mpz_size(n);
+    header.e_limbs = mpz_size(e);
+    header.s_limbs = mpz_size(s);
+
+    keystore_record *record = (keystore_record *) calloc(1, keystore_record_size(&header));
+    mp_limb_t *limbs = (mp_limb_t *) (record + 1);
+    *record = header;
+    strcpy(record->username, username);
+    memcpy(limbs, mpz_limbs_read(n), header.n_limbs * sizeof(mp_limb_t));
+    memcpy(limbs + header.n_limbs, mpz_limbs_read(e), header.e_limbs * sizeof(mp_limb_t));
+    memcpy(limbs + header.n_limbs + header.e_limbs, mpz_limbs_read(s),
+        header.s_limbs * sizeof(mp_limb_t));
+    return record;
+}
+
+// Returns the slot of username in an index being built, which holds record numbers plus one,
+// or the empty slot where it would go
+static uint64_t keystore_name_slot(uint64_t *slots, uint64_t mask, keystore_record *records[],
+    char *username) {
+    uint64_t i = keystore_hash(username) & mask;
+
+    while (slots[i] != 0 && strcmp(records[slots[i] - 1]->username, username) != 0) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+// Returns the slot of fingerprint in an index being built, or the empty slot where it would go
+static uint64_t keystore_fingerprint_slot(uint64_t *slots, uint64_t mask,
+    keystore_record *records[], uint64_t fingerprint) {
+    uint64_t i = fingerprint & mask;
+
+    while (slots[i] != 0 && records[slots[i] - 1]->fingerprint != fingerprint) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+// Writes records as a new keystore at path, in their order
+// A later record replaces an earlier one with the same username or the same key, so appending a
+// user's new key retires the old one
+// The file is written beside path and renamed over it, readers see the old keystore or the new one
+// Returns false if it couldn't be written
+bool keystore_write(char *path, keystore_record *records[], size_t count) {
+    keystore_header header = { 0 };
+    uint64_t buckets = 1;
+    uint64_t *offsets = (uint64_t *) calloc(count + 1, sizeof(uint64_t));
+    bool ok = true;
+
+    while (buckets < 2 * (uint64_t) count) {
+        buckets <<= 1;
+    }
+    uint64_t mask = buckets - 1;
+    uint64_t *names = (uint64_t *) calloc(buckets, sizeof(uint64_t));
+    uint64_t *fingerprints = (uint64_t *) calloc(buckets, sizeof(uint64_t));
+
+    // Walk back from the newest record, keeping one only if neither its username nor its key
+    // has been kept yet
+    for (size_t i = count; i-- > 0;) {
+        uint64_t name = keystore_name_slot(names, mask, records, records[i]->username);
+        uint64_t fingerprint = keystore_fingerprint_slot(fingerprints, mask, records,
+            records[i]->fingerprint);
+
+        if (names[name] == 0 && fingerprints[fingerprint] == 0) {
+            names[name] = i + 1;
+            fingerprints[fingerprint] = i + 1;
+            header.records++;
+        }
+    }
+
+    // Kept records go out in their order, so record numbers become file offsets
+    for (size_t i = 0; i < buckets; i++) {
+        if (names[i] != 0) {
+            offsets[names[i]] = 1;
+        }
+    }
+    uint64_t offset = sizeof(keystore_header);
+    for (size_t i = 1; i <= count; i++) {
+        if (offsets[i] != 0) {
+            offsets[i] = offset;
+            offset += keystore_record_size(records[i - 1]);
+        }
+    }
+    for (size_t i = 0; i < buckets; i++) {
+        names[i] = offsets[names[i]];
+        fingerprints[i] = offsets[fingerprints[i]];
+    }
+
+    memcpy(header.magic, KEYSTORE_MAGIC, 4);
+    header.version = KEYSTORE_VERSION;
+    header.byte_order = KEYSTORE_BYTE_ORDER;
+    header.limb_bytes = sizeof(mp_limb_t);
+    header.buckets = buckets;
+    header.names_offset = offset;
+    header.fingerprints_offset = offset + buckets * sizeof(uint64_t);
+    header.size = header.fingerprints_offset + buckets * sizeof(uint64_t);
+
+    size_t tmp_size = strlen(path) + 5;
+    char *tmp_path = (char *) malloc(tmp_size);
+    snprintf(tmp_path, tmp_size, "%s.tmp", path);
+    FILE *file = fopen(tmp_path, "w");
+    if (file == NULL) {
+        ok = false;
+    } else {
+        fwrite(&header, sizeof(keystore_header), 1, file);
+        for (size_t i = 1; i <= count; i++) {
+            if (offsets[i] != 0) {
+                fwrite(records[i - 1], keystore_record_size(records[i - 1]), 1, file);
+            }
+        }
+        fwrite(names, sizeof(uint64_t), buckets, file);
+        fwrite(fingerprints, sizeof(uint64_t), buckets, file);
+        ok = ferror(file) == 0 && fflush(file) == 0 && fsync(fileno(file)) == 0;
+        ok = fclose(file) == 0 && ok == true;
+        ok = ok == true && rename(tmp_path, path) == 0;
+        if (ok == false) {
+            unlink(tmp_path);
+        }
+    }
+    free(tmp_path);
+    free(names);
+    free(fingerprints);
+    free(offsets);
+    return ok;
+}
+
+// Takes an exclusive lock on path.lock, held while a keystore is read, changed, and written back,
+// so two appends at once can't lose each other's keys. Readers don't need it
+// Returns the descriptor for keystore_unlock, or -1 if the lock file can't be opened
+int keystore_lock(char *path) {
+    size_t lock_size = strlen(path) + 6;
+    char *lock_path = (char *) malloc(lock_size);
+
+    snprintf(lock_path, lock_size, "%s.lock", path);
+    int fd = open(lock_path, O_RDWR | O_CREAT, 0600);
+    free(lock_path);
+    if (fd >= 0) {
+        flock(fd, LOCK_EX);
+    }
+    return fd;
+}
+
+// Drops a lock taken by keystore_lock
+void keystore_unlock(int fd) {
+    flock(fd, LOCK_UN);
+    close(fd);
+    return;
+}
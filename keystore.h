@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <gmp.h>
+
+// Keystore file, the public keys of many users in one file that is memory-mapped read-only
+// header | record 0 | record 1 | ... | username index | fingerprint index
+// Every field is stored as this machine keeps it and the numbers as GMP limbs, so a key is used
+// straight out of the mapping. A file from a machine with another byte order or limb size is
+// refused
+// Each index is an open addressing table of header.buckets record offsets, 0 marks an empty slot,
+// probed linearly from the FNV-1a hash of the username or from the key's container_fingerprint
+// Files are never changed in place: keystore_write writes a new file and renames it over the old
+// one, so a process that has the old file mapped keeps a consistent view of it
+
+#define KEYSTORE_MAGIC "RSAK"
+#define KEYSTORE_VERSION 1
+#define KEYSTORE_BYTE_ORDER 0x01020304
+#define KEYSTORE_NAME_MAX 32 // Bytes for a username and its NUL, as many as encrypt reads
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order; // KEYSTORE_BYTE_ORDER
+    uint32_t limb_bytes; // sizeof(mp_limb_t)
+    uint64_t records;
+    uint64_t buckets; // Slots in each index, a power of two at least twice records
+    uint64_t names_offset; // Where the username index starts, the records end here
+    uint64_t fingerprints_offset;
+    uint64_t size; // Bytes in the whole file, a shorter file was cut off
+} keystore_header;
+
+// One public key, followed by the limbs of n, e, and s, least significant first
+typedef struct {
+    uint64_t fingerprint; // container_fingerprint of n
+    uint32_t n_limbs;
+    uint32_t e_limbs;
+    uint32_t s_limbs;
+    uint32_t reserved;
+    char username[KEYSTORE_NAME_MAX]; // NUL padded
+} keystore_record;
+
+typedef struct {
+    uint8_t *map;
+    size_t size;
+    keystore_header *header;
+} keystore;
+
+bool keystore_open(keystore *ks, char *path);
+
+void keystore_close(keystore *ks);
+
+keystore_record *keystore_find_user(keystore *ks, char *username);
+
+keystore_record *keystore_find_fingerprint(keystore *ks, uint64_t fingerprint);
+
+keystore_record *keystore_next(keystore *ks, keystore_record *record);
+
+size_t keystore_record_size(keystore_record *record);
+
+void keystore_key(keystore_record *record, mpz_t n, mpz_t e, mpz_t s);
+
+keystore_record *keystore_record_make(mpz_t n, mpz_t e, mpz_t s, char *username);
+
+bool keystore_write(char *path, keystore_record *records[], size_t count);
+
+int keystore_lock(char *path);
+
+void keystore_unlock(int fd);
@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "mbexp.h"
+#include "mont.h"
+#include "stats.h"
+#include <gmp.h>
+
+#if defined(__x86_64__) && defined(__GNUC__) && GMP_NUMB_BITS == 64
+#define MBEXP_IFMA 1
+#include <immintrin.h>
+#define MBEXP_TARGET __attribute__((target("avx512f,avx512ifma")))
+#endif
+
+#define MBEXP_MASK (((uint64_t) 1 << MBEXP_DIGIT_BITS) - 1)
+
+// Returns true if the CPU and the build can run the multi-buffer kernel
+bool mbexp_available(void) {
+#ifdef MBEXP_IFMA
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512ifma");
+#else
+    return false;
+#endif
+}
+
+#ifdef MBEXP_IFMA
+
+// Stores the digits of z in one lane of the digit-major array at out, z must fit in digits digits
+static void mbexp_to_lanes(uint64_t *out, size_t lane, mpz_t z, size_t digits) {
+    const mp_limb_t *limbs = mpz_limbs_read(z);
+    size_t size = mpz_size(z);
+
+    for (size_t i = 0; i < digits; i++) {
+        size_t limb = i * MBEXP_DIGIT_BITS / 64;
+        unsigned shift = i * MBEXP_DIGIT_BITS % 64;
+        uint64_t digit = 0;
+        if (limb < size) {
+            digit = limbs[limb] >> shift;
+        }
+        if (shift > 64 - MBEXP_DIGIT_BITS && limb + 1 < size) { // Digit runs into the next limb
+            digit |= limbs[limb + 1] << (64 - shift);
+        }
+        out[i * MBEXP_LANES + lane] = digit & MBEXP_MASK;
+    }
+    return;
+}
+
+// Sets z to the number held in one lane of the digit-major array at in
+static void mbexp_from_lanes(mpz_t z, uint64_t *in, size_t lane, size_t digits) {
+    size_t size = (digits * MBEXP_DIGIT_BITS + 63) / 64;
+    mp_limb_t *limbs = mpz_limbs_write(z, size);
+
+    mpn_zero(limbs, size);
+    for (size_t i = 0; i < digits; i++) {
+        size_t limb = i * MBEXP_DIGIT_BITS / 64;
+        unsigned shift = i * MBEXP_DIGIT_BITS % 64;
+        uint64_t digit = in[i * MBEXP_LANES + lane];
+        limbs[limb] |= digit << shift;
+        if (shift > 64 - MBEXP_DIGIT_BITS) {
+            limbs[limb + 1] |= digit >> (64 - shift);
+        }
+    }
+    mpz_limbs_finish(z, size);
+    return;
+}
+
+// Montgomery product r = a * b * R^-1 (mod n) in every lane, below 2n when a and b are
+// Works column by column, the column and the high halves that carry into the next one stay in
+// two registers, and the column's own multiple m of n is chosen to clear its low 52 bits
+// r may be a or b, m holds digits vectors of scratch
+static MBEXP_TARGET void mbexp_mul(
+    __m512i *r, __m512i *a, __m512i *b, mbexp_ctx *ctx, __m512i *m) {
+    size_t digits = ctx->digits;
+    __m512i mask = _mm512_set1_epi64(MBEXP_MASK);
+    __m512i ninv = _mm512_set1_epi64(ctx->ninv);
+    __m512i zero = _mm512_setzero_si512();
+    __m512i col = zero;
+    __m512i next = zero;
+
+    for (size_t k = 0; k < 2 * digits - 1; k++) {
+        size_t lo = k < digits ? 0 : k - digits + 1;
+        size_t hi = k < digits ? k : digits - 1;
+        if (a == b) { // A square has each cross product twice, so sum them once and double
+            __m512i cross = zero;
+            __m512i cross_next = zero;
+            for (size_t i = lo; i < k - i; i++) {
+                cross = _mm512_madd52lo_epu64(cross, a[i], a[k - i]);
+                cross_next = _mm512_madd52hi_epu64(cross_next, a[i], a[k - i]);
+            }
+            col = _mm512_add_epi64(col, _mm512_add_epi64(cross, cross));
+            next = _mm512_add_epi64(next, _mm512_add_epi64(cross_next, cross_next));
+            if (k % 2 == 0) {
+                col = _mm512_madd52lo_epu64(col, a[k / 2], a[k / 2]);
+                next = _mm512_madd52hi_epu64(next, a[k / 2], a[k / 2]);
+            }
+        } else {
+            for (size_t i = lo; i <= hi; i++) {
+                col = _mm512_madd52lo_epu64(col, a[i], b[k - i]);
+                next = _mm512_madd52hi_epu64(next, a[i], b[k - i]);
+            }
+        }
+        for (size_t i = lo; i <= hi && i < k; i++) {
+            __m512i nj = _mm512_set1_epi64(ctx->n[k - i]);
+            col = _mm512_madd52lo_epu64(col, m[i], nj);
+            next = _mm512_madd52hi_epu64(next, m[i], nj);
+        }
+        if (k < digits) { // Adding m[k] * n makes the column zero mod 2^52
+            __m512i n0 = _mm512_set1_epi64(ctx->n[0]);
+            m[k] = _mm512_madd52lo_epu64(zero, col, ninv);
+            col = _mm512_madd52lo_epu64(col, m[k], n0);
+            next = _mm512_madd52hi_epu64(next, m[k], n0);
+        } else {
+            r[k - digits] = _mm512_and_si512(col, mask);
+        }
+        col = _mm512_add_epi64(next, _mm512_srli_epi64(col, MBEXP_DIGIT_BITS));
+        next = zero;
+    }
+    r[digits - 1] = col; // Below 2n < 2^(52 * digits), so the last column has no carry
+    STATS_ADD(STAT_MODMULS, MBEXP_LANES);
+    return;
+}
+
+// Runs the exponentiation on the bases already in the lanes of x, leaves the results in acc
+// Same windows as mont_pow_exp, so every lane does the same steps in the same order
+static MBEXP_TARGET void mbexp_pow_lanes(mbexp_ctx *ctx) {
+    size_t digits = ctx->digits;
+    size_t table_size = (size_t) 1 << (ctx->rec.window - 1);
+    mont_exp *rec = &ctx->rec;
+    __m512i *acc = (__m512i *) ctx->lanes;
+    __m512i *b2 = acc + digits;
+    __m512i *x = b2 + digits;
+    __m512i *m = x + digits;
+    __m512i *table = m + digits; // table[i] = b^(2i + 1) in Montgomery form
+    __m512i *r2 = (__m512i *) ctx->r2;
+
+    mbexp_mul(table, x, r2, ctx, m); // table[0] = b * R (mod n)
+    if (table_size > 1) {
+        mbexp_mul(b2, table, table, ctx, m);
+    }
+    for (size_t i = 1; i < table_size; i++) {
+        mbexp_mul(table + i * digits, table + (i - 1) * digits, b2, ctx, m);
+    }
+
+    // The first window loads its table entry instead of multiplying into R
+    memcpy(acc, table + (rec->digits[0] >> 1) * digits, digits * sizeof(__m512i));
+    for (size_t i = 1; i < rec->count; i++) {
+        for (uint32_t j = 0; j < rec->shifts[i]; j++) {
+            mbexp_mul(acc, acc, acc, ctx, m);
+        }
+        mbexp_mul(acc, acc, table + (rec->digits[i] >> 1) * digits, ctx, m);
+    }
+    for (size_t j = 0; j < rec->tail; j++) {
+        mbexp_mul(acc, acc, acc, ctx, m);
+    }
+
+    memset(b2, 0, digits * sizeof(__m512i)); // Multiply by 1 to leave Montgomery form
+    b2[0] = _mm512_set1_epi64(1);
+    mbexp_mul(acc, acc, b2, ctx, m);
+    return;
+}
+
+#endif
+
+// Sets up the exponentiation of many bases to a positive exponent modulo an odd n
+// Returns false, with nothing to clear, if the CPU lacks AVX-512 IFMA or n or exponent don't fit
+bool mbexp_init(mbexp_ctx *ctx, mpz_t n, mpz_t exponent) {
+#ifdef MBEXP_IFMA
+    if (mbexp_available() == false || mpz_even_p(n) || mpz_cmp_ui(n, 1) <= 0
+        || mpz_sgn(exponent) <= 0) {
+        return false;
+    }
+    mpz_t r;
+    size_t words;
+
+    ctx->digits = (mpz_sizeinbase(n, 2) + 2 + MBEXP_DIGIT_BITS - 1) / MBEXP_DIGIT_BITS;
+    mpz_init_set(ctx->modulus, n);
+    mpz_init2(ctx->b, ctx->digits * MBEXP_DIGIT_BITS);
+    mont_exp_init(&ctx->rec, exponent);
+
+    uint64_t n0 = mpz_getlimbn(n, 0);
+    uint64_t x = n0; // n0 * n0 = 1 (mod 8), Newton steps double the correct bits from there
+    for (int i = 0; i < 6; i++) {
+        x *= 2 - n0 * x;
+    }
+    ctx->ninv = -x & MBEXP_MASK;
+
+    ctx->n = (uint64_t *) malloc(ctx->digits * sizeof(uint64_t));
+    words = ctx->digits * MBEXP_LANES;
+    ctx->r2 = (uint64_t *) aligned_alloc(64, words * sizeof(uint64_t));
+    words *= 4 + ((size_t) 1 << (ctx->rec.window - 1));
+    ctx->lanes = (uint64_t *) aligned_alloc(64, words * sizeof(uint64_t));
+
+    mpz_init(r);
+    mpz_setbit(r, 2 * ctx->digits * MBEXP_DIGIT_BITS);
+    mpz_mod(r, r, n);
+    for (size_t lane = 0; lane < MBEXP_LANES; lane++) { // Every lane multiplies by the same R^2
+        mbexp_to_lanes(ctx->r2, lane, r, ctx->digits);
+    }
+    mbexp_to_lanes(ctx->lanes, 0, n, ctx->digits); // Split n in lane 0 of the scratch space
+    for (size_t i = 0; i < ctx->digits; i++) {
+        ctx->n[i] = ctx->lanes[i * MBEXP_LANES];
+    }
+    mpz_clear(r);
+    return true;
+#else
+    (void) ctx;
+    (void) n;
+    (void) exponent;
+    return false;
+#endif
+}
+
+// Frees everything held by a context that mbexp_init set up
+void mbexp_clear(mbexp_ctx *ctx) {
+    free(ctx->n);
+    free(ctx->r2);
+    free(ctx->lanes);
+    mont_exp_clear(&ctx->rec);
+    mpz_clears(ctx->modulus, ctx->b, NULL);
+    return;
+}
+
+// Computes out[i] = base[i] ^ exponent (mod n) for count bases, count is at most MBEXP_LANES
+// The results are the same numbers mont_pow_exp gives, lanes past count run on zero
+void mbexp_pow(mbexp_ctx *ctx, mpz_t out[], mpz_t base[], size_t count) {
+#ifdef MBEXP_IFMA
+    size_t digits = ctx->digits;
+    uint64_t *x = ctx->lanes + 2 * digits * MBEXP_LANES;
+
+    STATS_ADD(STAT_EXPONENTIATIONS, count);
+    for (size_t lane = 0; lane < MBEXP_LANES; lane++) {
+        if (lane < count) { // Base must be below n before it enters Montgomery form
+            mpz_mod(ctx->b, base[lane], ctx->modulus);
+        } else {
+            mpz_set_ui(ctx->b, 0);
+        }
+        mbexp_to_lanes(x, lane, ctx->b, digits);
+    }
+
+    mbexp_pow_lanes(ctx);
+
+    for (size_t lane = 0; lane < count; lane++) {
+        mbexp_from_lanes(out[lane], ctx->lanes, lane, digits);
+        if (mpz_cmp(out[lane], ctx->modulus) >= 0) { // Leaving Montgomery form can give n for 0
+            mpz_sub(out[lane], out[lane], ctx->modulus);
+        }
+    }
+#else
+    (void) ctx;
+    (void) out;
+    (void) base;
+    (void) count;
+#endif
+    return;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <gmp.h>
+#include "mont.h"
+
+// Multi-buffer exponentiation: up to MBEXP_LANES powers x^e (mod n) with one n and e at once
+// Every number is split into 52-bit digits and lane i of a SIMD register holds a digit of x_i,
+// so one AVX-512 IFMA instruction does a step of all the Montgomery products together
+// mbexp_init checks the CPU at run time, callers keep mont_pow_exp for when it returns false
+
+#define MBEXP_LANES 8
+
+// Digit width, the IFMA instructions multiply the low 52 bits of each 64-bit lane
+#define MBEXP_DIGIT_BITS 52
+
+// Constants and scratch space for the exponentiations of one modulus and exponent
+typedef struct {
+    mpz_t modulus;
+    size_t digits; // Digits per number, R = 2^(52 * digits) is more than 4n
+    uint64_t *n; // Digits of the modulus
+    uint64_t ninv; // -n^-1 mod 2^52
+    uint64_t *r2; // R^2 mod n in every lane, used to move numbers into Montgomery form
+    mont_exp rec; // Sliding window recoding of the exponent, same as mont_pow_exp uses
+    uint64_t *lanes; // Aligned, a word per lane and digit: acc, b^2, base, m, then the table
+    mpz_t b; // One base reduced modulo n
+} mbexp_ctx;
+
+bool mbexp_available(void);
+
+bool mbexp_init(mbexp_ctx *ctx, mpz_t n, mpz_t exponent);
+
+void mbexp_clear(mbexp_ctx *ctx);
+
+void mbexp_pow(mbexp_ctx *ctx, mpz_t out[], mpz_t base[], size_t count);
@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "mont.h"
+#include "stats.h"
+#include <gmp.h>
+
+// Copies the value of z into size limbs at rp, padding the high limbs with zeros
+// z must be non-negative and fit in size limbs
+static void mont_limbs_from_mpz(mp_limb_t *rp, mpz_t z, mp_size_t size) {
+    mp_size_t zn = mpz_size(z);
+
+    if (zn > 0) {
+        mpn_copyi(rp, mpz_limbs_read(z), zn);
+    }
+    if (size > zn) {
+        mpn_zero(rp + zn, size - zn);
+    }
+    return;
+}
+
+// Computes -n^-1 mod 2^GMP_NUMB_BITS for an odd limb n0 using Newton iteration
+// Every step doubles the number of correct low bits
+static mp_limb_t mont_limb_inverse(mp_limb_t n0) {
+    mp_limb_t x = n0; // n0 * n0 = 1 (mod 8), so x starts with 3 correct bits
+
+    for (int i = 0; i < 6; i++) {
+        x *= 2 - n0 * x;
+    }
+    return -x;
+}
+
+// Montgomery reduction of the 2 * size limbs at tp, stores t * R^-1 (mod n) in rp
+// The carry out of each row is parked in the limb that row just cleared, then added in one pass
+// Every size shares this path: unrolled C kernels for fixed limb counts ran 1.5 to 5 times slower
+// than GMP's assembly rows, and fixed-size copies of this code were no faster than it
+static void mont_redc(mp_limb_t *rp, mp_limb_t *tp, mont_ctx *ctx) {
+    mp_size_t size = ctx->size;
+    mp_limb_t cy;
+
+    for (mp_size_t i = 0; i < size; i++) {
+        mp_limb_t u = tp[i] * ctx->ninv; // Chosen so that row i becomes zero
+        tp[i] = mpn_addmul_1(tp + i, ctx->n, size, u);
+    }
+    cy = mpn_add_n(rp, tp + size, tp, size);
+
+    if (cy != 0 || mpn_cmp(rp, ctx->n, size) >= 0) { // Result is below 2n, subtract n at most once
+        mpn_sub_n(rp, rp, ctx->n, size);
+    }
+    return;
+}
+
+// Montgomery product rp = ap * bp * R^-1 (mod n), tp must hold 2 * size limbs
+static void mont_mul(mp_limb_t *rp, mp_limb_t *ap, mp_limb_t *bp, mont_ctx *ctx, mp_limb_t *tp) {
+    mpn_mul_n(tp, ap, bp, ctx->size);
+    mont_redc(rp, tp, ctx);
+    STATS_ADD(STAT_MODMULS, 1);
+    return;
+}
+
+// Montgomery square rp = ap * ap * R^-1 (mod n), tp must hold 2 * size limbs
+// mpn_sqr skips the duplicate cross products that a general multiply would compute
+static void mont_sqr(mp_limb_t *rp, mp_limb_t *ap, mont_ctx *ctx, mp_limb_t *tp) {
+    mpn_sqr(tp, ap, ctx->size);
+    mont_redc(rp, tp, ctx);
+    STATS_ADD(STAT_MODMULS, 1);
+    return;
+}
+
+// Picks the sliding window width for an exponent of the given bit length
+// Larger windows need fewer multiplications but a bigger table of odd powers
+static int mont_window(size_t bits) {
+    if (bits <= 8) {
+        return 1;
+    }
+    if (bits <= 24) {
+        return 2;
+    }
+    if (bits <= 80) {
+        return 3;
+    }
+    if (bits <= 240) {
+        return 4;
+    }
+    if (bits <= 672) {
+        return 5;
+    }
+    return MONT_WINDOW_MAX;
+}
+
+// Allocates a Montgomery context for moduli of up to bits bits, without a modulus yet
+// mont_set then points it at a modulus, as many times as needed
+void mont_reserve(mont_ctx *ctx, uint64_t bits) {
+    ctx->cap = bits > 0 ? (bits + GMP_NUMB_BITS - 1) / GMP_NUMB_BITS : 1;
+    ctx->size = ctx->cap;
+    ctx->n = (mp_limb_t *) calloc(3 * ctx->cap, sizeof(mp_limb_t));
+    ctx->one = ctx->n + ctx->size;
+    ctx->r2 = ctx->one + ctx->size;
+    ctx->ninv = 0;
+    mpz_init2(ctx->modulus, ctx->cap * GMP_NUMB_BITS);
+    mpz_init2(ctx->r, (2 * ctx->cap + 1) * GMP_NUMB_BITS); // Room for (R mod n)^2
+    return;
+}
+
+// Sets up the Montgomery constants for modulus n in a context from mont_reserve or mont_init
+// Nothing is allocated unless n has more limbs than any modulus the context held before
+// Returns false and leaves the context as it was if n is not odd and greater than 1
+bool mont_set(mont_ctx *ctx, mpz_t n) {
+    if (mpz_even_p(n) || mpz_cmp_ui(n, 1) <= 0) {
+        return false;
+    }
+
+    ctx->size = mpz_size(n);
+    if (ctx->size > ctx->cap) {
+        ctx->cap = ctx->size;
+        ctx->n = (mp_limb_t *) realloc(ctx->n, 3 * ctx->cap * sizeof(mp_limb_t));
+        mpz_realloc2(ctx->r, (2 * ctx->cap + 1) * GMP_NUMB_BITS);
+    }
+    ctx->one = ctx->n + ctx->size;
+    ctx->r2 = ctx->one + ctx->size;
+    mpz_set(ctx->modulus, n);
+
+    mont_limbs_from_mpz(ctx->n, n, ctx->size);
+    ctx->ninv = mont_limb_inverse(ctx->n[0]);
+
+    mpz_set_ui(ctx->r, 0);
+    mpz_setbit(ctx->r, ctx->size * GMP_NUMB_BITS);
+    mpz_mod(ctx->r, ctx->r, n); // R mod n
+    mont_limbs_from_mpz(ctx->one, ctx->r, ctx->size);
+    mpz_mul(ctx->r, ctx->r, ctx->r);
+    mpz_mod(ctx->r, ctx->r, n); // R^2 mod n
+    mont_limbs_from_mpz(ctx->r2, ctx->r, ctx->size);
+
+    return true;
+}
+
+// Sets up the Montgomery constants for modulus n
+// Returns false if n is not odd and greater than 1, since Montgomery form needs gcd(n, R) = 1
+bool mont_init(mont_ctx *ctx, mpz_t n) {
+    if (mpz_even_p(n) || mpz_cmp_ui(n, 1) <= 0) {
+        return false;
+    }
+    mont_reserve(ctx, mpz_sizeinbase(n, 2));
+    return mont_set(ctx, n);
+}
+
+// Frees the modulus and limbs held by a Montgomery context
+void mont_clear(mont_ctx *ctx) {
+    mpz_clears(ctx->modulus, ctx->r, NULL);
+    free(ctx->n);
+    ctx->n = NULL;
+    ctx->one = NULL;
+    ctx->r2 = NULL;
+    return;
+}
+
+// Allocates the windows of a recoding for exponents of up to bits bits, without an exponent yet
+void mont_exp_reserve(mont_exp *rec, uint64_t bits) {
+    rec->cap = bits > 0 ? bits : 1; // At most one window per bit
+    rec->window = 1;
+    rec->count = 0;
+    rec->tail = 0;
+    rec->digits = (uint32_t *) calloc(rec->cap, sizeof(uint32_t));
+    rec->shifts = (uint32_t *) calloc(rec->cap, sizeof(uint32_t));
+    return;
+}
+
+// Recodes a positive exponent into sliding windows that end on set bits
+// Windows are listed from the most significant end, the order in which they are applied
+// Reuses the windows of rec unless the exponent has more bits than it has room for
+void mont_exp_set(mont_exp *rec, mpz_t exponent) {
+    size_t bits = mpz_sizeinbase(exponent, 2);
+    size_t i = bits;
+    size_t zeros = 0;
+
+    if (bits > rec->cap) {
+        rec->cap = bits;
+        rec->digits = (uint32_t *) realloc(rec->digits, rec->cap * sizeof(uint32_t));
+        rec->shifts = (uint32_t *) realloc(rec->shifts, rec->cap * sizeof(uint32_t));
+    }
+    rec->window = mont_window(bits);
+    rec->count = 0;
+
+    while (i > 0) {
+        if (mpz_tstbit(exponent, i - 1) == 0) { // Zero bits only square
+            zeros += 1;
+            i -= 1;
+            continue;
+        }
+
+        // Take the longest window of at most window bits that ends on a set bit
+        size_t low = i > (size_t) rec->window ? i - rec->window : 0;
+        while (mpz_tstbit(exponent, low) == 0) {
+            low += 1;
+        }
+        uint32_t value = 0;
+        for (size_t j = i; j > low; j--) {
+            value = (value << 1) | mpz_tstbit(exponent, j - 1);
+        }
+
+        rec->digits[rec->count] = value;
+        rec->shifts[rec->count] = rec->count == 0 ? 0 : zeros + (i - low);
+        rec->count += 1;
+        zeros = 0;
+        i = low;
+    }
+    rec->tail = zeros;
+
+    return;
+}
+
+// Recodes a positive exponent into a newly allocated recoding, see mont_exp_set
+void mont_exp_init(mont_exp *rec, mpz_t exponent) {
+    mont_exp_reserve(rec, mpz_sizeinbase(exponent, 2));
+    mont_exp_set(rec, exponent);
+    return;
+}
+
+// Frees the windows of a recoded exponent
+void mont_exp_clear(mont_exp *rec) {
+    free(rec->digits);
+    free(rec->shifts);
+    rec->digits = NULL;
+    rec->shifts = NULL;
+    return;
+}
+
+// Allocates scratch space for exponentiations modulo ctx with the given window width
+void mont_ws_init(mont_ws *ws, mont_ctx *ctx, int window) {
+    size_t table_size = (size_t) 1 << (window - 1);
+
+    ws->size = ctx->size;
+    ws->window = window;
+    ws->limbs = (mp_limb_t *) malloc((4 + table_size) * ctx->size * sizeof(mp_limb_t));
+    mpz_init2(ws->b, 2 * ctx->size * GMP_NUMB_BITS);
+
+    return;
+}
+
+// Grows a workspace if ctx or the window width need more than it was sized for
+// Does nothing in the usual case of a workspace that is already big enough
+void mont_ws_fit(mont_ws *ws, mont_ctx *ctx, int window) {
+    if (ctx->size <= ws->size && window <= ws->window) {
+        return;
+    }
+    ws->size = ctx->size > ws->size ? ctx->size : ws->size;
+    ws->window = window > ws->window ? window : ws->window;
+    size_t table_size = (size_t) 1 << (ws->window - 1);
+    ws->limbs = (mp_limb_t *) realloc(ws->limbs, (4 + table_size) * ws->size * sizeof(mp_limb_t));
+    mpz_realloc2(ws->b, 2 * ws->size * GMP_NUMB_BITS);
+    return;
+}
+
+// Frees the scratch space of a workspace
+void mont_ws_clear(mont_ws *ws) {
+    free(ws->limbs);
+    ws->limbs = NULL;
+    mpz_clear(ws->b);
+    return;
+}
+
+// Computes (base ^ e) % n for an exponent e recoded by mont_exp_init and the modulus held by ctx
+// All arithmetic is in Montgomery form, ws must be sized for ctx and the window, see mont_ws_fit
+void mont_pow_exp(mpz_t out, mpz_t base, mont_exp *rec, mont_ctx *ctx, mont_ws *ws) {
+    mp_size_t size = ctx->size;
+    size_t table_size = (size_t) 1 << (rec->window - 1);
+    mp_limb_t *acc = ws->limbs;
+    mp_limb_t *b2 = acc + size;
+    mp_limb_t *tp = b2 + size;
+    mp_limb_t *table = tp + 2 * size; // table[i] = b^(2i + 1) in Montgomery form
+
+    STATS_ADD(STAT_EXPONENTIATIONS, 1);
+    mpz_mod(ws->b, base, ctx->modulus); // Base must be below n before it enters Montgomery form
+    mont_limbs_from_mpz(acc, ws->b, size);
+
+    mont_mul(table, acc, ctx->r2, ctx, tp); // table[0] = b * R (mod n)
+    if (table_size > 1) {
+        mont_sqr(b2, table, ctx, tp);
+    }
+    for (size_t i = 1; i < table_size; i++) {
+        mont_mul(table + i * size, table + (i - 1) * size, b2, ctx, tp);
+    }
+
+    // The first window loads its table entry instead of multiplying into R
+    mpn_copyi(acc, table + (rec->digits[0] >> 1) * size, size);
+    for (size_t i = 1; i < rec->count; i++) {
+        for (uint32_t j = 0; j < rec->shifts[i]; j++) {
+            mont_sqr(acc, acc, ctx, tp);
+        }
+        mont_mul(acc, acc, table + (rec->digits[i] >> 1) * size, ctx, tp);
+    }
+    for (size_t j = 0; j < rec->tail; j++) {
+        mont_sqr(acc, acc, ctx, tp);
+    }
+
+    mpn_copyi(tp, acc, size); // Multiply by 1 to leave Montgomery form
+    mpn_zero(tp + size, size);
+    mont_redc(acc, tp, ctx);
+
+    mpn_copyi(mpz_limbs_write(out, size), acc, size);
+    mpz_limbs_finish(out, size);
+
+    return;
+}
+
+// Computes (base ^ exponent) % n with the modulus held by ctx, exponent must be positive
+// One-off form of mont_pow_exp that recodes the exponent and sizes the scratch space itself
+void mont_pow(mpz_t out, mpz_t base, mpz_t exponent, mont_ctx *ctx) {
+    mont_exp rec;
+    mont_ws ws;
+
+    mont_exp_init(&rec, exponent);
+    mont_ws_init(&ws, ctx, rec.window);
+    mont_pow_exp(out, base, &rec, ctx, &ws);
+    mont_ws_clear(&ws);
+    mont_exp_clear(&rec);
+
+    return;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <gmp.h>
+
+// Constants for Montgomery multiplication modulo an odd n, computed once by mont_init
+typedef struct {
+    mpz_t modulus; // n itself, for reducing inputs
+    mp_size_t size; // Number of limbs in n
+    mp_size_t cap; // Limbs allocated for each of n, one, and r2, see mont_set
+    mp_limb_t *n; // Limbs of the modulus
+    mp_limb_t ninv; // -n^-1 mod 2^GMP_NUMB_BITS
+    mp_limb_t *one; // R mod n, which is 1 in Montgomery form
+    mp_limb_t *r2; // R^2 mod n, used to move numbers into Montgomery form
+    mpz_t r; // R and R^2 mod n while mont_set computes them
+} mont_ctx;
+
+// Widest sliding window mont_exp_init picks
+#define MONT_WINDOW_MAX 6
+
+// Sliding window recoding of a fixed exponent, so it can be reused for many bases
+// Step i squares shifts[i] times and then multiplies by base^digits[i], digits are odd
+typedef struct {
+    int window; // Window width, the table needs 2^(window - 1) odd powers
+    size_t count; // Number of windows
+    size_t cap; // Windows digits and shifts have room for, one per exponent bit
+    uint32_t *digits;
+    uint32_t *shifts; // shifts[0] is always 0, the first window only loads the table entry
+    size_t tail; // Squarings left after the last window, one per trailing zero bit
+} mont_exp;
+
+// Scratch space for mont_pow_exp, sized once for a modulus and a window width
+typedef struct {
+    mp_size_t size; // Limb count it was sized for
+    int window; // Window width it was sized for
+    mp_limb_t *limbs; // acc, b^2, 2 * size product limbs, then the table of odd powers
+    mpz_t b; // Base reduced modulo n
+} mont_ws;
+
+bool mont_init(mont_ctx *ctx, mpz_t n);
+
+void mont_reserve(mont_ctx *ctx, uint64_t bits);
+
+bool mont_set(mont_ctx *ctx, mpz_t n);
+
+void mont_clear(mont_ctx *ctx);
+
+void mont_exp_init(mont_exp *rec, mpz_t exponent);
+
+void mont_exp_reserve(mont_exp *rec, uint64_t bits);
+
+void mont_exp_set(mont_exp *rec, mpz_t exponent);
+
+void mont_exp_clear(mont_exp *rec);
+
+void mont_ws_init(mont_ws *ws, mont_ctx *ctx, int window);
+
+void mont_ws_fit(mont_ws *ws, mont_ctx *ctx, int window);
+
+void mont_ws_clear(mont_ws *ws);
+
+void mont_pow_exp(mpz_t out, mpz_t base, mont_exp *rec, mont_ctx *ctx, mont_ws *ws);
+
+void mont_pow(mpz_t out, mpz_t base, mpz_t exponent, mont_ctx *ctx);
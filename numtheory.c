@@ -1,162 +1,802 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
 #include "numtheory.h"
 #include "randstate.h"
+#include "mont.h"
+#include "stats.h"
 #include <gmp.h>
 
-// Computes (base ^ exponent) % modulus
-// No return value
-void pow_mod(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus) {
-    mpz_t p;
-    mpz_t v;
-    mpz_t exponent_mod;
-    mpz_t exponent_temp;
-    mpz_t p_squared;
-
-    mpz_init(p_squared);
-    mpz_init_set(exponent_temp, exponent);
-    mpz_init_set(exponent_mod, modulus);
-    mpz_init_set_ui(v, 1);
-    mpz_init_set(p, base);
-
-    while (mpz_cmp_ui(exponent_temp, 0) > 0) { // Check if exponent is greater than 0
-        if ((mpz_odd_p(exponent_temp)) != 0) { // Checks if exponent is odd
+// Exponents of at most this many bits skip the Montgomery setup in pow_mod
+#define POW_MOD_MONT_MIN_BITS 4
+
+// Sets up only the temporaries of a workspace, sized for moduli of up to bits bits
+// Each gets room for a product of two such numbers, so they never have to grow
+// Enough for gcd_ws and mod_inverse_ws, which never touch the Montgomery parts
+static void numtheory_ws_init_temps(numtheory_ws *ws, uint64_t bits) {
+    for (int i = 0; i < NUMTHEORY_WS_TEMPS; i++) {
+        mpz_init2(ws->t[i], 2 * bits + 2 * GMP_NUMB_BITS);
+    }
+    return;
+}
+
+// Frees a workspace set up by numtheory_ws_init_temps
+static void numtheory_ws_clear_temps(numtheory_ws *ws) {
+    for (int i = 0; i < NUMTHEORY_WS_TEMPS; i++) {
+        mpz_clear(ws->t[i]);
+    }
+    return;
+}
+
+// Allocates a workspace for the _ws functions, sized for moduli of up to bits bits
+void numtheory_ws_init(numtheory_ws *ws, uint64_t bits) {
+    mont_reserve(&ws->ctx, bits);
+    mont_exp_reserve(&ws->rec, bits);
+    mont_ws_init(&ws->mont, &ws->ctx, MONT_WINDOW_MAX);
+    numtheory_ws_init_temps(ws, bits);
+    return;
+}
+
+// Frees everything held by a workspace
+void numtheory_ws_clear(numtheory_ws *ws) {
+    mont_ws_clear(&ws->mont);
+    mont_exp_clear(&ws->rec);
+    mont_clear(&ws->ctx);
+    numtheory_ws_clear_temps(ws);
+    return;
+}
+
+// Computes (base ^ exponent) % modulus by plain square-and-multiply, p and v are scratch
+static void pow_mod_plain(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus, mpz_t p, mpz_t v) {
+    mpz_set_ui(v, 1);
+    mpz_set(p, base);
+    STATS_ADD(STAT_EXPONENTIATIONS, 1);
+
+    size_t bits = mpz_sgn(exponent) > 0 ? mpz_sizeinbase(exponent, 2) : 0;
+    for (size_t i = 0; i < bits; i++) { // Walk the exponent bits instead of halving a copy
+        if (mpz_tstbit(exponent, i) != 0) { // Checks if the current bit is set
             mpz_mul(v, v, p);
-            mpz_mod(v, v, exponent_mod);
+            mpz_mod(v, v, modulus);
+            STATS_ADD(STAT_MODMULS, 1);
+        }
+        if (i + 1 < bits) { // The square after the top bit would be thrown away
+            mpz_mul(p, p, p);
+            mpz_mod(p, p, modulus);
+            STATS_ADD(STAT_MODMULS, 1);
         }
-        mpz_mul(p_squared, p, p);
-        mpz_mod(p, p_squared, exponent_mod);
-        mpz_fdiv_q_ui(exponent_temp, exponent_temp, 2); // Floor division of exponent / 2
     }
     mpz_set(out, v); // Store result in out
-    mpz_clear(p);
-    mpz_clear(v);
-    mpz_clear(exponent_mod);
-    mpz_clear(exponent_temp);
-    mpz_clear(p_squared);
 
     return;
 }
 
-// Miller-Rabin Test
-// Checks if n is prime using Miller Rabin test, returns true if so, or false otherwise
-bool is_prime(mpz_t n, uint64_t iters) {
+// Computes (base ^ exponent) % modulus like pow_mod, with the scratch space of ws
+// The Montgomery constants and exponent recoding are redone in place, nothing is allocated
+// Uses t[0] and t[1]
+void pow_mod_ws(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus, numtheory_ws *ws) {
+    if (mpz_sizeinbase(exponent, 2) > POW_MOD_MONT_MIN_BITS && mpz_sgn(exponent) > 0
+        && mont_set(&ws->ctx, modulus)) {
+        mont_exp_set(&ws->rec, exponent);
+        mont_ws_fit(&ws->mont, &ws->ctx, ws->rec.window);
+        mont_pow_exp(out, base, &ws->rec, &ws->ctx, &ws->mont);
+        return;
+    }
+    pow_mod_plain(out, base, exponent, modulus, ws->t[0], ws->t[1]);
 
-    mpz_t r, s, y, j, a, n_minus_one, r_mod, s_minus_one, temp_exponent, n_minus_three;
-    mpz_inits(r, y, j, a, s, n_minus_one, s_minus_one, r_mod, n_minus_three, NULL);
+    return;
+}
 
-    mpz_init_set_ui(temp_exponent, 2);
-    mpz_sub_ui(n_minus_one, n, 1);
-    mpz_sub_ui(n_minus_three, n, 3);
+// Computes (base ^ exponent) % modulus
+// Odd moduli go through the Montgomery sliding window engine in mont.c
+// Even moduli and tiny exponents use plain square-and-multiply, which has no setup cost
+// One-off form of pow_mod_ws that only sets up what its path needs, loops should keep a workspace
+// No return value
+void pow_mod(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus) {
+    mont_ctx ctx;
+    mpz_t p, v;
 
-    if (mpz_cmp_ui(n, 0) == 0) { // if n = 0, return false
-        mpz_clears(
-            r, y, j, a, s, n_minus_one, s_minus_one, r_mod, n_minus_three, temp_exponent, NULL);
-        return false;
+    if (mpz_sizeinbase(exponent, 2) > POW_MOD_MONT_MIN_BITS && mpz_sgn(exponent) > 0
+        && mont_init(&ctx, modulus)) { // Sized for this modulus and exponent alone
+        mont_pow(out, base, exponent, &ctx);
+        mont_clear(&ctx);
+        return;
     }
+    mpz_inits(p, v, NULL);
+    pow_mod_plain(out, base, exponent, modulus, p, v);
+    mpz_clears(p, v, NULL);
+    return;
+}
 
-    if (mpz_cmp_ui(n, 1) == 0) { // if n = 1, return false
-        mpz_clears(
-            r, y, j, a, s, n_minus_one, s_minus_one, r_mod, n_minus_three, temp_exponent, NULL);
-        return false;
+// Computes (base ^ exponent) % modulus for a small exponent such as 65537
+// Left to right square-and-multiply with no setup, which is the shortest addition chain for
+// sparse exponents and beats building a Montgomery context for only a few dozen products
+// No return value
+void pow_mod_ui(mpz_t out, mpz_t base, uint64_t exponent, mpz_t modulus) {
+    mpz_t b, v;
+
+    if (exponent == 0) {
+        mpz_set_ui(out, 1);
+        mpz_mod(out, out, modulus);
+        return;
+    }
+    STATS_ADD(STAT_EXPONENTIATIONS, 1);
+    mpz_init(b);
+    mpz_mod(b, base, modulus);
+    mpz_init_set(v, b);
+    int top = 63;
+    while (((exponent >> top) & 1) == 0) {
+        top -= 1;
     }
+    for (int i = top - 1; i >= 0; i--) { // The top bit is already in v
+        mpz_mul(v, v, v);
+        mpz_mod(v, v, modulus);
+        if (((exponent >> i) & 1) != 0) {
+            mpz_mul(v, v, b);
+            mpz_mod(v, v, modulus);
+            STATS_ADD(STAT_MODMULS, 1);
+        }
+    }
+    STATS_ADD(STAT_MODMULS, top);
+    mpz_set(out, v);
+    mpz_clears(b, v, NULL);
+    return;
+}
 
-    if (mpz_cmp_ui(n, 2) == 0) { // if n = 2, return true
-        mpz_clears(
-            r, y, j, a, s, n_minus_one, s_minus_one, r_mod, n_minus_three, temp_exponent, NULL);
-        return true;
+// Odd primes below this bound are used to sieve prime candidates, there are 6541 of them
+#define SIEVE_PRIME_BOUND (1 << 16)
+
+// Candidates p, p + 2, ... sieved at a time before moving the window along
+#define SIEVE_WINDOW 4096
+
+static uint32_t sieve_primes[SIEVE_PRIME_BOUND / 2];
+static size_t sieve_prime_count;
+static pthread_once_t sieve_primes_once = PTHREAD_ONCE_INIT;
+
+// Fills sieve_primes with the odd primes below SIEVE_PRIME_BOUND using Eratosthenes
+static void sieve_primes_init(void) {
+    static bool composite[SIEVE_PRIME_BOUND];
+
+    for (uint32_t i = 3; i < SIEVE_PRIME_BOUND; i += 2) {
+        if (composite[i] == true) {
+            continue;
+        }
+        sieve_primes[sieve_prime_count++] = i;
+        for (uint32_t j = i * i; j < SIEVE_PRIME_BOUND; j += 2 * i) {
+            composite[j] = true;
+        }
     }
+    return;
+}
 
-    if (mpz_cmp_ui(n, 3) == 0) { // if n = 3, return true
-        mpz_clears(
-            r, y, j, a, s, n_minus_one, s_minus_one, r_mod, n_minus_three, temp_exponent, NULL);
+// Odd primes tried by trial division in is_prime, 3 through 1229
+#define TRIAL_PRIMES 200
+
+// Numbers with no factor among the trial primes and below this are prime, 1231^2
+#define TRIAL_BOUND 1515361
+
+// Miller-Rabin state for one odd n > 3, set up once and reused for every base
+// Lives in a workspace, which holds the Montgomery constants for n and the recoding of r
+typedef struct {
+    mpz_ptr n;
+    mpz_ptr n_minus_one; // t[2] of the workspace
+    uint64_t s; // n - 1 = r * 2^s with r odd
+    mpz_ptr y; // t[3] of the workspace
+    numtheory_ws *ws;
+} prime_test;
+
+static void prime_test_init(prime_test *pt, mpz_t n, numtheory_ws *ws) {
+    mpz_ptr r = ws->t[4];
+
+    pt->n = n;
+    pt->n_minus_one = ws->t[2];
+    pt->y = ws->t[3];
+    pt->ws = ws;
+    mpz_sub_ui(pt->n_minus_one, n, 1);
+    pt->s = mpz_scan1(pt->n_minus_one, 0);
+    mpz_tdiv_q_2exp(r, pt->n_minus_one, pt->s);
+    mont_set(&ws->ctx, n);
+    mont_exp_set(&ws->rec, r);
+    mont_ws_fit(&ws->mont, &ws->ctx, ws->rec.window);
+    return;
+}
+
+// Strong probable prime test of n to base a
+// One exponentiation a^r through the Montgomery engine, then at most s - 1 plain squarings
+// Returns false if a proves n composite
+static bool prime_test_sprp(prime_test *pt, mpz_t a) {
+    STATS_ADD(STAT_MR_ROUNDS, 1);
+    mont_pow_exp(pt->y, a, &pt->ws->rec, &pt->ws->ctx, &pt->ws->mont);
+    if (mpz_cmp_ui(pt->y, 1) == 0 || mpz_cmp(pt->y, pt->n_minus_one) == 0) {
         return true;
     }
+    for (uint64_t j = 1; j < pt->s; j++) {
+        mpz_mul(pt->y, pt->y, pt->y);
+        mpz_mod(pt->y, pt->y, pt->n);
+        STATS_ADD(STAT_MODMULS, 1);
+        if (mpz_cmp(pt->y, pt->n_minus_one) == 0) {
+            return true;
+        }
+        if (mpz_cmp_ui(pt->y, 1) == 0) { // A square root of 1 other than -1
+            return false;
+        }
+    }
+    return false;
+}
+
+// Halves x modulo the odd n, x must already be reduced
+static void lucas_half(mpz_t x, mpz_t n) {
+    if (mpz_odd_p(x)) {
+        mpz_add(x, x, n);
+    }
+    mpz_tdiv_q_2exp(x, x, 1);
+    return;
+}
+
+// Strong Lucas probable prime test of an odd n > 3 that isn't a perfect square
+// Selfridge parameters: the first D in 5, -7, 9, -11, ... with (D/n) = -1, P = 1, Q = (1 - D)/4
+// Uses t[0] through t[6] of ws
+// Returns false if n is proven composite
+static bool strong_lucas(mpz_t n, numtheory_ws *ws) {
+    int64_t d = 5;
+    mpz_ptr big_d = ws->t[0], q = ws->t[1], k = ws->t[2], u = ws->t[3];
+    mpz_ptr v = ws->t[4], qk = ws->t[5], t = ws->t[6];
+    bool prime = false;
+
+    STATS_ADD(STAT_LUCAS_TESTS, 1);
+    while (true) {
+        mpz_set_si(big_d, d);
+        int jacobi = mpz_jacobi(big_d, n);
+        if (jacobi == -1) {
+            break;
+        }
+        if (jacobi == 0 && mpz_cmpabs_ui(n, d < 0 ? -d : d) != 0) { // D shares a factor with n
+            return false;
+        }
+        d = d > 0 ? -(d + 2) : -d + 2;
+    }
+    mpz_set_si(q, (1 - d) / 4);
+    mpz_mod(q, q, n);
+    mpz_mod(big_d, big_d, n);
+
+    // n + 1 = k * 2^s with k odd
+    mpz_add_ui(k, n, 1);
+    uint64_t s = mpz_scan1(k, 0);
+    mpz_tdiv_q_2exp(k, k, s);
+
+    // U_1 = 1, V_1 = P = 1, then walk down the bits of k doubling and adding one
+    mpz_set_ui(u, 1);
+    mpz_set_ui(v, 1);
+    mpz_set(qk, q);
+    for (size_t i = mpz_sizeinbase(k, 2) - 1; i-- > 0;) {
+        mpz_mul(u, u, v); // U_2j = U_j * V_j
+        mpz_mod(u, u, n);
+        mpz_mul(v, v, v); // V_2j = V_j^2 - 2 * Q^j
+        mpz_submul_ui(v, qk, 2);
+        mpz_mod(v, v, n);
+        mpz_mul(qk, qk, qk);
+        mpz_mod(qk, qk, n);
+        if (mpz_tstbit(k, i) != 0) {
+            mpz_add(t, u, v); // U_j+1 = (P * U_j + V_j) / 2
+            mpz_mod(t, t, n);
+            lucas_half(t, n);
+            mpz_mul(u, u, big_d); // V_j+1 = (D * U_j + P * V_j) / 2
+            mpz_add(v, v, u);
+            mpz_mod(v, v, n);
+            lucas_half(v, n);
+            mpz_swap(u, t);
+            mpz_mul(qk, qk, q);
+            mpz_mod(qk, qk, n);
+        }
+    }
 
-    if ((mpz_even_p(n) != 0)) { // if n is even, return false
-        mpz_clears(
-            r, y, j, a, s, n_minus_one, s_minus_one, r_mod, n_minus_three, temp_exponent, NULL);
+    if (mpz_sgn(u) == 0 || mpz_sgn(v) == 0) {
+        prime = true;
+    }
+    for (uint64_t r = 1; r < s && prime == false; r++) { // V_k*2^r = 0 for some r < s
+        mpz_mul(v, v, v);
+        mpz_submul_ui(v, qk, 2);
+        mpz_mod(v, v, n);
+        mpz_mul(qk, qk, qk);
+        mpz_mod(qk, qk, n);
+        prime = mpz_sgn(v) == 0;
+    }
+
+    return prime;
+}
+
+// Random-base Miller-Rabin rounds for a bits bit candidate that already passed base 2
+// Follows FIPS 186-4 Appendix C.3, the chance of a composite passing is below 2^-100
+uint64_t prime_rounds(uint64_t bits) {
+    if (bits >= 1536) {
+        return 3;
+    } else if (bits >= 1024) {
+        return 4;
+    } else if (bits >= 512) {
+        return 7;
+    } else if (bits >= 256) {
+        return 16;
+    }
+    return 40; // The table doesn't go below 256 bits, stay conservative
+}
+
+// Checks if n is prime, returns true if so, or false otherwise
+// Trial division and a base 2 strong probable prime test reject almost every composite
+// Survivors then get a strong Lucas test if iters is PRIME_ITERS_BPSW, the FIPS 186-4 round count
+// for their size if it is PRIME_ITERS_FIPS, or iters random-base Miller-Rabin rounds otherwise
+// Same as is_prime with the scratch space of ws, so testing candidate after candidate allocates
+// nothing
+bool is_prime_ws(mpz_t n, uint64_t iters, numtheory_ws *ws) {
+    prime_test pt;
+    bool prime;
+    mpz_ptr a = ws->t[0];
+    mpz_ptr n_minus_three = ws->t[1];
+
+    if (mpz_cmp_ui(n, 2) < 0) { // 0, 1, and negative numbers aren't prime
+        return false;
+    }
+    if (mpz_cmp_ui(n, 2) == 0) {
+        return true;
+    }
+    if (mpz_even_p(n) != 0) {
         return false;
     }
 
-    mpz_set(r, n_minus_one);
-    while ((mpz_even_p(r) != 0)) { // while r is still even, keep dividing r by two
-        mpz_fdiv_q_ui(r, r, 2);
-        mpz_add_ui(s, s, 1);
+    pthread_once(&sieve_primes_once, sieve_primes_init);
+    for (size_t i = 0; i < TRIAL_PRIMES; i++) {
+        if (mpz_cmp_ui(n, sieve_primes[i]) == 0) {
+            return true;
+        }
+        if (mpz_divisible_ui_p(n, sieve_primes[i]) != 0) {
+            STATS_ADD(STAT_REJECT_TRIAL, 1);
+            return false;
+        }
     }
+    if (mpz_cmp_ui(n, TRIAL_BOUND) < 0) {
+        return true;
+    }
+
+    prime_test_init(&pt, n, ws);
+
+    mpz_set_ui(a, 2);
+    prime = prime_test_sprp(&pt, a);
+    if (prime == false) {
+        STATS_ADD(STAT_REJECT_BASE2, 1);
+    } else {
+        if (iters == PRIME_ITERS_BPSW) {
+            prime = mpz_perfect_square_p(n) == 0 && strong_lucas(n, ws);
+        } else {
+            iters = iters == PRIME_ITERS_FIPS ? prime_rounds(mpz_sizeinbase(n, 2)) : iters;
+            mpz_sub_ui(n_minus_three, n, 3);
+            for (uint64_t i = 0; i < iters && prime == true; i++) {
+                mpz_urandomm(a, state, n_minus_three);
+                mpz_add_ui(a, a, 2); // Sets a to range [2, n-2]
+                prime = prime_test_sprp(&pt, a);
+            }
+        }
+        if (prime == false) {
+            STATS_ADD(STAT_REJECT_FINAL, 1);
+        }
+    }
+
+    return prime;
+}
+
+// Checks if n is prime, returns true if so, or false otherwise
+// One-off form of is_prime_ws, see there for the tests
+bool is_prime(mpz_t n, uint64_t iters) {
+    numtheory_ws ws;
+    bool prime;
 
-    mpz_sub_ui(s_minus_one, s, 1); // Initializing s - 1
+    numtheory_ws_init(&ws, mpz_sizeinbase(n, 2));
+    prime = is_prime_ws(n, iters, &ws);
+    numtheory_ws_clear(&ws);
+    return prime;
+}
 
-    for (uint64_t i = 1; i <= iters; i++) {
-        mpz_urandomm(a, state, n_minus_three);
-        mpz_add_ui(a, a, 2); // Sets a to range [2, n-2]
-        pow_mod(y, a, r, n);
+// Returns how many small primes can sieve candidates of bits bits
+// Only primes below 2^(bits - 1) are used, so a candidate is never sieved out by itself
+static size_t sieve_prime_limit(uint64_t bits) {
+    size_t count;
 
-        if ((mpz_cmp_ui(y, 1) != 0) && (mpz_cmp(y, n_minus_one) != 0)) {
-            mpz_set_ui(j, 1);
+    pthread_once(&sieve_primes_once, sieve_primes_init);
+    for (count = 0; count < sieve_prime_count; count++) {
+        if (bits <= 32 && sieve_primes[count] >= (UINT64_C(1) << (bits - 1))) {
+            break;
+        }
+    }
+    return count;
+}
 
-            while ((mpz_cmp(j, s_minus_one) <= 0) && (mpz_cmp(y, n_minus_one) != 0)) {
-                pow_mod(y, y, temp_exponent, n);
+// Sets start to a random odd number of exactly bits bits and residues to start modulo the primes
+static void sieve_start(mpz_t start, uint64_t bits, uint32_t residues[], size_t count) {
+    mpz_urandomb(start, state, bits);
+    mpz_setbit(start, bits - 1);
+    mpz_setbit(start, 0);
+    for (size_t i = 0; i < count; i++) {
+        residues[i] = mpz_fdiv_ui(start, sieve_primes[i]);
+    }
+    return;
+}
 
-                if (mpz_cmp_ui(y, 1) == 0) { // if the pow_mod returns 1, return false
-                    mpz_clears(r, s, y, j, a, n_minus_one, r_mod, s_minus_one, temp_exponent,
-                        n_minus_three, NULL);
-                    return false;
+// Marks the candidates start + 2 * index in the window that a small prime divides
+// Then moves the residues on to the start of the next window without a division
+static void sieve_window(uint8_t composite[], uint32_t residues[], size_t count) {
+    memset(composite, 0, SIEVE_WINDOW);
+    for (size_t i = 0; i < count; i++) {
+        uint32_t prime = sieve_primes[i];
+        // start + 2 * index is divisible by prime at index = -residue / 2 mod prime
+        uint64_t index = (uint64_t) (prime - residues[i]) % prime;
+        index = index * ((prime + 1) / 2) % prime;
+        for (; index < SIEVE_WINDOW; index += prime) {
+            composite[index] = 1;
+        }
+        residues[i] = (residues[i] + 2 * SIEVE_WINDOW) % prime;
+    }
+    return;
+}
+
+// Computes a prime p of exactly bits bits
+// Starts at a random odd number with the top bit set and sieves the window of candidates
+// p, p + 2, ... against the small primes, only the survivors go through Miller-Rabin
+// The residues of the window start are carried over to the next window without a division
+// Every candidate is tested in the same workspace, so the search allocates nothing as it goes
+// No return value
+void make_prime(mpz_t p, uint64_t bits, uint64_t iters) {
+    size_t count; // Small primes used, all of them are below every candidate
+    uint32_t *residues; // Start of the window modulo each small prime
+    uint8_t composite[SIEVE_WINDOW];
+    mpz_t start, candidate;
+    numtheory_ws ws;
+    uint64_t timer = stats_begin();
+
+    bits = bits < 2 ? 2 : bits;
+    count = sieve_prime_limit(bits);
+    residues = (uint32_t *) malloc((count + 1) * sizeof(uint32_t));
+    mpz_init2(start, bits);
+    mpz_init2(candidate, bits);
+    numtheory_ws_init(&ws, bits);
+
+    while (true) {
+        sieve_start(start, bits, residues, count); // Draw a new start once a whole run is empty
+
+        while (mpz_sizeinbase(start, 2) == bits) { // Slide the window until it runs past bits
+            sieve_window(composite, residues, count);
+
+            for (size_t index = 0; index < SIEVE_WINDOW; index++) {
+                if (composite[index] != 0) {
+                    STATS_ADD(STAT_SIEVED, 1);
+                    continue;
+                }
+                mpz_add_ui(candidate, start, 2 * index);
+                if (mpz_sizeinbase(candidate, 2) != bits) { // Ran past the top of the range
+                    break;
+                }
+                if (is_prime_ws(candidate, iters, &ws)) {
+                    mpz_set(p, candidate);
+                    mpz_clears(start, candidate, NULL);
+                    numtheory_ws_clear(&ws);
+                    free(residues);
+                    stats_end(STAGE_PRIME, timer);
+                    return;
                 }
-                mpz_add_ui(j, j, 1);
             }
+            mpz_add_ui(start, start, 2 * SIEVE_WINDOW);
+        }
+    }
+}
 
-            if (mpz_cmp(y, n_minus_one) != 0) { // if y != n-1, return false
-                mpz_clears(r, s, y, j, a, n_minus_one, r_mod, s_minus_one, temp_exponent,
-                    n_minus_three, NULL);
-                return false;
-            }
+// Returns true if e is 0 or gcd(e, p - 1) = 1, so that e has an inverse modulo p - 1
+// Uses t[0] through t[6] of ws
+bool prime_fits_exponent_ws(mpz_t p, mpz_t e, numtheory_ws *ws) {
+    mpz_ptr p_minus_one = ws->t[5], d = ws->t[6];
+    bool fits;
+
+    if (mpz_sgn(e) == 0) {
+        return true;
+    }
+    mpz_sub_ui(p_minus_one, p, 1);
+    gcd_ws(d, e, p_minus_one, ws);
+    fits = mpz_cmp_ui(d, 1) == 0;
+    if (fits == false) {
+        STATS_ADD(STAT_E_RETRIES, 1);
+    }
+    return fits;
+}
+
+// Returns true if e is 0 or gcd(e, p - 1) = 1, one-off form of prime_fits_exponent_ws
+bool prime_fits_exponent(mpz_t p, mpz_t e) {
+    numtheory_ws ws;
+    bool fits;
+
+    numtheory_ws_init_temps(&ws, mpz_sizeinbase(p, 2));
+    fits = prime_fits_exponent_ws(p, e, &ws);
+    numtheory_ws_clear_temps(&ws);
+    return fits;
+}
+
+// No round of a search has found a prime yet
+#define ROUND_NONE UINT64_MAX
+
+// Shared state of make_prime_threads, every field after lock is guarded by it
+typedef struct {
+    mpz_t *primes;
+    uint64_t *bits;
+    size_t count; // Number of primes searched for at once
+    uint64_t iters;
+    uint64_t seed;
+    mpz_srcptr e; // Public exponent every prime p must fit, see prime_fits_exponent
+    pthread_mutex_t lock;
+    uint64_t next; // Next round to hand out, round r searches for prime r % count
+    uint64_t *best; // Lowest round that found each prime, ROUND_NONE until one does
+} prime_search;
+
+// Returns true if round r of search i can no longer win because a lower round already has
+static bool prime_search_lost(prime_search *ps, size_t i, uint64_t r) {
+    pthread_mutex_lock(&ps->lock);
+    bool lost = ps->best[i] < r;
+    pthread_mutex_unlock(&ps->lock);
+    return lost;
+}
+
+// Runs one round, a sieved window at a random start drawn from the round's own seed
+// The outcome only depends on the seed and the round, never on which thread ran it
+// Returns true and sets p to the first prime in the window, or false if there is none
+static bool prime_search_round(prime_search *ps, mpz_t p, uint64_t round, uint32_t residues[],
+    uint8_t composite[], mpz_t start, numtheory_ws *ws) {
+    size_t i = round % ps->count;
+    uint64_t r = round / ps->count;
+    uint64_t bits = ps->bits[i];
+    size_t count = sieve_prime_limit(bits);
+
+    gmp_randseed_ui(state, randstate_derive(ps->seed, round));
+    sieve_start(start, bits, residues, count);
+    sieve_window(composite, residues, count);
+
+    for (size_t index = 0; index < SIEVE_WINDOW; index++) {
+        if (composite[index] != 0) {
+            STATS_ADD(STAT_SIEVED, 1);
+            continue;
         }
+        mpz_add_ui(p, start, 2 * index);
+        if (mpz_sizeinbase(p, 2) != bits || prime_search_lost(ps, i, r) == true) {
+            return false;
+        }
+        if (is_prime_ws(p, ps->iters, ws) && prime_fits_exponent_ws(p, (mpz_ptr) ps->e, ws)) {
+            return true;
+        }
+    }
+    return false;
+}
+// Worker thread of make_prime_threads, takes rounds in order until every prime is found
+// Each worker gets its own random state, reseeded for every round it runs, and its own workspace
+static void *prime_search_worker(void *arg) {
+    prime_search *ps = (prime_search *) arg;
+    uint32_t *residues = (uint32_t *) malloc((sieve_prime_count + 1) * sizeof(uint32_t));
+    uint8_t composite[SIEVE_WINDOW];
+    uint64_t bits = 2;
+    mpz_t p, start;
+    numtheory_ws ws;
+
+    for (size_t i = 0; i < ps->count; i++) {
+        bits = ps->bits[i] > bits ? ps->bits[i] : bits;
     }
+    mpz_init2(p, bits);
+    mpz_init2(start, bits);
+    numtheory_ws_init(&ws, bits);
+    randstate_init(ps->seed);
+
+    while (true) {
+        uint64_t round = 0;
+        bool done = true;
+
+        pthread_mutex_lock(&ps->lock);
+        for (size_t i = 0; i < ps->count; i++) { // Rounds handed out from now on can't win
+            done = done && ps->best[i] != ROUND_NONE;
+        }
+        while (done == false) { // Skip the rounds of primes that already have a lower winner
+            round = ps->next++;
+            if (ps->best[round % ps->count] >= round / ps->count) {
+                break;
+            }
+        }
+        pthread_mutex_unlock(&ps->lock);
+        if (done == true) {
+            break;
+        }
 
-    mpz_clears(r, s, y, j, a, n_minus_one, r_mod, s_minus_one, temp_exponent, n_minus_three, NULL);
+        uint64_t timer = stats_begin();
+        bool found = prime_search_round(ps, p, round, residues, composite, start, &ws);
+        stats_end(STAGE_PRIME, timer);
+        if (found == true) {
+            size_t i = round % ps->count;
+            pthread_mutex_lock(&ps->lock);
+            if (round / ps->count < ps->best[i]) {
+                ps->best[i] = round / ps->count;
+                mpz_set(ps->primes[i], p);
+            }
+            pthread_mutex_unlock(&ps->lock);
+        }
+    }
 
-    return true;
+    randstate_clear();
+    mpz_clears(p, start, NULL);
+    numtheory_ws_clear(&ws);
+    free(residues);
+    return NULL;
 }
 
-// Computes a prime p by generating random numbers until one is found
+// Computes count primes at once, primes[i] of exactly bits[i] bits, on threads worker threads
+// The search is cut into rounds that each sieve one window at a random start derived from seed
+// Workers race through the rounds and cancel the ones above the lowest round that found a prime
+// The lowest round always wins, so the same seed gives the same primes for any number of threads
+// Primes that don't fit the public exponent e are skipped, e = 0 accepts every prime
 // No return value
-void make_prime(mpz_t p, uint64_t bits, uint64_t iters) {
-    mpz_t temp_p;
-    mpz_init(temp_p);
-    mpz_urandomb(temp_p, state, bits); // create an initial random p
+void make_prime_threads(mpz_t primes[], uint64_t bits[], size_t count, uint64_t iters, mpz_t e,
+    int threads, uint64_t seed) {
+    prime_search ps;
+    pthread_t *workers = (pthread_t *) calloc(threads, sizeof(pthread_t));
+
+    pthread_once(&sieve_primes_once, sieve_primes_init);
+    ps.primes = primes;
+    ps.bits = (uint64_t *) calloc(count, sizeof(uint64_t));
+    ps.count = count;
+    ps.iters = iters;
+    ps.seed = seed;
+    ps.e = e;
+    ps.next = 0;
+    ps.best = (uint64_t *) calloc(count, sizeof(uint64_t));
+    pthread_mutex_init(&ps.lock, NULL);
+    for (size_t i = 0; i < count; i++) {
+        ps.bits[i] = bits[i] < 2 ? 2 : bits[i];
+        ps.best[i] = ROUND_NONE;
+    }
+
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&workers[i], NULL, prime_search_worker, &ps);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    pthread_mutex_destroy(&ps.lock);
+    free(ps.bits);
+    free(ps.best);
+    free(workers);
+    return;
+}
+
+// Leading digits Lehmer's inner loop works on, small enough that the cofactor sums fit in 64 bits
+#define LEHMER_BITS 62
+
+// Returns the bits of a from bit shift up, a must be below 2^(shift + 64)
+static uint64_t lehmer_digit(mpz_t a, size_t shift) {
+    size_t limb = shift / GMP_NUMB_BITS;
+    unsigned bit = shift % GMP_NUMB_BITS;
+    uint64_t digit = mpz_getlimbn(a, limb) >> bit;
+
+    if (bit > 0) {
+        digit |= (uint64_t) mpz_getlimbn(a, limb + 1) << (GMP_NUMB_BITS - bit);
+    }
+    return digit;
+}
+
+// Sets out = x * a + y * b for the single-word cofactors of a Lehmer step
+static void lehmer_combine(mpz_t out, mpz_t a, int64_t x, mpz_t b, int64_t y) {
+    mpz_mul_si(out, a, x);
+    if (y >= 0) {
+        mpz_addmul_ui(out, b, y);
+    } else {
+        mpz_submul_ui(out, b, -(uint64_t) y);
+    }
+    return;
+}
+
+// Runs Lehmer's gcd on r0 >= r1 >= 0 until r1 is 0, leaving the gcd in r0
+// If s is not NULL, s[0] and s[1] are the cofactors of r0 and r1 and are kept up to date with them
+// Each pass runs Euclid on the leading 62 bits of r0 and r1 as long as the quotients are sure to be
+// the real ones (Knuth's Algorithm L), then applies the steps it took to the full numbers at once
+// Uses t[0] through t[2] of ws besides r0, r1, and s
+static void lehmer(mpz_t r0, mpz_t r1, mpz_t *s, numtheory_ws *ws) {
+    mpz_ptr t = ws->t[0], w = ws->t[1], q = ws->t[2];
+
+    while (mpz_sgn(r1) != 0) {
+        size_t bits = mpz_sizeinbase(r0, 2);
+        size_t shift = bits > LEHMER_BITS ? bits - LEHMER_BITS : 0;
+        int64_t u = lehmer_digit(r0, shift);
+        int64_t v = lehmer_digit(r1, shift);
+        int64_t a = 1, b = 0, c = 0, d = 1; // Cofactor matrix of the steps taken on u and v
+
+        // Numbers of 62 bits or less are finished with plain division steps
+        while (shift > 0 && v + c != 0 && v + d != 0) {
+            int64_t quotient = (u + a) / (v + c);
+            if (quotient != (u + b) / (v + d)) { // The leading digits can't decide this quotient
+                break;
+            }
+            int64_t temp = a - quotient * c;
+            a = c;
+            c = temp;
+            temp = b - quotient * d;
+            b = d;
+            d = temp;
+            temp = u - quotient * v;
+            u = v;
+            v = temp;
+        }
+
+        if (b == 0) { // No step could be taken on the leading digits, so do one in full
+            mpz_fdiv_qr(q, t, r0, r1);
+            mpz_swap(r0, r1);
+            mpz_swap(r1, t); // r0, r1 = r1, r0 - q * r1
+            if (s != NULL) {
+                mpz_submul(s[0], q, s[1]);
+                mpz_swap(s[0], s[1]);
+            }
+            continue;
+        }
+        lehmer_combine(t, r0, a, r1, b);
+        lehmer_combine(w, r0, c, r1, d);
+        mpz_swap(r0, t);
+        mpz_swap(r1, w);
+        if (s != NULL) {
+            lehmer_combine(t, s[0], a, s[1], b);
+            lehmer_combine(w, s[0], c, s[1], d);
+            mpz_swap(s[0], t);
+            mpz_swap(s[1], w);
+        }
+    }
+    return;
+}
+
+// Computes the greatest common divisor of a and b with the scratch space of ws
+// Stores the value in d, uses t[0] through t[4]
+void gcd_ws(mpz_t d, mpz_t a, mpz_t b, numtheory_ws *ws) {
+    mpz_ptr r0 = ws->t[3];
+    mpz_ptr r1 = ws->t[4];
 
-    while (!(is_prime(temp_p, iters))
-           || (mpz_sizeinbase(temp_p, 2)
-               < bits)) { // While p is not prime or p is not at least bits amount of bits long
-        mpz_urandomb(temp_p, state, bits);
+    mpz_abs(r0, a);
+    mpz_abs(r1, b);
+    if (mpz_cmp(r0, r1) < 0) {
+        mpz_swap(r0, r1);
     }
+    lehmer(r0, r1, NULL, ws);
+    mpz_set(d, r0);
 
-    mpz_set(p, temp_p);
-    mpz_clear(temp_p);
     return;
 }
 
 // Computes the greatest common divisor of a and b
 // Stores the value in d
 void gcd(mpz_t d, mpz_t a, mpz_t b) {
-    mpz_t t, a_temp, b_temp;
-    mpz_init(t);
-    mpz_init(a_temp);
-    mpz_init(b_temp);
-    mpz_set(a_temp, a);
-    mpz_set(b_temp, b);
+    numtheory_ws ws;
+
+    numtheory_ws_init_temps(&ws, mpz_sizeinbase(a, 2) > mpz_sizeinbase(b, 2)
+                                     ? mpz_sizeinbase(a, 2)
+                                     : mpz_sizeinbase(b, 2));
+    gcd_ws(d, a, b, &ws);
+    numtheory_ws_clear_temps(&ws);
+    return;
+}
+
+// An inverse function that finds the inverse i of a modulo n, with the scratch space of ws
+// Runs the extended form of Lehmer's gcd on n and a, keeping only the cofactor of a
+// Sets i to 0 if no inverse is found, uses t[0] through t[6]
+void mod_inverse_ws(mpz_t i, mpz_t a, mpz_t n, numtheory_ws *ws) {
+    mpz_ptr r0 = ws->t[3], r1 = ws->t[4];
+    mpz_t *s = &ws->t[5]; // s[0] * a = r0 and s[1] * a = r1 (mod n) throughout
+
+    mpz_set(r0, n);
+    mpz_mod(r1, a, n);
+    mpz_set_ui(s[0], 0);
+    mpz_set_ui(s[1], 1);
+    lehmer(r0, r1, s, ws);
 
-    while (mpz_cmp_ui(b_temp, 0) != 0) { // While b != 0
-        mpz_set(t, b_temp);
-        mpz_mod(b_temp, a_temp, t); // b = a % b
-        mpz_set(a_temp, t);
+    if (mpz_cmp_ui(r0, 1) != 0) { // If no inverse found, set i to 0
+        mpz_set_ui(i, 0);
+        return;
     }
-    mpz_set(d, a_temp); // Store value of a into d
-    mpz_clear(t);
-    mpz_clear(a_temp);
-    mpz_clear(b_temp);
+    mpz_mod(i, s[0], n);
 
     return;
 }
@@ -164,52 +804,55 @@ void gcd(mpz_t d, mpz_t a, mpz_t b) {
 // An inverse function that finds the inverse i of a modulo n
 // Sets i to 0 if no inverse is found
 void mod_inverse(mpz_t i, mpz_t a, mpz_t n) {
+    numtheory_ws ws;
 
-    mpz_t t, t_prime, r, r_prime, q, x, y, temp, temp_two;
-
-    mpz_init(x);
-    mpz_init(y);
-    mpz_init(q);
-    mpz_init_set(r, n);
-    mpz_init_set(r_prime, a);
-    mpz_init_set_ui(t, 0);
-    mpz_init_set_ui(t_prime, 1);
-    mpz_init(temp);
-    mpz_init(temp_two);
+    numtheory_ws_init_temps(&ws, mpz_sizeinbase(n, 2));
+    mod_inverse_ws(i, a, n, &ws);
+    numtheory_ws_clear_temps(&ws);
+    return;
+}
 
-    while (mpz_cmp_ui(r_prime, 0) != 0) { // While r' != 0
-        mpz_fdiv_q(q, r, r_prime);
-        mpz_set(x, r);
-        mpz_set(r, r_prime);
-        mpz_mul(temp, q, r_prime); // Following pemdas order, multiply first, then subtract
-        mpz_sub(r_prime, x, temp); // Sets r' = r - q x r'
+// Finds the inverses out[k] of a[k] modulo n for count values with a single inversion
+// Montgomery's trick: out[k] first holds the product a[0] * ... * a[k], the inverse of the whole
+// product is then peeled back down the list, two products per value
+// Sets out[k] to 0 for a value with no inverse, out must not be a, uses t[0] through t[8]
+void mod_inverse_batch_ws(mpz_t out[], mpz_t a[], size_t count, mpz_t n, numtheory_ws *ws) {
+    mpz_ptr inv = ws->t[7], temp = ws->t[8];
 
-        mpz_set(y, t);
-        mpz_set(t, t_prime);
-        mpz_mul(temp_two, q, t_prime);
-        mpz_sub(t_prime, y, temp_two); // Sets t' = t - q x t'
+    if (count == 0) {
+        return;
     }
+    mpz_mod(out[0], a[0], n);
+    for (size_t k = 1; k < count; k++) {
+        mpz_mul(temp, out[k - 1], a[k]);
+        mpz_mod(out[k], temp, n);
+    }
+    mod_inverse_ws(inv, out[count - 1], n, ws);
 
-    if (mpz_cmp_ui(r, 1) > 0) { // If no inverse found, set i to 0
-        mpz_set_ui(i, 0);
-        mpz_clears(x, y, q, r, r_prime, t, t_prime, temp, temp_two, NULL);
+    if (mpz_sgn(inv) == 0) { // Some value shares a factor with n, so invert each one on its own
+        for (size_t k = 0; k < count; k++) {
+            mod_inverse_ws(out[k], a[k], n, ws);
+        }
         return;
     }
-    if (mpz_cmp_ui(t, 0) < 0) {
-        mpz_add(t, t, n);
+    for (size_t k = count - 1; k > 0; k--) { // inv is the inverse of a[0] * ... * a[k] here
+        mpz_mul(temp, inv, out[k - 1]);
+        mpz_mod(out[k], temp, n);
+        mpz_mul(temp, inv, a[k]);
+        mpz_mod(inv, temp, n);
     }
+    mpz_set(out[0], inv);
 
-    mpz_set(i, t);
+    return;
+}
 
-    mpz_clear(x);
-    mpz_clear(y);
-    mpz_clear(q);
-    mpz_clear(r);
-    mpz_clear(r_prime);
-    mpz_clear(t);
-    mpz_clear(t_prime);
-    mpz_clear(temp);
-    mpz_clear(temp_two);
+// Finds the inverses out[k] of a[k] modulo n for count values with a single inversion
+// Sets out[k] to 0 for a value with no inverse, out must not be a
+void mod_inverse_batch(mpz_t out[], mpz_t a[], size_t count, mpz_t n) {
+    numtheory_ws ws;
 
+    numtheory_ws_init_temps(&ws, mpz_sizeinbase(n, 2));
+    mod_inverse_batch_ws(out, a, count, n, &ws);
+    numtheory_ws_clear_temps(&ws);
     return;
 }
@@ -1,16 +1,62 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <gmp.h>
+#include "mont.h"
+
+// Temporaries in a numtheory workspace, as many as the hungriest function needs
+#define NUMTHEORY_WS_TEMPS 9
+
+// Scratch space for the _ws variants, made once by numtheory_ws_init and reused for every call
+// Everything is sized for a modulus at init and only grows if a larger one comes along
+// A workspace must not be shared between threads
+typedef struct {
+    mont_ctx ctx; // Montgomery constants of the current modulus
+    mont_exp rec; // Recoding of the current exponent
+    mont_ws mont;
+    mpz_t t[NUMTHEORY_WS_TEMPS];
+} numtheory_ws;
+
+void numtheory_ws_init(numtheory_ws *ws, uint64_t bits);
+
+void numtheory_ws_clear(numtheory_ws *ws);
 
 void gcd(mpz_t d, mpz_t a, mpz_t b);
 
+void gcd_ws(mpz_t d, mpz_t a, mpz_t b, numtheory_ws *ws);
+
 void mod_inverse(mpz_t i, mpz_t a, mpz_t n);
 
+void mod_inverse_ws(mpz_t i, mpz_t a, mpz_t n, numtheory_ws *ws);
+
+void mod_inverse_batch(mpz_t out[], mpz_t a[], size_t count, mpz_t n);
+
+void mod_inverse_batch_ws(mpz_t out[], mpz_t a[], size_t count, mpz_t n, numtheory_ws *ws);
+
 void pow_mod(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus);
 
+void pow_mod_ws(mpz_t out, mpz_t base, mpz_t exponent, mpz_t modulus, numtheory_ws *ws);
+
+void pow_mod_ui(mpz_t out, mpz_t base, uint64_t exponent, mpz_t modulus);
+
+// Values of iters for is_prime that pick a test instead of a number of Miller-Rabin rounds
+#define PRIME_ITERS_BPSW 0
+#define PRIME_ITERS_FIPS UINT64_MAX
+
+uint64_t prime_rounds(uint64_t bits);
+
 bool is_prime(mpz_t n, uint64_t iters);
 
+bool is_prime_ws(mpz_t n, uint64_t iters, numtheory_ws *ws);
+
 void make_prime(mpz_t p, uint64_t bits, uint64_t iters);
+
+bool prime_fits_exponent(mpz_t p, mpz_t e);
+
+bool prime_fits_exponent_ws(mpz_t p, mpz_t e, numtheory_ws *ws);
+
+void make_prime_threads(mpz_t primes[], uint64_t bits[], size_t count, uint64_t iters, mpz_t e,
+    int threads, uint64_t seed);
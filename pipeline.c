@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "pipeline.h"
+#include "stats.h"
+
+// Each slot of the ring is free, holds read input, is being worked on, or holds finished output
+typedef enum { SLOT_FREE, SLOT_READ, SLOT_WORKING, SLOT_DONE } slot_state;
+
+// Shared state of one pipeline_run, every field after lock is guarded by it
+typedef struct {
+    pipeline_config *config;
+    pipeline_batch *batches;
+    slot_state *states;
+    pthread_mutex_t lock;
+    pthread_cond_t changed; // Signalled whenever a slot changes state or the input ends
+    uint64_t read_seq; // Next batch the reader will fill
+    uint64_t work_seq; // Next batch a worker will take
+    bool eof; // The reader has seen the end of the input
+} pipeline_state;
+
+// Arguments handed to each worker thread
+typedef struct {
+    pipeline_state *state;
+    void *worker;
+} worker_arg;
+
+// Reader stage, fills free slots in order until the read callback runs out of input
+static void *pipeline_reader(void *arg) {
+    pipeline_state *ps = (pipeline_state *) arg;
+    pipeline_config *config = ps->config;
+
+    while (true) {
+        size_t slot = ps->read_seq % config->slots;
+
+        pthread_mutex_lock(&ps->lock);
+        while (ps->states[slot] != SLOT_FREE) { // Wait for the writer to drain this slot
+            pthread_cond_wait(&ps->changed, &ps->lock);
+        }
+        pthread_mutex_unlock(&ps->lock);
+
+        pipeline_batch *batch = &ps->batches[slot];
+        batch->seq = ps->read_seq;
+        batch->in = batch->in_buf;
+        batch->in_len = 0;
+        batch->out_len = 0;
+        batch->failed = false;
+        uint64_t timer = stats_begin();
+        bool more = config->read(config->read_arg, batch);
+        stats_end(STAGE_READ, timer);
+
+        pthread_mutex_lock(&ps->lock);
+        if (batch->in_len > 0) {
+            ps->states[slot] = SLOT_READ;
+            ps->read_seq += 1;
+        }
+        if (more == false) {
+            ps->eof = true;
+        }
+        pthread_cond_broadcast(&ps->changed);
+        pthread_mutex_unlock(&ps->lock);
+
+        if (more == false) {
+            return NULL;
+        }
+    }
+}
+
+// Worker stage, takes read batches in order of arrival and runs the work callback on them
+static void *pipeline_worker(void *arg) {
+    worker_arg *wa = (worker_arg *) arg;
+    pipeline_state *ps = wa->state;
+    pipeline_config *config = ps->config;
+
+    while (true) {
+        pthread_mutex_lock(&ps->lock);
+        while (ps->work_seq == ps->read_seq && ps->eof == false) {
+            pthread_cond_wait(&ps->changed, &ps->lock);
+        }
+        if (ps->work_seq == ps->read_seq) { // Input is over and every batch is taken
+            pthread_mutex_unlock(&ps->lock);
+            return NULL;
+        }
+        size_t slot = ps->work_seq % config->slots;
+        ps->work_seq += 1;
+        ps->states[slot] = SLOT_WORKING;
+        pthread_mutex_unlock(&ps->lock);
+
+        config->work(wa->worker, &ps->batches[slot]);
+
+        pthread_mutex_lock(&ps->lock);
+        ps->states[slot] = SLOT_DONE;
+        pthread_cond_broadcast(&ps->changed);
+        pthread_mutex_unlock(&ps->lock);
+    }
+}
+
+// Runs a reader thread, config->threads worker threads, and an in-order writer on this thread
+// Batches go around a ring of config->slots slots, so at most that many are in memory at once
+void pipeline_run(pipeline_config *config) {
+    pipeline_state ps;
+    pthread_t reader;
+    pthread_t *workers = (pthread_t *) calloc(config->threads, sizeof(pthread_t));
+    worker_arg *args = (worker_arg *) calloc(config->threads, sizeof(worker_arg));
+
+    ps.config = config;
+    ps.batches = (pipeline_batch *) calloc(config->slots, sizeof(pipeline_batch));
+    ps.states = (slot_state *) calloc(config->slots, sizeof(slot_state));
+    ps.read_seq = 0;
+    ps.work_seq = 0;
+    ps.eof = false;
+    pthread_mutex_init(&ps.lock, NULL);
+    pthread_cond_init(&ps.changed, NULL);
+
+    for (size_t i = 0; i < config->slots; i++) {
+        ps.batches[i].in_buf = (uint8_t *) malloc(config->in_cap);
+        ps.batches[i].in = ps.batches[i].in_buf;
+        ps.batches[i].in_cap = config->in_cap;
+        ps.batches[i].out = (uint8_t *) malloc(config->out_cap);
+        ps.batches[i].out_cap = config->out_cap;
+    }
+
+    pthread_create(&reader, NULL, pipeline_reader, &ps);
+    for (int i = 0; i < config->threads; i++) {
+        args[i].state = &ps;
+        args[i].worker = config->workers[i];
+        pthread_create(&workers[i], NULL, pipeline_worker, &args[i]);
+    }
+
+    // Writer stage, drains slots strictly in input order
+    for (uint64_t seq = 0;; seq++) {
+        size_t slot = seq % config->slots;
+
+        pthread_mutex_lock(&ps.lock);
+        while (ps.states[slot] != SLOT_DONE && !(ps.eof == true && seq == ps.read_seq)) {
+            pthread_cond_wait(&ps.changed, &ps.lock);
+        }
+        if (ps.states[slot] != SLOT_DONE) { // Every batch that was read has been written
+            pthread_mutex_unlock(&ps.lock);
+            break;
+        }
+        pthread_mutex_unlock(&ps.lock);
+
+        uint64_t timer = stats_begin();
+        config->write(config->write_arg, &ps.batches[slot]);
+        stats_end(STAGE_WRITE, timer);
+
+        pthread_mutex_lock(&ps.lock);
+        ps.states[slot] = SLOT_FREE;
+        pthread_cond_broadcast(&ps.changed);
+        pthread_mutex_unlock(&ps.lock);
+    }
+
+    pthread_join(reader, NULL);
+    for (int i = 0; i < config->threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    for (size_t i = 0; i < config->slots; i++) {
+        free(ps.batches[i].in_buf);
+        free(ps.batches[i].out);
+    }
+    pthread_mutex_destroy(&ps.lock);
+    pthread_cond_destroy(&ps.changed);
+    free(ps.batches);
+    free(ps.states);
+    free(workers);
+    free(args);
+    return;
+}
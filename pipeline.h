@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// A batch of consecutive blocks moving through the pipeline
+// The reader fills in, a worker turns in into out, and the writer drains out
+typedef struct {
+    uint64_t seq; // Position of the batch in the input, batches are written in this order
+    uint8_t *in; // Points at in_buf, or at input the reader keeps alive for the whole run
+    uint8_t *in_buf; // in_cap bytes owned by the pipeline
+    size_t in_len;
+    size_t in_cap;
+    uint8_t *out;
+    size_t out_len;
+    size_t out_cap;
+    bool failed; // Set by the work callback if the input was malformed, out holds what came before
+} pipeline_batch;
+
+// Fills batch->in with the next input, returns false once there is nothing left to read
+typedef bool (*pipeline_read_fn)(void *arg, pipeline_batch *batch);
+
+// Turns batch->in into batch->out, worker is the per-thread state given to pipeline_run
+typedef void (*pipeline_work_fn)(void *worker, pipeline_batch *batch);
+
+// Writes out batch->out, called in input order from the calling thread
+typedef void (*pipeline_write_fn)(void *arg, pipeline_batch *batch);
+
+typedef struct {
+    int threads; // Number of worker threads
+    size_t slots; // Batches in flight at once, this bounds the memory used
+    size_t in_cap; // Bytes of input and output space in each batch
+    size_t out_cap;
+    pipeline_read_fn read;
+    void *read_arg;
+    pipeline_work_fn work;
+    void **workers; // One entry per worker thread
+    pipeline_write_fn write;
+    void *write_arg;
+} pipeline_config;
+
+void pipeline_run(pipeline_config *config);
@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include "numtheory.h"
+#include "pool.h"
+#include <gmp.h>
+
+// Opens the pool file at path for reading and writing, creating it first if create is set
+// Returns NULL if it can't be opened
+FILE *pool_open(char *path, bool create) {
+    int fd = open(path, create == true ? O_RDWR | O_CREAT : O_RDWR, 0600);
+
+    if (fd < 0) {
+        return NULL;
+    }
+    FILE *pool = fdopen(fd, "r+");
+    if (pool == NULL) {
+        close(fd);
+    }
+    return pool;
+}
+
+// Parses one line of the pool into p, returns false if it isn't a whole, well formed record
+// A line cut short by a crash during pool_append has no newline and is skipped
+static bool pool_parse(char *line, ssize_t len, char *mark, uint64_t *bits, mpz_t p) {
+    char *hex;
+
+    if (len < 4 || line[len - 1] != '\n' || line[1] != ' ') {
+        return false;
+    }
+    line[len - 1] = '\0';
+    *mark = line[0];
+    *bits = strtoull(line + 2, &hex, 10);
+    if (*hex != ' ') {
+        return false;
+    }
+    return mpz_set_str(p, hex + 1, 16) == 0;
+}
+
+// Appends count primes of bits bits to the pool as free records
+// Writes them under the lock and syncs before returning, so a taker never sees half a batch
+// Returns false if the write failed
+bool pool_append(FILE *pool, mpz_t primes[], uint64_t bits, size_t count) {
+    bool ok = true;
+
+    flock(fileno(pool), LOCK_EX);
+    fseek(pool, 0, SEEK_END);
+    if (ftell(pool) > 0) { // Finish a line left without a newline so it can't swallow the next one
+        fseek(pool, -1, SEEK_END);
+        bool newline = fgetc(pool) == '\n';
+        fseek(pool, 0, SEEK_END);
+        if (newline == false) {
+            fputc('\n', pool);
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        gmp_fprintf(pool, "%c %" PRIu64 " %Zx\n", POOL_FREE, bits, primes[i]);
+    }
+    ok = fflush(pool) == 0 && fsync(fileno(pool)) == 0;
+    flock(fileno(pool), LOCK_UN);
+    return ok;
+}
+
+// Takes count free primes of bits bits out of the pool, all of them or none
+// Each prime is checked again with is_prime, and primes that don't fit e are left for other keys
+// Returns true and sets primes[] if enough were found, they are marked taken before the lock drops
+bool pool_take(FILE *pool, mpz_t primes[], uint64_t bits, size_t count, mpz_t e) {
+    long *offsets = (long *) calloc(count, sizeof(long));
+    char *line = NULL;
+    size_t cap = 0;
+    size_t found = 0;
+    bool ok = true;
+    numtheory_ws ws; // Every line is tested in the same workspace
+    mpz_t p;
+
+    mpz_init(p);
+    numtheory_ws_init(&ws, bits);
+    flock(fileno(pool), LOCK_EX);
+    fseek(pool, 0, SEEK_SET);
+    while (found < count) {
+        long offset = ftell(pool);
+        ssize_t len = getline(&line, &cap, pool);
+        char mark;
+        uint64_t record_bits;
+
+        if (len < 0) {
+            break;
+        }
+        if (pool_parse(line, len, &mark, &record_bits, p) == false || mark != POOL_FREE
+            || record_bits != bits || mpz_sizeinbase(p, 2) != bits) {
+            continue;
+        }
+        if (is_prime_ws(p, PRIME_ITERS_BPSW, &ws) == false
+            || prime_fits_exponent_ws(p, e, &ws) == false) {
+            continue;
+        }
+        bool repeat = false; // The same prime appended twice must never end up as both p and q
+        for (size_t i = 0; i < found; i++) {
+            repeat = repeat || mpz_cmp(primes[i], p) == 0;
+        }
+        if (repeat == true) {
+            continue;
+        }
+        mpz_set(primes[found], p);
+        offsets[found++] = offset;
+    }
+
+    if (found == count) {
+        for (size_t i = 0; i < count; i++) {
+            fseek(pool, offsets[i], SEEK_SET);
+            fputc(POOL_TAKEN, pool);
+        }
+        ok = fflush(pool) == 0 && fsync(fileno(pool)) == 0;
+    }
+    flock(fileno(pool), LOCK_UN);
+    free(line);
+    free(offsets);
+    numtheory_ws_clear(&ws);
+    mpz_clear(p);
+    return found == count && ok == true;
+}
+
+// Returns the number of free primes of bits bits in the pool
+size_t pool_count(FILE *pool, uint64_t bits) {
+    char *line = NULL;
+    size_t cap = 0;
+    size_t count = 0;
+    ssize_t len;
+    mpz_t p;
+
+    mpz_init(p);
+    flock(fileno(pool), LOCK_SH);
+    fseek(pool, 0, SEEK_SET);
+    while ((len = getline(&line, &cap, pool)) >= 0) {
+        char mark;
+        uint64_t record_bits;
+
+        if (pool_parse(line, len, &mark, &record_bits, p) == true && mark == POOL_FREE
+            && record_bits == bits) {
+            count++;
+        }
+    }
+    flock(fileno(pool), LOCK_UN);
+    free(line);
+    mpz_clear(p);
+    return count;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <gmp.h>
+
+// Prime pool file, one line per prime
+// "+ bits hex" while the prime is free and "- bits hex" once it has been taken
+// Primes are only ever appended, taking one overwrites the first byte of its line in place
+// Every access holds an exclusive flock on the file, so keygen and primepool can share it
+
+#define POOL_FREE '+'
+#define POOL_TAKEN '-'
+
+FILE *pool_open(char *path, bool create);
+
+bool pool_append(FILE *pool, mpz_t primes[], uint64_t bits, size_t count);
+
+bool pool_take(FILE *pool, mpz_t primes[], uint64_t bits, size_t count, mpz_t e);
+
+size_t pool_count(FILE *pool, uint64_t bits);
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <gmp.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "numtheory.h"
+#include "pool.h"
+#include "randstate.h"
+#include "rsa.h"
+#include "stats.h"
+
+#define OPTIONS "hb:c:l:e:i:p:s:t:w:dv"
+
+#define POOL_SIZES_MAX 16 // Key sizes one run can fill
+#define POOL_BATCH 8 // Primes searched for at once and appended together
+
+// Prints out the help message
+void help_message(void) {
+    printf("SYNOPSIS\n");
+    printf("   Fills a pool of primes ahead of time for keygen --pool.\n");
+    printf("\n");
+    printf("USAGE\n");
+    printf("   ./primepool [-hdv] [-b bits] [-c count] [-l low] [-e exponent] [-i confidence]\n");
+    printf("               [-t threads] [-w seconds] -p pool\n");
+    printf("\n");
+    printf("OPTIONS\n");
+    printf("   -h              Display program help and usage.\n");
+    printf("   -v              Display verbose program output.\n");
+    printf("   -b bits         Key size the primes are for, may be given more than once\n");
+    printf("                   (default: 256).\n");
+    printf("   -c count        Free primes to keep for each key size (default: 16).\n");
+    printf("   -l low          Refill a key size once it has fewer free primes\n");
+    printf("                   (default: count).\n");
+    printf("   -e exponent     Public exponent the primes must fit, 0 for any (default: 65537).\n");
+    printf("   -i confidence   Primality test: bpsw, fips, or a number of Miller-Rabin rounds\n");
+    printf("                   of at least 1 (default: bpsw).\n");
+    printf("   -p pool         Pool file, created if missing (default: rsa.pool).\n");
+    printf("   -s seed         Random seed for testing.\n");
+    printf("   -t threads      Search for primes on this many threads (default: 1).\n");
+    printf("   -d              Keep running and refill the pool as keygen drains it.\n");
+    printf("   -w seconds      Time between checks of the pool with -d (default: 5).\n");
+    exit(0);
+}
+
+// Turns the -i argument into iters for is_prime, bpsw and fips pick a test instead of a count
+// Returns false unless it is bpsw, fips, or a number of rounds of at least 1, 0 would test nothing
+// and is PRIME_ITERS_BPSW besides
+static bool parse_iters(char *arg, uint64_t *iters) {
+    char *end;
+
+    if (strcmp(arg, "bpsw") == 0) {
+        *iters = PRIME_ITERS_BPSW;
+        return true;
+    } else if (strcmp(arg, "fips") == 0) {
+        *iters = PRIME_ITERS_FIPS;
+        return true;
+    }
+    *iters = strtoull(arg, &end, 10);
+    return *arg >= '0' && *arg <= '9' && *end == '\0' && *iters > 0 && *iters != PRIME_ITERS_FIPS;
+}
+
+// Returns a seed from /dev/urandom, or from the time and process id if it can't be read
+// Two runs must never share a seed, or they would append the same primes
+static uint64_t random_seed(void) {
+    uint64_t seed = 0;
+
+    if (randstate_entropy((uint8_t *) &seed, sizeof(seed)) == false) {
+        seed = (uint64_t) time(NULL) ^ ((uint64_t) getpid() << 32);
+    }
+    return seed;
+}
+
+// Appends primes for keys of nbits bits until the pool holds count free ones
+// Each batch is searched for with make_prime_threads from its own seed and appended right away,
+// so keygen can use the first primes while the rest are still being searched for
+// Returns the number of primes appended
+static size_t refill(FILE *pool, uint64_t nbits, size_t count, uint64_t iters, mpz_t e,
+    int threads, uint64_t seed, uint64_t *batch) {
+    uint64_t bits = rsa_pool_bits(nbits);
+    uint64_t sizes[POOL_BATCH];
+    mpz_t primes[POOL_BATCH];
+    size_t have = pool_count(pool, bits);
+    size_t added = 0;
+
+    for (size_t i = 0; i < POOL_BATCH; i++) {
+        sizes[i] = bits;
+        mpz_init(primes[i]);
+    }
+    while (have + added < count) {
+        size_t want = count - have - added < POOL_BATCH ? count - have - added : POOL_BATCH;
+        make_prime_threads(primes, sizes, want, iters, e, threads, randstate_derive(seed, *batch));
+        *batch += 1;
+        if (pool_append(pool, primes, bits, want) == false) {
+            printf("Error writing to prime pool.\n");
+            break;
+        }
+        added += want;
+    }
+    for (size_t i = 0; i < POOL_BATCH; i++) {
+        mpz_clear(primes[i]);
+    }
+    return added;
+}
+
+// Main program, fills the pool once or keeps it filled with -d
+int main(int argc, char **argv) {
+    int opt = 0;
+    uint64_t sizes[POOL_SIZES_MAX];
+    size_t size_count = 0;
+    size_t count = 16;
+    size_t low = 0; // 0 until -l is given, then count is used
+    uint64_t iters = PRIME_ITERS_BPSW;
+    char *pool_path = "rsa.pool";
+    char *exponent = "65537";
+    uint64_t seed = random_seed();
+    int threads = 1;
+    unsigned interval = 5;
+    bool keep_running = false; // Set by -d
+    bool verbose = false;
+    uint64_t batch = 0; // Batches searched for so far, each gets its own seed
+    FILE *pool;
+    mpz_t e;
+
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'h': help_message(); return -1;
+        case 'b':
+            if (size_count < POOL_SIZES_MAX) {
+                sizes[size_count++] = strtoull(optarg, NULL, 10);
+            }
+            break;
+        case 'c': count = strtoull(optarg, NULL, 10); break;
+        case 'l': low = strtoull(optarg, NULL, 10); break;
+        case 'e': exponent = optarg; break;
+        case 'i':
+            if (parse_iters(optarg, &iters) == false) {
+                printf("-i takes bpsw, fips, or a number of Miller-Rabin rounds of at least 1.\n");
+                return -1;
+            }
+            break;
+        case 'p': pool_path = optarg; break;
+        case 's': seed = strtoull(optarg, NULL, 10); break;
+        case 't': threads = atoi(optarg); break;
+        case 'w': interval = atoi(optarg); break;
+        case 'd': keep_running = true; break;
+        case 'v': verbose = true; break;
+        }
+    }
+    if (size_count == 0) {
+        sizes[size_count++] = 256;
+    }
+    if (low == 0 || low > count) {
+        low = count;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    stats_init(verbose); // Counters and stage timers, or a trace if RSA_TRACE is set
+
+    mpz_init(e);
+    if (mpz_set_str(e, exponent, 10) != 0 || mpz_sgn(e) < 0
+        || (mpz_sgn(e) != 0 && (mpz_even_p(e) || mpz_cmp_ui(e, 3) < 0))) {
+        printf("Public exponent must be odd and at least 3, or 0.\n");
+        return -1;
+    }
+
+    pool = pool_open(pool_path, true);
+    if (pool == NULL) {
+        printf("Error opening prime pool %s.\n", pool_path);
+        return -1;
+    }
+
+    do {
+        for (size_t i = 0; i < size_count; i++) {
+            uint64_t bits = rsa_pool_bits(sizes[i]);
+            if (pool_count(pool, bits) >= low) { // Leave a size alone until it drops below low
+                continue;
+            }
+            size_t added = refill(pool, sizes[i], count, iters, e, threads, seed, &batch);
+            if (verbose == true) {
+                printf("added %zu primes of %" PRIu64 " bits for %" PRIu64 "-bit keys\n", added,
+                    bits, sizes[i]);
+            }
+        }
+        if (keep_running == true) {
+            sleep(interval);
+        }
+    } while (keep_running == true);
+
+    if (verbose == true) {
+        for (size_t i = 0; i < size_count; i++) {
+            uint64_t bits = rsa_pool_bits(sizes[i]);
+            printf("%zu free primes of %" PRIu64 " bits\n", pool_count(pool, bits), bits);
+        }
+        stats_print(stdout);
+    }
+    stats_finish();
+
+    fclose(pool);
+    mpz_clear(e);
+    return 0;
+}
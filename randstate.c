@@ -1,12 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include "randstate.h"
 #include <gmp.h>
 
-gmp_randstate_t state;
+_Thread_local gmp_randstate_t state;
 
-// Initializes the global state and uses the seed parameter for random seed
+// Initializes this thread's state and uses the seed parameter for random seed
 // No return value
 void randstate_init(uint64_t seed) {
     gmp_randinit_mt(state);
@@ -16,3 +17,28 @@ void randstate_init(uint64_t seed) {
 void randstate_clear(void) {
     gmp_randclear(state);
 }
+
+// Derives an independent seed for stream number stream from seed
+// Uses the splitmix64 finalizer, so nearby streams get unrelated seeds
+uint64_t randstate_derive(uint64_t seed, uint64_t stream) {
+    uint64_t z = seed + (stream + 1) * UINT64_C(0x9E3779B97F4A7C15);
+
+    z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+    return z ^ (z >> 31);
+}
+
+// Fills out with len bytes from the operating system's random source
+// Unlike state, which is seeded from the clock, these are fit for secret keys
+// Returns false if the random source can't be read
+bool randstate_entropy(uint8_t *out, size_t len) {
+    FILE *urandom = fopen("/dev/urandom", "r");
+    bool ok;
+
+    if (urandom == NULL) {
+        return false;
+    }
+    ok = fread(out, sizeof(uint8_t), len, urandom) == len;
+    fclose(urandom);
+    return ok;
+}
@@ -1,10 +1,17 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <gmp.h>
 
-extern gmp_randstate_t state;
+// Each thread has its own state, worker threads seed theirs with randstate_init
+extern _Thread_local gmp_randstate_t state;
 
 void randstate_init(uint64_t seed);
 
 void randstate_clear(void);
+
+uint64_t randstate_derive(uint64_t seed, uint64_t stream);
+
+bool randstate_entropy(uint8_t *out, size_t len);
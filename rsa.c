@@ -1,53 +1,87 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <gmp.h>
 #include "rsa.h"
 #include "randstate.h"
 #include "numtheory.h"
+#include "pipeline.h"
+#include "container.h"
+#include "fileio.h"
+#include "pool.h"
+#include "aead.h"
+#include "stats.h"
+#include "hex.h"
 
-// Creates all the necessary components of a public key
-// Creates two primes, p and q, n = p*q, and also computes a fitting public exponent e
-void rsa_make_pub(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters) {
-    uint64_t remaining_bits;
-    uint64_t p_bits;
-    uint64_t q_bits;
-    mpz_t totient;
-    mpz_t p_minus_one;
-    mpz_t q_minus_one;
+// Public exponents of at most this many bits take the pow_mod_ui path
+#define RSA_SMALL_E_BITS 32
+
+// Computes out = base^e (mod n) for a public exponent
+// Small exponents like 65537 skip the Montgomery setup, which would cost more than the few products
+static void rsa_pow_public(mpz_t out, mpz_t base, mpz_t e, mpz_t n) {
+    if (mpz_sgn(e) > 0 && mpz_sizeinbase(e, 2) <= RSA_SMALL_E_BITS) {
+        pow_mod_ui(out, base, mpz_get_ui(e), n);
+        return;
+    }
+    pow_mod(out, base, e, n);
+    return;
+}
+
+// Splits nbits between p and q, p gets between a quarter and three quarters of them
+static void rsa_prime_bits(uint64_t *p_bits, uint64_t *q_bits, uint64_t nbits) {
+    *p_bits = (random() % (nbits / 2)) + (nbits / 4);
+    *p_bits += 1;
+    *q_bits = nbits - *p_bits; // q_bits is given the remaining bits of nbits
+    *q_bits += 1;
+    return;
+}
+
+// Picks a random e of nbits bits that is coprime with the totient
+// Every draw reuses one workspace for its gcd
+static void rsa_pick_e(mpz_t e, mpz_t totient, uint64_t nbits) {
     mpz_t curr_e;
     mpz_t curr_gcd;
+    numtheory_ws ws;
 
     mpz_init(curr_e);
     mpz_init(curr_gcd);
-    mpz_init(totient);
-    mpz_init(p_minus_one);
-    mpz_init(q_minus_one);
-
-    p_bits = (random() % (nbits / 2)) + (nbits / 4);
-    p_bits += 1;
-    remaining_bits = nbits - p_bits; // q_bits is given the remaining bits of nbits
-    q_bits = remaining_bits;
-    q_bits += 1;
-
-    make_prime(p, p_bits, iters);
-    make_prime(q, q_bits, iters);
-
-    mpz_sub_ui(p_minus_one, p, 1);
-    mpz_sub_ui(q_minus_one, q, 1);
-    mpz_mul(totient, p_minus_one, q_minus_one); // Setting totient to (p-1)(q-1)
-
-    mpz_mul(n, p, q);
+    numtheory_ws_init(&ws, nbits);
 
     while (mpz_cmp_ui(curr_gcd, 1) != 0) { // stop the loop when we find coprime with totient
         mpz_urandomb(curr_e, state, nbits);
-        gcd(curr_gcd, curr_e, totient);
+        gcd_ws(curr_gcd, curr_e, totient, &ws);
+        STATS_ADD(STAT_E_RETRIES, mpz_cmp_ui(curr_gcd, 1) != 0 ? 1 : 0);
     }
 
     mpz_set(e, curr_e); // Set e
 
     mpz_clear(curr_e);
     mpz_clear(curr_gcd);
+    numtheory_ws_clear(&ws);
+    return;
+}
+
+// Computes n = p*q, and picks a random e as large as n coprime with the totient if e is 0
+static void rsa_make_pub_finish(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits) {
+    mpz_t totient;
+    mpz_t p_minus_one;
+    mpz_t q_minus_one;
+
+    mpz_mul(n, p, q);
+    if (mpz_sgn(e) != 0) { // A fixed e already fits p and q
+        return;
+    }
+
+    mpz_init(totient);
+    mpz_init(p_minus_one);
+    mpz_init(q_minus_one);
+
+    mpz_sub_ui(p_minus_one, p, 1);
+    mpz_sub_ui(q_minus_one, q, 1);
+    mpz_mul(totient, p_minus_one, q_minus_one); // Setting totient to (p-1)(q-1)
+    rsa_pick_e(e, totient, nbits);
+
     mpz_clear(totient);
     mpz_clear(p_minus_one);
     mpz_clear(q_minus_one);
@@ -55,13 +89,173 @@ void rsa_make_pub(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t i
     return;
 }
 
+// Sets totient to the product of r - 1 over count primes
+static void rsa_totient(mpz_t totient, mpz_t primes[], size_t count) {
+    mpz_t r_minus_one;
+
+    mpz_init(r_minus_one);
+    mpz_set_ui(totient, 1);
+    for (size_t i = 0; i < count; i++) {
+        mpz_sub_ui(r_minus_one, primes[i], 1);
+        mpz_mul(totient, totient, r_minus_one);
+    }
+    mpz_clear(r_minus_one);
+    return;
+}
+
+// Creates all the necessary components of a public key
+// Creates two primes, p and q, n = p*q, for the public exponent passed in e
+// Each prime is drawn again until gcd(e, p - 1) = 1, e = 0 picks a random e as large as n instead
+void rsa_make_pub(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters) {
+    uint64_t p_bits;
+    uint64_t q_bits;
+
+    rsa_prime_bits(&p_bits, &q_bits, nbits);
+    do {
+        make_prime(p, p_bits, iters);
+    } while (prime_fits_exponent(p, e) == false);
+    do {
+        make_prime(q, q_bits, iters);
+    } while (prime_fits_exponent(q, e) == false);
+    rsa_make_pub_finish(p, q, n, e, nbits);
+    return;
+}
+
+// Same as rsa_make_pub, but p and q are searched for at the same time on threads worker threads
+// The primes only depend on seed, a random e is still drawn from the calling thread's state
+void rsa_make_pub_threads(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters,
+    int threads, uint64_t seed) {
+    uint64_t bits[2];
+    mpz_t primes[2];
+
+    rsa_prime_bits(&bits[0], &bits[1], nbits);
+    mpz_inits(primes[0], primes[1], NULL);
+    make_prime_threads(primes, bits, 2, iters, e, threads, seed);
+    mpz_set(p, primes[0]);
+    mpz_set(q, primes[1]);
+    mpz_clears(primes[0], primes[1], NULL);
+    rsa_make_pub_finish(p, q, n, e, nbits);
+    return;
+}
+
+// Sets the sizes of the count primes of a multi-prime key of nbits bits, as equal as they can be
+// There are nbits + count bits in all, so n gets at least nbits + 1
+static void rsa_multi_bits(uint64_t bits[], size_t count, uint64_t nbits) {
+    for (size_t i = 0; i < count; i++) {
+        bits[i] = (nbits + count) / count + (i < (nbits + count) % count ? 1 : 0);
+    }
+    return;
+}
+
+// Returns true if no two of the count primes are equal
+static bool rsa_primes_distinct(mpz_t primes[], size_t count) {
+    for (size_t i = 1; i < count; i++) {
+        for (size_t j = 0; j < i; j++) {
+            if (mpz_cmp(primes[i], primes[j]) == 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Computes n as the product of count primes, and picks a random e as large as n if e is 0
+static void rsa_make_pub_product(mpz_t n, mpz_t e, mpz_t primes[], size_t count, uint64_t nbits) {
+    mpz_t totient;
+
+    mpz_set_ui(n, 1);
+    for (size_t i = 0; i < count; i++) {
+        mpz_mul(n, n, primes[i]);
+    }
+    if (mpz_sgn(e) == 0) { // A fixed e already fits every prime
+        mpz_init(totient);
+        rsa_totient(totient, primes, count);
+        rsa_pick_e(e, totient, nbits);
+        mpz_clear(totient);
+    }
+    return;
+}
+
+// Creates a multi-prime public key (RFC 8017), n is the product of count primes of about equal size
+// The primes are searched for at the same time on threads worker threads like rsa_make_pub_threads,
+// each is only a count-th of n and much cheaper to find than a half
+// The search starts over from a derived seed in the rare case that two primes come out equal
+void rsa_make_pub_multi(mpz_t primes[], size_t count, mpz_t n, mpz_t e, uint64_t nbits,
+    uint64_t iters, int threads, uint64_t seed) {
+    uint64_t bits[RSA_PRIMES_MAX];
+    bool distinct = false;
+
+    rsa_multi_bits(bits, count, nbits);
+    for (uint64_t attempt = 0; distinct == false; attempt++) {
+        make_prime_threads(primes, bits, count, iters, e, threads,
+            attempt == 0 ? seed : randstate_derive(seed, attempt));
+        distinct = rsa_primes_distinct(primes, count);
+    }
+    rsa_make_pub_product(n, e, primes, count, nbits);
+    return;
+}
+
+// Creates count public keys of per_key primes each at once, for generating keys in bulk
+// The primes of all the keys go into one make_prime_threads search on threads worker threads,
+// so a thread that is done with one prime moves on to any other key's instead of waiting
+// Key i gets primes[i * per_key] on, n[i], and e[i], which all hold the same public exponent on
+// entry, or 0 to pick a random one for each key
+// The primes split nbits like rsa_make_pub for two-prime keys and like rsa_make_pub_multi otherwise
+// A key whose primes come out equal is searched for again from a derived seed
+void rsa_make_pub_many(mpz_t primes[], mpz_t n[], mpz_t e[], size_t count, size_t per_key,
+    uint64_t nbits, uint64_t iters, int threads, uint64_t seed) {
+    uint64_t *bits = (uint64_t *) calloc(count * per_key, sizeof(uint64_t));
+    uint64_t attempt = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (per_key == 2) {
+            rsa_prime_bits(&bits[2 * i], &bits[2 * i + 1], nbits);
+        } else {
+            rsa_multi_bits(bits + i * per_key, per_key, nbits);
+        }
+    }
+    make_prime_threads(primes, bits, count * per_key, iters, e[0], threads, seed);
+    for (size_t i = 0; i < count; i++) {
+        while (rsa_primes_distinct(primes + i * per_key, per_key) == false) {
+            make_prime_threads(primes + i * per_key, bits + i * per_key, per_key, iters, e[0],
+                threads, randstate_derive(seed, ++attempt));
+        }
+        rsa_make_pub_product(n[i], e[i], primes + i * per_key, per_key, nbits);
+    }
+    free(bits);
+    return;
+}
+
+// Bits of each prime of a pool-backed key of nbits bits
+// Both primes have the same size, so one pool size serves every key of that size
+uint64_t rsa_pool_bits(uint64_t nbits) {
+    return (nbits + 1) / 2 + 1;
+}
+
+// Same as rsa_make_pub, but takes p and q from a prime pool instead of searching for them
+// Returns false, leaving the pool untouched, if it doesn't hold two free primes that fit e
+bool rsa_make_pub_pool(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, FILE *pool) {
+    mpz_t primes[2];
+    bool ok;
+
+    mpz_inits(primes[0], primes[1], NULL);
+    ok = pool_take(pool, primes, rsa_pool_bits(nbits), 2, e);
+    if (ok == true) {
+        mpz_set(p, primes[0]);
+        mpz_set(q, primes[1]);
+        rsa_make_pub_finish(p, q, n, e, nbits);
+    }
+    mpz_clears(primes[0], primes[1], NULL);
+    return ok;
+}
+
 // Writes a public key to a specified pbfile
 // Writes all components, including n, e, s, and username, as hexstrings
 void rsa_write_pub(mpz_t n, mpz_t e, mpz_t s, char username[], FILE *pbfile) {
 
-    gmp_fprintf(pbfile, "%Zx\n", n); // Prints out n with a trailing newline
-    gmp_fprintf(pbfile, "%Zx\n", e); // Prints out e with a trailing newline
-    gmp_fprintf(pbfile, "%Zx\n", s); // Prints out s with a trailing newline
+    hex_write(pbfile, n); // Prints out n with a trailing newline
+    hex_write(pbfile, e); // Prints out e with a trailing newline
+    hex_write(pbfile, s); // Prints out s with a trailing newline
 
     fprintf(pbfile, "%s\n", username);
 
@@ -102,11 +296,22 @@ void rsa_make_priv(mpz_t d, mpz_t e, mpz_t p, mpz_t q) {
     return;
 }
 
+// Makes the private key d of a multi-prime key, the inverse of e modulo the product of r - 1
+void rsa_make_priv_multi(mpz_t d, mpz_t e, mpz_t primes[], size_t count) {
+    mpz_t totient;
+
+    mpz_init(totient);
+    rsa_totient(totient, primes, count);
+    mod_inverse(d, e, totient);
+    mpz_clear(totient);
+    return;
+}
+
 // Writes the private key to a specified pvfile
 // n and d are both written out as hexstrings
 void rsa_write_priv(mpz_t n, mpz_t d, FILE *pvfile) {
-    gmp_fprintf(pvfile, "%Zx\n", n); // Writes n as hexstring to private file
-    gmp_fprintf(pvfile, "%Zx\n", d); // Writes d as hexstring to private file
+    hex_write(pvfile, n); // Writes n as hexstring to private file
+    hex_write(pvfile, d); // Writes d as hexstring to private file
 
     return;
 }
@@ -120,40 +325,134 @@ void rsa_read_priv(mpz_t n, mpz_t d, FILE *pvfile) {
     return;
 }
 
+// Computes the Chinese Remainder Theorem components of the private key
+// dp = d mod (p-1), dq = d mod (q-1), and qinv = q^-1 mod p
+void rsa_make_crt(mpz_t dp, mpz_t dq, mpz_t qinv, mpz_t d, mpz_t p, mpz_t q) {
+    mpz_t p_minus_one;
+    mpz_t q_minus_one;
+
+    mpz_init(p_minus_one);
+    mpz_init(q_minus_one);
+
+    mpz_sub_ui(p_minus_one, p, 1);
+    mpz_sub_ui(q_minus_one, q, 1);
+
+    mpz_mod(dp, d, p_minus_one); // dp = d mod (p-1)
+    mpz_mod(dq, d, q_minus_one); // dq = d mod (q-1)
+    mod_inverse(qinv, q, p); // qinv = q^-1 mod p
+
+    mpz_clears(p_minus_one, q_minus_one, NULL);
+
+    return;
+}
+
+// Writes the private key with its CRT components to a specified pvfile
+// n and d come first so the file still starts like the two line format, followed by p, q, dp, dq, qinv
+void rsa_write_priv_crt(
+    mpz_t n, mpz_t d, mpz_t p, mpz_t q, mpz_t dp, mpz_t dq, mpz_t qinv, FILE *pvfile) {
+    rsa_write_priv(n, d, pvfile); // Writes n and d as hexstrings
+
+    hex_write(pvfile, p); // Writes p as hexstring to private file
+    hex_write(pvfile, q); // Writes q as hexstring to private file
+    hex_write(pvfile, dp); // Writes dp as hexstring to private file
+    hex_write(pvfile, dq); // Writes dq as hexstring to private file
+    hex_write(pvfile, qinv); // Writes qinv as hexstring to private file
+
+    return;
+}
+
+// Reads a private key that may carry CRT components from a specified pvfile
+// Returns true if p, q, dp, dq, and qinv were all read, or false for an old two line key file
+bool rsa_read_priv_crt(
+    mpz_t n, mpz_t d, mpz_t p, mpz_t q, mpz_t dp, mpz_t dq, mpz_t qinv, FILE *pvfile) {
+    rsa_read_priv(n, d, pvfile); // Reads n and d as hexstrings
+
+    if (gmp_fscanf(pvfile, "%Zx\n", p) != 1) { // Old key files end after d
+        return false;
+    }
+    if (gmp_fscanf(pvfile, "%Zx\n", q) != 1) {
+        return false;
+    }
+    if (gmp_fscanf(pvfile, "%Zx\n", dp) != 1) {
+        return false;
+    }
+    if (gmp_fscanf(pvfile, "%Zx\n", dq) != 1) {
+        return false;
+    }
+    if (gmp_fscanf(pvfile, "%Zx\n", qinv) != 1) {
+        return false;
+    }
+
+    return true;
+}
+
+// Computes the CRT components of the primes of a multi-prime key past p = primes[0], q = primes[1]
+// dr[i - 2] = d mod (r_i - 1) and tr[i - 2] = (r_0 r_1 ... r_(i-1))^-1 mod r_i, as in RFC 8017
+void rsa_make_crt_extra(mpz_t dr[], mpz_t tr[], mpz_t d, mpz_t primes[], size_t count) {
+    mpz_t r_minus_one;
+    mpz_t product;
+    numtheory_ws ws; // Shared by the inverse of every prime
+
+    if (count <= 2) { // A two-prime key has no extra primes
+        return;
+    }
+    mpz_init(r_minus_one);
+    mpz_init(product);
+    numtheory_ws_init(&ws, mpz_sizeinbase(primes[2], 2));
+    mpz_mul(product, primes[0], primes[1]);
+    for (size_t i = 2; i < count; i++) {
+        mpz_sub_ui(r_minus_one, primes[i], 1);
+        mpz_mod(dr[i - 2], d, r_minus_one);
+        mod_inverse_ws(tr[i - 2], product, primes[i], &ws);
+        mpz_mul(product, product, primes[i]);
+    }
+    mpz_clears(r_minus_one, product, NULL);
+    numtheory_ws_clear(&ws);
+    return;
+}
+
+// Writes the extra primes of a multi-prime key after the CRT components, r_i, d_i, and t_i of each
+// A two-prime key has none, so its file stays the same
+void rsa_write_priv_extra(mpz_t r[], mpz_t dr[], mpz_t tr[], size_t extra, FILE *pvfile) {
+    for (size_t i = 0; i < extra; i++) {
+        hex_write(pvfile, r[i]);
+        hex_write(pvfile, dr[i]);
+        hex_write(pvfile, tr[i]);
+    }
+    return;
+}
+
+// Reads the extra primes that follow the CRT components of a multi-prime key file
+// Returns how many there were, 0 for a two-prime key
+size_t rsa_read_priv_extra(mpz_t r[], mpz_t dr[], mpz_t tr[], FILE *pvfile) {
+    size_t extra = 0;
+
+    while (extra < RSA_EXTRA_PRIMES && gmp_fscanf(pvfile, "%Zx\n", r[extra]) == 1) {
+        if (gmp_fscanf(pvfile, "%Zx\n", dr[extra]) != 1
+            || gmp_fscanf(pvfile, "%Zx\n", tr[extra]) != 1) {
+            break;
+        }
+        extra += 1;
+    }
+    return extra;
+}
+
 // Does RSA encryption by encrypting m using e and n
 // Stores the ciphertext in c
 // Computes the equation c = (m ^ e) (mod n)
 void rsa_encrypt(mpz_t c, mpz_t m, mpz_t e, mpz_t n) {
-    pow_mod(c, m, e, n); // Computes c = m^e (mod n)
+    rsa_pow_public(c, m, e, n); // Computes c = m^e (mod n)
     return;
 }
 
 // Encrypts the specified infile and writes out the encryption contents to the specified outfile
 // Takes in a modulo n and a public exponent e
 void rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e) {
-    mpz_t m;
-    mpz_t c;
-    mpz_init(m);
-    mpz_init(c);
-
-    size_t k = (mpz_sizeinbase(n, 2) - 1) / 8; // calculate block size = (log2(n) - 1) / 8
-    size_t j = 0;
-
-    uint8_t *buffer = (uint8_t *) calloc(k, sizeof(uint8_t)); // Creates a buffer for the blocks
-    buffer[0] = 0xFF;
+    rsa_key_ctx ctx;
 
-    while (
-        (j = fread(&buffer[1], sizeof(uint8_t), k - 1, infile))
-        > 0) { // we need to know when there's 0 bytes left so we can't make read_bytes = 0 or else the loop wouldn't stop when needed
-
-        mpz_import(m, j + 1, 1, sizeof(uint8_t), 1, 0, buffer);
-
-        rsa_encrypt(c, m, e, n);
-
-        gmp_fprintf(outfile, "%Zx\n", c); // Prints out the encrypted c to outfile
-    }
-    free(buffer);
-    mpz_clears(m, c, NULL);
+    rsa_ctx_init_pub(&ctx, n, e); // Set up n and e once for every block of the file
+    rsa_ctx_encrypt_file(&ctx, infile, outfile);
+    rsa_ctx_clear(&ctx);
     return;
 }
 
@@ -167,23 +466,50 @@ void rsa_decrypt(mpz_t m, mpz_t c, mpz_t d, mpz_t n) {
 // Decrypts the content of a specified infile and writes to a specified outfile
 // Takes in n and d as parameters
 void rsa_decrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t d) {
-    mpz_t m;
-    mpz_t c;
-    mpz_init(m);
-    mpz_init(c);
+    rsa_key_ctx ctx;
 
-    size_t k = (mpz_sizeinbase(n, 2) - 1) / 8; // Computes block size using (log2(n) - 1) / 8
-    size_t j = 0;
+    rsa_ctx_init_priv(&ctx, n, d); // Set up n and d once for every block of the file
+    rsa_ctx_decrypt_file(&ctx, infile, outfile);
+    rsa_ctx_clear(&ctx);
+    return;
+}
 
-    uint8_t *buffer = (uint8_t *) calloc(k, sizeof(uint8_t)); // Create a buffer for the blocks
+// Performs decryption of c with the CRT components of the private key
+// Two half-size exponentiations m1 = c^dp (mod p) and m2 = c^dq (mod q) are recombined with Garner's formula
+void rsa_decrypt_crt(mpz_t m, mpz_t c, mpz_t p, mpz_t q, mpz_t dp, mpz_t dq, mpz_t qinv) {
+    mpz_t m1;
+    mpz_t m2;
+    mpz_t h;
 
-    while (gmp_fscanf(infile, "%Zx\n", c) > 0) {
-        rsa_decrypt(m, c, d, n);
-        mpz_export(buffer, &j, 1, sizeof(uint8_t), 1, 0, m);
-        fwrite(&buffer[1], sizeof(uint8_t), j - 1, outfile); // Write out j-1 bytes to outfile
-    }
-    free(buffer);
-    mpz_clears(m, c, NULL);
+    mpz_init(m1);
+    mpz_init(m2);
+    mpz_init(h);
+
+    mpz_mod(h, c, p); // Reduce c first so the exponentiation works on half-size numbers
+    pow_mod(m1, h, dp, p); // m1 = c^dp (mod p)
+    mpz_mod(h, c, q);
+    pow_mod(m2, h, dq, q); // m2 = c^dq (mod q)
+
+    mpz_sub(h, m1, m2);
+    mpz_mul(h, h, qinv);
+    mpz_mod(h, h, p); // h = qinv * (m1 - m2) (mod p)
+
+    mpz_mul(h, h, q);
+    mpz_add(m, m2, h); // m = m2 + h * q
+
+    mpz_clears(m1, m2, h, NULL);
+    return;
+}
+
+// Decrypts the content of a specified infile using the CRT components of the private key
+// Produces the same output as rsa_decrypt_file, only faster
+void rsa_decrypt_file_crt(FILE *infile, FILE *outfile, mpz_t n, mpz_t p, mpz_t q, mpz_t dp,
+    mpz_t dq, mpz_t qinv) {
+    rsa_key_ctx ctx;
+
+    rsa_ctx_init_crt(&ctx, n, p, q, dp, dq, qinv); // Set up both halves once for the whole file
+    rsa_ctx_decrypt_file(&ctx, infile, outfile);
+    rsa_ctx_clear(&ctx);
     return;
 }
 
@@ -194,13 +520,20 @@ void rsa_sign(mpz_t s, mpz_t m, mpz_t d, mpz_t n) {
     return;
 }
 
+// Produces a signature by signing m using the CRT components of the private key
+// Computes the same S(m) = s = m^d (mod n) as rsa_sign
+void rsa_sign_crt(mpz_t s, mpz_t m, mpz_t p, mpz_t q, mpz_t dp, mpz_t dq, mpz_t qinv) {
+    rsa_decrypt_crt(s, m, p, q, dp, dq, qinv); // Signing is the same operation as decryption
+    return;
+}
+
 // Verifies the signature s, Returns true if s is verified (if t is same as m) and false otherwise
 // Computes the equation t = V(S) = s^e (mod n)
 bool rsa_verify(mpz_t m, mpz_t s, mpz_t e, mpz_t n) {
     mpz_t t;
     mpz_init(t);
 
-    pow_mod(t, s, e, n); // Calculates the equation stated above
+    rsa_pow_public(t, s, e, n); // Calculates the equation stated above
 
     if (mpz_cmp(t, m) == 0) { // Returns true only if t is the same as expected message
         mpz_clear(t);
@@ -210,3 +543,1592 @@ bool rsa_verify(mpz_t m, mpz_t s, mpz_t e, mpz_t n) {
     mpz_clear(t);
     return false;
 }
+
+// Sets up the parts of a key context shared by every kind of key
+// Computes the block size and allocates the block buffer and temporaries
+static void rsa_ctx_init_common(rsa_key_ctx *ctx, mpz_t n) {
+    mpz_init_set(ctx->n, n);
+    mpz_inits(ctx->exponent, ctx->p, ctx->q, ctx->dp, ctx->dq, ctx->qinv, NULL);
+    mpz_inits(ctx->m, ctx->c, ctx->m1, ctx->m2, ctx->verified_m, ctx->verified_s, NULL);
+    for (size_t i = 0; i < MBEXP_LANES; i++) {
+        mpz_inits(ctx->lanes_in[i], ctx->lanes_out[i], ctx->lanes_p[i], NULL);
+    }
+    for (size_t i = 0; i < RSA_EXTRA_PRIMES; i++) {
+        mpz_inits(ctx->r[i], ctx->dr[i], ctx->tr[i], ctx->rprod[i], ctx->mr[i], NULL);
+        for (size_t j = 0; j < MBEXP_LANES; j++) {
+            mpz_init(ctx->lanes_r[i][j]);
+        }
+    }
+    ctx->extra = 0;
+    ctx->crt = false;
+    ctx->mont = false;
+    ctx->mb = false;
+    ctx->bytes_read = 0;
+    ctx->bytes_written = 0;
+    ctx->verified = false;
+
+    ctx->k = (mpz_sizeinbase(n, 2) - 1) / 8; // calculate block size = (log2(n) - 1) / 8
+    ctx->width = (mpz_sizeinbase(n, 2) + 7) / 8; // Bytes in any number below n
+    ctx->buffer = (uint8_t *) calloc(ctx->k + 1, sizeof(uint8_t)); // m < n fits in k + 1 bytes
+
+    return;
+}
+
+// Sets up the exponentiation of one exponent over n for a public or non-CRT private key
+// Montgomery constants, the exponent recoding, and scratch space are all made here once
+static void rsa_ctx_init_exponent(rsa_key_ctx *ctx, mpz_t n, mpz_t exponent) {
+    rsa_ctx_init_common(ctx, n);
+    mpz_set(ctx->exponent, exponent);
+
+    if (mpz_sgn(exponent) > 0 && mont_init(&ctx->mont_n, n)) {
+        mont_exp_init(&ctx->exp_n, exponent);
+        mont_ws_init(&ctx->ws_n, &ctx->mont_n, ctx->exp_n.window);
+        ctx->mont = true;
+        ctx->mb = mbexp_init(&ctx->mb_n, n, exponent);
+    } else {
+        numtheory_ws_init(&ctx->ws, mpz_sizeinbase(n, 2));
+    }
+    return;
+}
+
+// Builds a key context from a public key n and e, for encryption and verification
+void rsa_ctx_init_pub(rsa_key_ctx *ctx, mpz_t n, mpz_t e) {
+    rsa_ctx_init_exponent(ctx, n, e);
+    return;
+}
+
+// Builds a key context from a private key n and d, for decryption and signing
+void rsa_ctx_init_priv(rsa_key_ctx *ctx, mpz_t n, mpz_t d) {
+    rsa_ctx_init_exponent(ctx, n, d);
+    return;
+}
+
+// The exponentiation state of one CRT prime of a context
+typedef struct {
+    mpz_ptr prime, exponent;
+    mont_ctx *mont;
+    mont_exp *exp;
+    mont_ws *ws;
+    mbexp_ctx *mb;
+} rsa_crt_prime;
+
+// Returns CRT prime i of a context: 0 is p, 1 is q, and 2 on are the extra primes
+static rsa_crt_prime rsa_ctx_crt_prime(rsa_key_ctx *ctx, size_t i) {
+    rsa_crt_prime r;
+
+    if (i == 0) {
+        r = (rsa_crt_prime) { ctx->p, ctx->dp, &ctx->mont_p, &ctx->exp_p, &ctx->ws_p, &ctx->mb_p };
+    } else if (i == 1) {
+        r = (rsa_crt_prime) { ctx->q, ctx->dq, &ctx->mont_q, &ctx->exp_q, &ctx->ws_q, &ctx->mb_q };
+    } else {
+        i -= 2;
+        r = (rsa_crt_prime) { ctx->r[i], ctx->dr[i], &ctx->mont_r[i], &ctx->exp_r[i],
+            &ctx->ws_r[i], &ctx->mb_r[i] };
+    }
+    return r;
+}
+
+// Frees the Montgomery state of the first count CRT primes
+static void rsa_ctx_clear_mont(rsa_key_ctx *ctx, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        rsa_crt_prime r = rsa_ctx_crt_prime(ctx, i);
+        mont_ws_clear(r.ws);
+        mont_exp_clear(r.exp);
+        mont_clear(r.mont);
+    }
+    return;
+}
+
+// Frees the SIMD lanes of the first count CRT primes
+static void rsa_ctx_clear_mb(rsa_key_ctx *ctx, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        mbexp_clear(rsa_ctx_crt_prime(ctx, i).mb);
+    }
+    return;
+}
+
+// Builds a key context from the CRT components of a private key, for decryption and signing
+// Falls back to the plain pow_mod CRT path if p or q can't be put in Montgomery form
+void rsa_ctx_init_crt(
+    rsa_key_ctx *ctx, mpz_t n, mpz_t p, mpz_t q, mpz_t dp, mpz_t dq, mpz_t qinv) {
+    rsa_ctx_init_multi(ctx, n, p, q, dp, dq, qinv, NULL, NULL, NULL, 0);
+    return;
+}
+
+// Builds a key context from the CRT components of a multi-prime private key with extra primes
+// past p and q, r[i], dr[i], and tr[i] as made by rsa_make_crt_extra, extra = 0 for two primes
+// Falls back to the plain pow_mod CRT path if any prime can't be put in Montgomery form
+void rsa_ctx_init_multi(rsa_key_ctx *ctx, mpz_t n, mpz_t p, mpz_t q, mpz_t dp, mpz_t dq,
+    mpz_t qinv, mpz_t r[], mpz_t dr[], mpz_t tr[], size_t extra) {
+    size_t primes = 2 + extra;
+    size_t made = 0;
+
+    rsa_ctx_init_common(ctx, n);
+    mpz_set(ctx->p, p);
+    mpz_set(ctx->q, q);
+    mpz_set(ctx->dp, dp);
+    mpz_set(ctx->dq, dq);
+    mpz_set(ctx->qinv, qinv);
+    for (size_t i = 0; i < extra; i++) {
+        mpz_set(ctx->r[i], r[i]);
+        mpz_set(ctx->dr[i], dr[i]);
+        mpz_set(ctx->tr[i], tr[i]);
+        if (i == 0) {
+            mpz_mul(ctx->rprod[i], ctx->p, ctx->q);
+        } else {
+            mpz_mul(ctx->rprod[i], ctx->rprod[i - 1], ctx->r[i - 1]);
+        }
+    }
+    ctx->extra = extra;
+    ctx->crt = true;
+
+    for (; made < primes; made++) {
+        rsa_crt_prime r = rsa_ctx_crt_prime(ctx, made);
+        if (mpz_sgn(r.exponent) <= 0 || mont_init(r.mont, r.prime) == false) {
+            break;
+        }
+        mont_exp_init(r.exp, r.exponent);
+        mont_ws_init(r.ws, r.mont, r.exp->window);
+    }
+    ctx->mont = made == primes;
+    if (ctx->mont == false) {
+        rsa_ctx_clear_mont(ctx, made);
+        numtheory_ws_init(&ctx->ws, mpz_sizeinbase(n, 2));
+        return;
+    }
+
+    for (made = 0; made < primes; made++) {
+        rsa_crt_prime r = rsa_ctx_crt_prime(ctx, made);
+        if (mbexp_init(r.mb, r.prime, r.exponent) == false) {
+            break;
+        }
+    }
+    ctx->mb = made == primes;
+    if (ctx->mb == false) {
+        rsa_ctx_clear_mb(ctx, made);
+    }
+    return;
+}
+
+// Builds a key context for the same key as src, with its own scratch space
+// Used to give every worker thread a context of its own
+void rsa_ctx_copy(rsa_key_ctx *dst, rsa_key_ctx *src) {
+    if (src->crt == true) {
+        rsa_ctx_init_multi(dst, src->n, src->p, src->q, src->dp, src->dq, src->qinv, src->r,
+            src->dr, src->tr, src->extra);
+    } else {
+        rsa_ctx_init_exponent(dst, src->n, src->exponent);
+    }
+    return;
+}
+
+// Frees everything held by a key context
+void rsa_ctx_clear(rsa_key_ctx *ctx) {
+    if (ctx->mb == true && ctx->crt == true) {
+        rsa_ctx_clear_mb(ctx, 2 + ctx->extra);
+    } else if (ctx->mb == true) {
+        mbexp_clear(&ctx->mb_n);
+    }
+    for (size_t i = 0; i < MBEXP_LANES; i++) {
+        mpz_clears(ctx->lanes_in[i], ctx->lanes_out[i], ctx->lanes_p[i], NULL);
+    }
+    for (size_t i = 0; i < RSA_EXTRA_PRIMES; i++) {
+        mpz_clears(ctx->r[i], ctx->dr[i], ctx->tr[i], ctx->rprod[i], ctx->mr[i], NULL);
+        for (size_t j = 0; j < MBEXP_LANES; j++) {
+            mpz_clear(ctx->lanes_r[i][j]);
+        }
+    }
+    if (ctx->mont == true && ctx->crt == true) {
+        rsa_ctx_clear_mont(ctx, 2 + ctx->extra);
+    } else if (ctx->mont == true) {
+        mont_ws_clear(&ctx->ws_n);
+        mont_exp_clear(&ctx->exp_n);
+        mont_clear(&ctx->mont_n);
+    } else {
+        numtheory_ws_clear(&ctx->ws);
+    }
+    free(ctx->buffer);
+    mpz_clears(ctx->n, ctx->exponent, ctx->p, ctx->q, ctx->dp, ctx->dq, ctx->qinv, NULL);
+    mpz_clears(ctx->m, ctx->c, ctx->m1, ctx->m2, ctx->verified_m, ctx->verified_s, NULL);
+    return;
+}
+
+// Recombines m1 = c^dp (mod p) and m2 = c^dq (mod q) into out with Garner's formula
+// Like rsa_decrypt_crt, m1 is used as scratch and out may be m2
+static void rsa_ctx_combine(rsa_key_ctx *ctx, mpz_t out, mpz_t m1, mpz_t m2) {
+    mpz_sub(m1, m1, m2);
+    mpz_mul(m1, m1, ctx->qinv);
+    mpz_mod(m1, m1, ctx->p); // h = qinv * (m1 - m2) (mod p)
+    mpz_mul(m1, m1, ctx->q);
+    mpz_add(out, m2, m1); // m = m2 + h * q
+    return;
+}
+
+// Adds the residue mi = c^d_i (mod r_i) of extra prime i to out, which holds c^d modulo rprod[i]
+// Garner's formula again, with t_i in place of qinv, mi is used as scratch
+static void rsa_ctx_combine_extra(rsa_key_ctx *ctx, mpz_t out, mpz_t mi, size_t i) {
+    mpz_sub(mi, mi, out);
+    mpz_mod(mi, mi, ctx->r[i]);
+    mpz_mul(mi, mi, ctx->tr[i]);
+    mpz_mod(mi, mi, ctx->r[i]); // h = t_i * (m_i - m) (mod r_i)
+    mpz_mul(mi, mi, ctx->rprod[i]);
+    mpz_add(out, out, mi); // m = m + h * rprod
+    return;
+}
+
+// Computes out = in ^ exponent (mod n) with whatever the context was built with
+// CRT contexts recombine the two halves with Garner's formula like rsa_decrypt_crt
+static void rsa_ctx_pow(rsa_key_ctx *ctx, mpz_t out, mpz_t in) {
+    uint64_t timer = stats_begin();
+
+    if (ctx->crt == false) {
+        if (ctx->mont == true) {
+            mont_pow_exp(out, in, &ctx->exp_n, &ctx->mont_n, &ctx->ws_n);
+        } else {
+            pow_mod_ws(out, in, ctx->exponent, ctx->n, &ctx->ws);
+        }
+        stats_end(STAGE_EXPONENTIATE, timer);
+        return;
+    }
+
+    if (ctx->mont == true) {
+        mont_pow_exp(ctx->m1, in, &ctx->exp_p, &ctx->mont_p, &ctx->ws_p); // m1 = c^dp (mod p)
+        mont_pow_exp(ctx->m2, in, &ctx->exp_q, &ctx->mont_q, &ctx->ws_q); // m2 = c^dq (mod q)
+        for (size_t i = 0; i < ctx->extra; i++) { // m_i = c^d_i (mod r_i)
+            mont_pow_exp(ctx->mr[i], in, &ctx->exp_r[i], &ctx->mont_r[i], &ctx->ws_r[i]);
+        }
+    } else {
+        mpz_mod(ctx->m1, in, ctx->p);
+        pow_mod_ws(ctx->m1, ctx->m1, ctx->dp, ctx->p, &ctx->ws);
+        mpz_mod(ctx->m2, in, ctx->q);
+        pow_mod_ws(ctx->m2, ctx->m2, ctx->dq, ctx->q, &ctx->ws);
+        for (size_t i = 0; i < ctx->extra; i++) {
+            mpz_mod(ctx->mr[i], in, ctx->r[i]);
+            pow_mod_ws(ctx->mr[i], ctx->mr[i], ctx->dr[i], ctx->r[i], &ctx->ws);
+        }
+    }
+    rsa_ctx_combine(ctx, out, ctx->m1, ctx->m2); // Every residue is in hand before out is written
+    for (size_t i = 0; i < ctx->extra; i++) {
+        rsa_ctx_combine_extra(ctx, out, ctx->mr[i], i);
+    }
+
+    stats_end(STAGE_EXPONENTIATE, timer);
+    return;
+}
+
+// Groups of fewer bases than this are faster one at a time than in the SIMD lanes
+#define RSA_LANES_MIN 2
+
+// Computes out[i] = in[i] ^ exponent (mod n) for count bases, out may be in
+// Bases go through the SIMD lanes MBEXP_LANES at a time when the context has them, results are
+// the same as from rsa_ctx_pow
+static void rsa_ctx_pow_many(rsa_key_ctx *ctx, mpz_t out[], mpz_t in[], size_t count) {
+    for (size_t i = 0; i < count; i += MBEXP_LANES) {
+        size_t group = count - i < MBEXP_LANES ? count - i : MBEXP_LANES;
+        if (ctx->mb == false || group < RSA_LANES_MIN) {
+            for (size_t j = i; j < i + group; j++) {
+                rsa_ctx_pow(ctx, out[j], in[j]);
+            }
+            continue;
+        }
+        uint64_t timer = stats_begin();
+        if (ctx->crt == false) {
+            mbexp_pow(&ctx->mb_n, out + i, in + i, group);
+        } else {
+            mbexp_pow(&ctx->mb_p, ctx->lanes_p, in + i, group); // m1 = c^dp (mod p)
+            for (size_t r = 0; r < ctx->extra; r++) { // m_r = c^d_r (mod r_r)
+                mbexp_pow(&ctx->mb_r[r], ctx->lanes_r[r], in + i, group);
+            }
+            mbexp_pow(&ctx->mb_q, out + i, in + i, group); // m2 = c^dq (mod q), out may be in
+            for (size_t j = 0; j < group; j++) {
+                rsa_ctx_combine(ctx, out[i + j], ctx->lanes_p[j], out[i + j]);
+                for (size_t r = 0; r < ctx->extra; r++) {
+                    rsa_ctx_combine_extra(ctx, out[i + j], ctx->lanes_r[r][j], r);
+                }
+            }
+        }
+        stats_end(STAGE_EXPONENTIATE, timer);
+    }
+    return;
+}
+
+// Encrypts m under a public key context, same as rsa_encrypt
+void rsa_ctx_encrypt(rsa_key_ctx *ctx, mpz_t c, mpz_t m) {
+    rsa_ctx_pow(ctx, c, m); // Computes c = m^e (mod n)
+    return;
+}
+
+// Decrypts c under a private key context, same as rsa_decrypt or rsa_decrypt_crt
+void rsa_ctx_decrypt(rsa_key_ctx *ctx, mpz_t m, mpz_t c) {
+    rsa_ctx_pow(ctx, m, c); // Computes m = c^d (mod n)
+    return;
+}
+
+// Signs m under a private key context, same as rsa_sign or rsa_sign_crt
+void rsa_ctx_sign(rsa_key_ctx *ctx, mpz_t s, mpz_t m) {
+    rsa_ctx_pow(ctx, s, m); // Computes s = m^d (mod n)
+    return;
+}
+
+// Verifies the signature s of m under a public key context, same as rsa_verify
+// A pair that already verified under this context is accepted without another exponentiation
+bool rsa_ctx_verify(rsa_key_ctx *ctx, mpz_t m, mpz_t s) {
+    if (ctx->verified == true && mpz_cmp(ctx->verified_m, m) == 0
+        && mpz_cmp(ctx->verified_s, s) == 0) {
+        return true;
+    }
+
+    rsa_ctx_pow(ctx, ctx->c, s); // Computes t = s^e (mod n)
+
+    if (mpz_cmp(ctx->c, m) != 0) { // Only true if t is the same as expected message
+        return false;
+    }
+    mpz_set(ctx->verified_m, m);
+    mpz_set(ctx->verified_s, s);
+    ctx->verified = true;
+    return true;
+}
+
+// Records the bytes a file function moved, extra_read and extra_written count the container
+// header and footer that bypass the reader and writer, then flushes and frees both
+static void rsa_ctx_file_done(rsa_key_ctx *ctx, fileio_reader *reader, fileio_writer *writer,
+    uint64_t extra_read, uint64_t extra_written) {
+    uint64_t timer = stats_begin();
+
+    fileio_flush(writer);
+    stats_end(STAGE_WRITE, timer);
+
+    ctx->bytes_read = reader->bytes + extra_read;
+    ctx->bytes_written = writer->bytes + extra_written;
+    STATS_ADD(STAT_BYTES_READ, ctx->bytes_read);
+    STATS_ADD(STAT_BYTES_WRITTEN, ctx->bytes_written);
+    fileio_writer_clear(writer);
+    fileio_reader_clear(reader);
+    return;
+}
+
+// Stores c big-endian in exactly width bytes, zero padded on the left
+static void rsa_export_fixed(uint8_t *out, size_t width, mpz_t c) {
+    size_t count = (mpz_sizeinbase(c, 2) + 7) / 8;
+
+    memset(out, 0, width - count);
+    mpz_export(out + width - count, NULL, 1, sizeof(uint8_t), 1, 0, c);
+    return;
+}
+
+// Looks at the first byte of infile without consuming it
+// Binary containers start with CONTAINER_MAGIC, which is not a hex digit
+rsa_format rsa_detect_format(FILE *infile) {
+    int c = getc(infile);
+
+    if (c == EOF) {
+        return RSA_FORMAT_HEX;
+    }
+    ungetc(c, infile);
+    return c == CONTAINER_MAGIC[0] ? RSA_FORMAT_BIN : RSA_FORMAT_HEX;
+}
+
+// Fills in the container header for this key
+static void rsa_ctx_header(rsa_key_ctx *ctx, container_header *header) {
+    header->version = CONTAINER_VERSION;
+    header->mode = CONTAINER_MODE_BLOCKS;
+    header->k = ctx->k;
+    header->width = ctx->width;
+    header->fingerprint = container_fingerprint(ctx->n);
+    return;
+}
+
+// Reads a container header from infile and checks that it was made for this key
+// The caller picks the decryption path from header->mode
+static bool rsa_ctx_check_header(rsa_key_ctx *ctx, FILE *infile, container_header *header) {
+    container_header expected;
+
+    rsa_ctx_header(ctx, &expected);
+    if (container_read_header(header, infile) == false) {
+        return false;
+    }
+    return (header->mode == CONTAINER_MODE_BLOCKS || header->mode == CONTAINER_MODE_HYBRID)
+           && header->k == expected.k && header->width == expected.width
+           && header->fingerprint == expected.fingerprint;
+}
+
+// Writes the ciphertext c to out as a fixed-width block or as a hex line like %Zx
+// Returns the bytes written
+static size_t rsa_export_cipher(uint8_t *out, mpz_t c, size_t width, rsa_format format) {
+    if (format == RSA_FORMAT_BIN) {
+        rsa_export_fixed(out, width, c);
+        return width;
+    }
+    size_t digits = hex_encode((char *) out, c);
+    out[digits] = '\n';
+    return digits + 1;
+}
+
+// Encrypts len bytes at in as blocks of k - 1 bytes, the last of which may be shorter
+// The blocks are exponentiated as one group, so len can be at most MBEXP_LANES * (k - 1)
+// Writes the ciphertexts to out in the given format and returns the bytes written
+static size_t rsa_ctx_encrypt_blocks(
+    rsa_key_ctx *ctx, uint8_t *out, uint8_t *in, size_t len, rsa_format format) {
+    size_t count = 0;
+    size_t written = 0;
+    uint64_t timer = stats_begin();
+
+    for (size_t i = 0; i < len; i += ctx->k - 1) {
+        size_t j = len - i < ctx->k - 1 ? len - i : ctx->k - 1;
+        rsa_import_message(ctx->lanes_in[count++], in + i, j, ctx->k); // 0xFF and the block
+    }
+    stats_end(STAGE_IMPORT, timer);
+    rsa_ctx_pow_many(ctx, ctx->lanes_out, ctx->lanes_in, count);
+    timer = stats_begin();
+    for (size_t i = 0; i < count; i++) {
+        written += rsa_export_cipher(out + written, ctx->lanes_out[i], ctx->width, format);
+    }
+    stats_end(STAGE_EXPORT, timer);
+    STATS_ADD(STAT_BLOCKS, count);
+    return written;
+}
+
+// Imports one fixed-width ciphertext block into c
+// Returns false if the block isn't below n, then it is corrupt or no ciphertext under this key
+static bool rsa_ctx_import_block(rsa_key_ctx *ctx, mpz_t c, uint8_t *block) {
+    uint64_t timer = stats_begin();
+
+    mpz_import(c, ctx->width, 1, sizeof(uint8_t), 1, 0, block);
+    stats_end(STAGE_IMPORT, timer);
+    return mpz_cmp(c, ctx->n) < 0;
+}
+
+// Exports a decrypted block m into ctx->buffer
+// Returns how many plaintext bytes follow the 0xFF prefix, starting at ctx->buffer[1]
+static size_t rsa_ctx_export_plain(rsa_key_ctx *ctx, mpz_t m) {
+    size_t j = 0;
+    uint64_t timer = stats_begin();
+
+    mpz_export(ctx->buffer, &j, 1, sizeof(uint8_t), 1, 0, m);
+    stats_end(STAGE_EXPORT, timer);
+    STATS_ADD(STAT_BLOCKS, 1);
+    return j > 0 ? j - 1 : 0; // Drop the 0xFF prefix
+}
+
+// Decrypts one fixed-width block into ctx->buffer, *len is set to how many plaintext bytes follow
+// the 0xFF prefix, starting at ctx->buffer[1]
+// Returns false if the block isn't below n
+static bool rsa_ctx_decrypt_block(rsa_key_ctx *ctx, uint8_t *block, size_t *len) {
+    if (rsa_ctx_import_block(ctx, ctx->c, block) == false) {
+        return false;
+    }
+    rsa_ctx_decrypt(ctx, ctx->m, ctx->c);
+    *len = rsa_ctx_export_plain(ctx, ctx->m);
+    return true;
+}
+
+// Decrypts count fixed-width blocks at in as one group, count is at most MBEXP_LANES
+// Writes their plaintext to out, which needs room for count * k bytes, and its length to *written
+// Returns false if a block isn't below n, the blocks before it are still decrypted
+static bool rsa_ctx_decrypt_blocks(
+    rsa_key_ctx *ctx, uint8_t *out, uint8_t *in, size_t count, size_t *written) {
+    size_t good = 0;
+
+    while (good < count
+           && rsa_ctx_import_block(ctx, ctx->lanes_in[good], in + good * ctx->width) == true) {
+        good++;
+    }
+    rsa_ctx_pow_many(ctx, ctx->lanes_out, ctx->lanes_in, good);
+    *written = 0;
+    for (size_t i = 0; i < good; i++) {
+        size_t j = rsa_ctx_export_plain(ctx, ctx->lanes_out[i]);
+        memcpy(out + *written, &ctx->buffer[1], j);
+        *written += j;
+    }
+    return good == count;
+}
+
+// Fills in the nonce of record index, the final flag keeps a cut off stream from passing as whole
+static void rsa_hybrid_nonce(uint8_t *nonce, uint64_t index, bool final) {
+    memset(nonce, 0, AEAD_NONCE_SIZE);
+    nonce[0] = final == true ? 1 : 0;
+    for (int i = 0; i < 8; i++) {
+        nonce[AEAD_NONCE_SIZE - 1 - i] = (index >> (8 * i)) & 0xFF;
+    }
+    return;
+}
+
+// Hands out the next want bytes of input, straight out of the caller's span if nothing is pending
+// Otherwise tops up pending, and returns NULL if the span ran out before want bytes were there
+// What is handed out stays valid until the next call
+static uint8_t *rsa_crypt_take(rsa_crypt *crypt, uint8_t **in, size_t *len, size_t want) {
+    if (crypt->pending_len == 0 && *len >= want) {
+        uint8_t *unit = *in;
+        *in += want;
+        *len -= want;
+        return unit;
+    }
+    size_t n = want - crypt->pending_len < *len ? want - crypt->pending_len : *len;
+    if (n > 0) {
+        memcpy(crypt->pending + crypt->pending_len, *in, n);
+        crypt->pending_len += n;
+        *in += n;
+        *len -= n;
+    }
+    if (crypt->pending_len < want) {
+        return NULL;
+    }
+    crypt->pending_len = 0;
+    return crypt->pending;
+}
+
+// Returns room for len more bytes of output, or NULL and fails the stream if out is too small
+static uint8_t *rsa_crypt_room(
+    rsa_crypt *crypt, uint8_t *out, size_t out_cap, size_t *out_len, size_t len) {
+    if (out_cap - *out_len < len) {
+        crypt->failed = true;
+        return NULL;
+    }
+    return out + *out_len;
+}
+
+// Copies the len plaintext bytes a block decrypted to, at ctx->buffer[1], to the output
+static void rsa_crypt_emit(rsa_crypt *crypt, uint8_t *out, size_t out_cap, size_t *out_len,
+    size_t len) {
+    uint8_t *at = rsa_crypt_room(crypt, out, out_cap, out_len, len);
+
+    if (at != NULL) {
+        memcpy(at, &crypt->ctx->buffer[1], len);
+        *out_len += len;
+        crypt->total += len;
+    }
+    return;
+}
+
+// Plaintext bytes encrypted as one unit, a block or a hybrid record
+static size_t rsa_crypt_unit(rsa_crypt *crypt) {
+    return crypt->format == RSA_FORMAT_HYBRID ? CONTAINER_RECORD_SIZE : crypt->ctx->k - 1;
+}
+
+// Most output bytes one unit of plaintext can become
+static size_t rsa_crypt_unit_out(rsa_crypt *crypt) {
+    switch (crypt->format) {
+    case RSA_FORMAT_HEX: return 2 * crypt->ctx->width + 1; // Digits and the newline
+    case RSA_FORMAT_BIN: return crypt->ctx->width;
+    default: return 4 + CONTAINER_RECORD_SIZE + AEAD_TAG_SIZE;
+    }
+}
+
+// Returns the input bytes to take next when RSA blocks of unit bytes are coming
+// With nothing pending, up to MBEXP_LANES whole blocks in the span are taken as one group
+static size_t rsa_crypt_group(rsa_crypt *crypt, size_t unit, size_t len) {
+    size_t units = len / unit;
+
+    if (crypt->pending_len > 0 || units < 2) {
+        return unit;
+    }
+    return (units < MBEXP_LANES ? units : MBEXP_LANES) * unit;
+}
+
+// Sets up an incremental encryption under a public key context in one of the three formats
+// A hybrid encryption draws its session key here
+// Returns false if n is too small for the format or no session key could be drawn
+bool rsa_encrypt_init(rsa_crypt *crypt, rsa_key_ctx *ctx, rsa_format format) {
+    container_header header;
+
+    memset(crypt, 0, sizeof(rsa_crypt));
+    crypt->ctx = ctx;
+    crypt->format = format;
+    crypt->failed = ctx->k < 2 || (format == RSA_FORMAT_BIN && ctx->width <= CONTAINER_FOOTER_SIZE)
+                    || (format == RSA_FORMAT_HYBRID
+                        && randstate_entropy(crypt->key, AEAD_KEY_SIZE) == false);
+    if (crypt->failed == true) {
+        return false;
+    }
+    rsa_ctx_header(ctx, &header);
+    header.mode = format == RSA_FORMAT_HYBRID ? CONTAINER_MODE_HYBRID : CONTAINER_MODE_BLOCKS;
+    container_pack_header(&header, crypt->aad);
+    crypt->pending_cap = rsa_crypt_unit(crypt);
+    crypt->pending = (uint8_t *) malloc(crypt->pending_cap);
+    return true;
+}
+
+// Returns how much output space an encrypt update of len bytes, or an encrypt final, can need
+size_t rsa_encrypt_bound(rsa_crypt *crypt, size_t len) {
+    if (crypt->failed == true) {
+        return 0;
+    }
+    // One unit more than the input fills, for the last one final encrypts
+    size_t units = (crypt->pending_len + len) / rsa_crypt_unit(crypt) + 1;
+    size_t key = (AEAD_KEY_SIZE + crypt->ctx->k - 2) / (crypt->ctx->k - 1) * crypt->ctx->width;
+    return units * rsa_crypt_unit_out(crypt) + CONTAINER_HEADER_SIZE + CONTAINER_FOOTER_SIZE + key;
+}
+
+// Writes the container header, and for hybrid the session key wrapped in blocks
+static void rsa_encrypt_start(rsa_crypt *crypt, uint8_t *out, size_t out_cap, size_t *out_len) {
+    rsa_key_ctx *ctx = crypt->ctx;
+    uint8_t *at;
+
+    crypt->stage = RSA_CRYPT_DATA;
+    if (crypt->format == RSA_FORMAT_HEX) {
+        return;
+    }
+    if ((at = rsa_crypt_room(crypt, out, out_cap, out_len, CONTAINER_HEADER_SIZE)) == NULL) {
+        return;
+    }
+    memcpy(at, crypt->aad, CONTAINER_HEADER_SIZE);
+    *out_len += CONTAINER_HEADER_SIZE;
+    for (size_t i = 0; crypt->format == RSA_FORMAT_HYBRID && i < AEAD_KEY_SIZE; i += ctx->k - 1) {
+        size_t len = AEAD_KEY_SIZE - i < ctx->k - 1 ? AEAD_KEY_SIZE - i : ctx->k - 1;
+        if ((at = rsa_crypt_room(crypt, out, out_cap, out_len, ctx->width)) == NULL) {
+            return;
+        }
+        rsa_import_message(ctx->m, crypt->key + i, len, ctx->k);
+        rsa_ctx_encrypt(ctx, ctx->c, ctx->m);
+        rsa_export_fixed(at, ctx->width, ctx->c);
+        *out_len += ctx->width;
+        STATS_ADD(STAT_BLOCKS, 1);
+    }
+    return;
+}
+
+// Encrypts len bytes at in as one record or as a group of blocks
+// final marks the last record of a hybrid container
+static void rsa_encrypt_unit(rsa_crypt *crypt, uint8_t *out, size_t out_cap, size_t *out_len,
+    uint8_t *in, size_t len, bool final) {
+    rsa_key_ctx *ctx = crypt->ctx;
+    size_t units = crypt->format == RSA_FORMAT_HYBRID ? 1 : (len + ctx->k - 2) / (ctx->k - 1);
+    uint8_t *at = rsa_crypt_room(crypt, out, out_cap, out_len, units * rsa_crypt_unit_out(crypt));
+    uint64_t timer = stats_begin();
+
+    if (at == NULL) {
+        return;
+    }
+    crypt->total += len;
+    if (crypt->format == RSA_FORMAT_HYBRID) {
+        uint8_t nonce[AEAD_NONCE_SIZE];
+        uint32_t length = final == true ? len | CONTAINER_RECORD_FINAL : len;
+        rsa_hybrid_nonce(nonce, crypt->index++, final);
+        for (int i = 0; i < 4; i++) {
+            at[i] = (length >> (24 - 8 * i)) & 0xFF;
+        }
+        aead_encrypt(at + 4, at + 4 + len, in, len, crypt->aad, CONTAINER_HEADER_SIZE, crypt->key,
+            nonce);
+        *out_len += 4 + len + AEAD_TAG_SIZE;
+        stats_end(STAGE_CIPHER, timer);
+        return;
+    }
+
+    *out_len += rsa_ctx_encrypt_blocks(ctx, at, in, len, crypt->format);
+    return;
+}
+
+// Encrypts len bytes of plaintext at in into out, which has room for out_cap bytes
+// Whole blocks or records are encrypted straight out of in, the rest waits in pending
+// Sets *out_len to the bytes written, out_cap must be at least rsa_encrypt_bound(crypt, len)
+// Returns false if the stream has failed
+bool rsa_encrypt_update(
+    rsa_crypt *crypt, uint8_t *out, size_t out_cap, size_t *out_len, uint8_t *in, size_t len) {
+    uint8_t *data;
+
+    *out_len = 0;
+    if (crypt->failed == false && crypt->stage == RSA_CRYPT_HEADER) {
+        rsa_encrypt_start(crypt, out, out_cap, out_len);
+    }
+    while (crypt->failed == false && crypt->stage == RSA_CRYPT_DATA) {
+        size_t want = rsa_crypt_unit(crypt);
+        if (crypt->format != RSA_FORMAT_HYBRID) {
+            want = rsa_crypt_group(crypt, want, len);
+        }
+        if ((data = rsa_crypt_take(crypt, &in, &len, want)) == NULL) {
+            break;
+        }
+        rsa_encrypt_unit(crypt, out, out_cap, out_len, data, want, false);
+    }
+    return crypt->failed == false;
+}
+
+// Encrypts what is left in pending and writes the footer
+// Sets *out_len to the bytes written, out_cap must be at least rsa_encrypt_bound(crypt, 0)
+// Returns false if the stream has failed
+bool rsa_encrypt_final(rsa_crypt *crypt, uint8_t *out, size_t out_cap, size_t *out_len) {
+    uint8_t *at;
+
+    *out_len = 0;
+    if (crypt->failed == false && crypt->stage == RSA_CRYPT_HEADER) { // Empty input still gets one
+        rsa_encrypt_start(crypt, out, out_cap, out_len);
+    }
+    if (crypt->failed == true || crypt->stage == RSA_CRYPT_DONE) {
+        return crypt->failed == false;
+    }
+    if (crypt->pending_len > 0 || crypt->format == RSA_FORMAT_HYBRID) { // Hybrid always ends on one
+        rsa_encrypt_unit(crypt, out, out_cap, out_len, crypt->pending, crypt->pending_len, true);
+        crypt->pending_len = 0;
+    }
+    if (crypt->format != RSA_FORMAT_HEX
+        && (at = rsa_crypt_room(crypt, out, out_cap, out_len, CONTAINER_FOOTER_SIZE)) != NULL) {
+        container_pack_footer(crypt->total, at);
+        *out_len += CONTAINER_FOOTER_SIZE;
+    }
+    crypt->stage = RSA_CRYPT_DONE;
+    return crypt->failed == false;
+}
+
+// Sets up an incremental decryption under a private key context
+// format is RSA_FORMAT_HEX for hex lines or RSA_FORMAT_BIN for either kind of binary container
+// Returns false if n is too small to have encrypted anything
+bool rsa_decrypt_init(rsa_crypt *crypt, rsa_key_ctx *ctx, rsa_format format) {
+    memset(crypt, 0, sizeof(rsa_crypt));
+    crypt->ctx = ctx;
+    crypt->format = format;
+    crypt->failed = ctx->k < 2;
+    if (crypt->failed == true) {
+        return false;
+    }
+    if (format == RSA_FORMAT_HEX) { // A line of up to 2 * width digits
+        crypt->pending_cap = 2 * ctx->width;
+        crypt->stage = RSA_CRYPT_DATA;
+    } else { // The largest unit of a container is a record, or a block with a very large n
+        crypt->pending_cap = CONTAINER_RECORD_SIZE + AEAD_TAG_SIZE;
+        crypt->pending_cap = ctx->width > crypt->pending_cap ? ctx->width : crypt->pending_cap;
+    }
+    crypt->pending = (uint8_t *) malloc(crypt->pending_cap);
+    return true;
+}
+
+// Returns how much output space a decrypt update of len bytes, or a decrypt final, can need
+// Nothing encrypt writes decrypts to more than its own size, k covers a block finished from pending
+size_t rsa_decrypt_bound(rsa_crypt *crypt, size_t len) {
+    return crypt->failed == true ? 0 : crypt->pending_len + len + crypt->ctx->k;
+}
+
+// Decrypts the hex lines imported into ctx->lanes_in as one group and writes their plaintext out
+static void rsa_decrypt_group(rsa_crypt *crypt, uint8_t *out, size_t out_cap, size_t *out_len) {
+    rsa_key_ctx *ctx = crypt->ctx;
+
+    rsa_ctx_pow_many(ctx, ctx->lanes_out, ctx->lanes_in, crypt->lines);
+    for (size_t i = 0; i < crypt->lines; i++) {
+        rsa_crypt_emit(crypt, out, out_cap, out_len, rsa_ctx_export_plain(ctx, ctx->lanes_out[i]));
+    }
+    crypt->lines = 0;
+    return;
+}
+
+// Imports the hex line in pending into the group, blank lines are skipped like gmp_fscanf does
+// A full group is decrypted right away
+static void rsa_decrypt_line(rsa_crypt *crypt, uint8_t *out, size_t out_cap, size_t *out_len) {
+    rsa_key_ctx *ctx = crypt->ctx;
+    uint64_t timer = stats_begin();
+
+    if (crypt->pending_len == 0) {
+        return;
+    }
+    size_t len = crypt->pending_len;
+    crypt->pending_len = 0;
+    if (hex_decode(ctx->lanes_in[crypt->lines], (char *) crypt->pending, len) == false) {
+        crypt->failed = true; // Stop at the first bad line, the lines before it are still written
+        return;
+    }
+    stats_end(STAGE_IMPORT, timer);
+    if (++crypt->lines == MBEXP_LANES) {
+        rsa_decrypt_group(crypt, out, out_cap, out_len);
+    }
+    return;
+}
+
+// Splits len bytes of hex ciphertext into lines, and decrypts every line that is complete
+// Lines are gathered in pending, so one split across calls is still decoded whole
+static void rsa_decrypt_lines(
+    rsa_crypt *crypt, uint8_t *out, size_t out_cap, size_t *out_len, uint8_t *in, size_t len) {
+    while (crypt->failed == false && len > 0) {
+        uint8_t *newline = (uint8_t *) memchr(in, '\n', len);
+        size_t n = newline != NULL ? (size_t) (newline - in) : len;
+        if (crypt->pending_len + n > crypt->pending_cap) { // Longer than any ciphertext under n
+            crypt->failed = true;
+            break;
+        }
+        memcpy(crypt->pending + crypt->pending_len, in, n);
+        crypt->pending_len += n;
+        if (newline == NULL) {
+            break;
+        }
+        in += n + 1;
+        len -= n + 1;
+        rsa_decrypt_line(crypt, out, out_cap, out_len);
+    }
+    rsa_decrypt_group(crypt, out, out_cap, out_len); // Nothing is held back for the next call
+    return;
+}
+
+// Checks the container header at data against the key and picks the stage that follows it
+static void rsa_decrypt_header(rsa_crypt *crypt, uint8_t *data) {
+    container_header header;
+    container_header expected;
+
+    rsa_ctx_header(crypt->ctx, &expected);
+    if (container_parse_header(&header, data) == false || header.k != expected.k
+        || header.width != expected.width || header.fingerprint != expected.fingerprint) {
+        crypt->failed = true;
+    } else if (header.mode == CONTAINER_MODE_HYBRID) {
+        crypt->format = RSA_FORMAT_HYBRID;
+        crypt->stage = RSA_CRYPT_KEY;
+    } else if (header.mode == CONTAINER_MODE_BLOCKS && expected.width > CONTAINER_FOOTER_SIZE) {
+        crypt->stage = RSA_CRYPT_DATA;
+    } else {
+        crypt->failed = true;
+    }
+    memcpy(crypt->aad, data, CONTAINER_HEADER_SIZE);
+    return;
+}
+
+// Unwraps the next piece of the hybrid session key from the block at data
+static void rsa_decrypt_key(rsa_crypt *crypt, uint8_t *data) {
+    size_t piece = crypt->ctx->k - 1;
+    size_t at = crypt->index * piece;
+    size_t len = AEAD_KEY_SIZE - at < piece ? AEAD_KEY_SIZE - at : piece;
+
+    size_t got = 0;
+
+    if (rsa_ctx_decrypt_block(crypt->ctx, data, &got) == false || got != len) {
+        crypt->failed = true;
+        return;
+    }
+    memcpy(crypt->key + at, &crypt->ctx->buffer[1], len);
+    crypt->index++;
+    if (at + len == AEAD_KEY_SIZE) {
+        crypt->index = 0;
+        crypt->stage = RSA_CRYPT_DATA;
+    }
+    return;
+}
+
+// Reads the length in front of a hybrid record
+static void rsa_decrypt_length(rsa_crypt *crypt, uint8_t *data) {
+    uint32_t length = 0;
+
+    for (int i = 0; i < 4; i++) {
+        length = (length << 8) | data[i];
+    }
+    crypt->final = (length & CONTAINER_RECORD_FINAL) != 0;
+    crypt->record = length & ~CONTAINER_RECORD_FINAL;
+    crypt->failed = crypt->record > CONTAINER_RECORD_SIZE;
+    crypt->stage = RSA_CRYPT_RECORD;
+    return;
+}
+
+// Checks the tag of the hybrid record at data and only then decrypts it into the output
+static void rsa_decrypt_record(
+    rsa_crypt *crypt, uint8_t *out, size_t out_cap, size_t *out_len, uint8_t *data) {
+    uint8_t nonce[AEAD_NONCE_SIZE];
+    uint8_t *at = rsa_crypt_room(crypt, out, out_cap, out_len, crypt->record);
+    uint64_t timer = stats_begin();
+
+    if (at == NULL) {
+        return;
+    }
+    rsa_hybrid_nonce(nonce, crypt->index++, crypt->final);
+    if (aead_decrypt(at, data, crypt->record, data + crypt->record, crypt->aad,
+            CONTAINER_HEADER_SIZE, crypt->key, nonce)
+        == false) {
+        crypt->failed = true;
+        return;
+    }
+    *out_len += crypt->record;
+    crypt->total += crypt->record;
+    crypt->stage = crypt->final == true ? RSA_CRYPT_FOOTER : RSA_CRYPT_DATA;
+    stats_end(STAGE_CIPHER, timer);
+    return;
+}
+
+// Checks the footer at data against the plaintext length produced
+static void rsa_decrypt_footer(rsa_crypt *crypt, uint8_t *data) {
+    uint64_t length = 0;
+
+    crypt->failed = container_parse_footer(&length, data) == false || length != crypt->total;
+    crypt->stage = RSA_CRYPT_DONE;
+    return;
+}
+
+// Decrypts count blocks at data as one group and writes their plaintext out
+static void rsa_decrypt_blocks(rsa_crypt *crypt, uint8_t *out, size_t out_cap, size_t *out_len,
+    uint8_t *data, size_t count) {
+    uint8_t *at = rsa_crypt_room(crypt, out, out_cap, out_len, count * crypt->ctx->k);
+
+    if (at != NULL) {
+        size_t written = 0;
+        crypt->failed = rsa_ctx_decrypt_blocks(crypt->ctx, at, data, count, &written) == false;
+        *out_len += written;
+        crypt->total += written;
+    }
+    return;
+}
+
+// Returns the input bytes the next step of a binary container needs, with len bytes in the span
+static size_t rsa_decrypt_want(rsa_crypt *crypt, size_t len) {
+    switch (crypt->stage) {
+    case RSA_CRYPT_HEADER: return CONTAINER_HEADER_SIZE;
+    case RSA_CRYPT_KEY: return crypt->ctx->width;
+    case RSA_CRYPT_DATA:
+        return crypt->format == RSA_FORMAT_HYBRID ? 4
+                                                  : rsa_crypt_group(crypt, crypt->ctx->width, len);
+    case RSA_CRYPT_RECORD: return crypt->record + AEAD_TAG_SIZE;
+    default: return CONTAINER_FOOTER_SIZE;
+    }
+}
+
+// Decrypts len bytes of ciphertext at in into out, which has room for out_cap bytes
+// Whole blocks and records are decrypted straight out of in, the rest waits in pending
+// Hybrid records are only written out once their tag has checked out
+// Sets *out_len to the bytes written, out_cap must be at least rsa_decrypt_bound(crypt, len)
+// Returns false once the input has turned out malformed or made for another key
+bool rsa_decrypt_update(
+    rsa_crypt *crypt, uint8_t *out, size_t out_cap, size_t *out_len, uint8_t *in, size_t len) {
+    uint8_t *data;
+
+    *out_len = 0;
+    if (crypt->format == RSA_FORMAT_HEX) {
+        rsa_decrypt_lines(crypt, out, out_cap, out_len, in, len);
+        return crypt->failed == false;
+    }
+    crypt->failed = crypt->failed == true || (crypt->stage == RSA_CRYPT_DONE && len > 0);
+    while (crypt->failed == false && crypt->stage != RSA_CRYPT_DONE) {
+        size_t want = rsa_decrypt_want(crypt, len);
+        if ((data = rsa_crypt_take(crypt, &in, &len, want)) == NULL) {
+            break;
+        }
+        switch (crypt->stage) {
+        case RSA_CRYPT_HEADER: rsa_decrypt_header(crypt, data); break;
+        case RSA_CRYPT_KEY: rsa_decrypt_key(crypt, data); break;
+        case RSA_CRYPT_RECORD: rsa_decrypt_record(crypt, out, out_cap, out_len, data); break;
+        case RSA_CRYPT_FOOTER: rsa_decrypt_footer(crypt, data); break;
+        default:
+            if (crypt->format == RSA_FORMAT_HYBRID) {
+                rsa_decrypt_length(crypt, data);
+            } else { // Blocks are wider than the footer, which stays in pending until final
+                rsa_decrypt_blocks(crypt, out, out_cap, out_len, data, want / crypt->ctx->width);
+            }
+        }
+        crypt->failed = crypt->failed == true || (crypt->stage == RSA_CRYPT_DONE && len > 0);
+    }
+    return crypt->failed == false;
+}
+
+// Finishes a decryption, a hex line without a newline is decrypted here
+// Sets *out_len to the bytes written, out_cap must be at least rsa_decrypt_bound(crypt, 0)
+// Returns false if the input was malformed, truncated, or made for another key
+bool rsa_decrypt_final(rsa_crypt *crypt, uint8_t *out, size_t out_cap, size_t *out_len) {
+    *out_len = 0;
+    if (crypt->failed == false && crypt->format == RSA_FORMAT_HEX) {
+        rsa_decrypt_line(crypt, out, out_cap, out_len);
+        rsa_decrypt_group(crypt, out, out_cap, out_len);
+    } else if (crypt->failed == false && crypt->format == RSA_FORMAT_BIN) { // The footer is pending
+        crypt->failed
+            = crypt->stage != RSA_CRYPT_DATA || crypt->pending_len != CONTAINER_FOOTER_SIZE;
+        if (crypt->failed == false) {
+            rsa_decrypt_footer(crypt, crypt->pending);
+        }
+    } else if (crypt->failed == false) {
+        crypt->failed = crypt->stage != RSA_CRYPT_DONE;
+    }
+    crypt->pending_len = 0;
+    crypt->stage = RSA_CRYPT_DONE;
+    return crypt->failed == false;
+}
+
+// Frees pending and wipes the session key
+void rsa_crypt_clear(rsa_crypt *crypt) {
+    free(crypt->pending);
+    memset(crypt, 0, sizeof(rsa_crypt));
+    return;
+}
+
+// Bytes of input the file functions hand to the incremental functions at a time
+#define RSA_CRYPT_CHUNK (1 << 18)
+
+// Runs infile through the incremental functions into outfile
+// header is a container header already read from infile that is fed in first, or NULL
+// Returns false if the key doesn't fit the format or the input didn't decrypt
+static bool rsa_ctx_file_crypt(rsa_key_ctx *ctx, FILE *infile, FILE *outfile, bool encrypt,
+    rsa_format format, uint8_t *header) {
+    rsa_crypt crypt;
+    fileio_reader reader;
+    fileio_writer writer;
+    uint8_t *data = header;
+    size_t got = header != NULL ? CONTAINER_HEADER_SIZE : 0;
+    size_t chunk = RSA_CRYPT_CHUNK;
+    size_t cap;
+    size_t len = 0;
+    bool ok;
+    uint64_t timer;
+
+    ok = encrypt == true ? rsa_encrypt_init(&crypt, ctx, format)
+                         : rsa_decrypt_init(&crypt, ctx, format);
+    fileio_reader_init(&reader, infile);
+    fileio_writer_init(&writer, outfile);
+    while (encrypt == true && ok == true && rsa_encrypt_bound(&crypt, chunk) > FILEIO_BUFFER_SIZE) {
+        chunk /= 2; // Tiny keys make hex output many times larger than the input
+    }
+
+    timer = stats_begin();
+    while (ok == true && (got > 0 || (got = fileio_read(&reader, &data, chunk)) > 0)) {
+        stats_end(STAGE_READ, timer);
+        cap = encrypt == true ? rsa_encrypt_bound(&crypt, got) : rsa_decrypt_bound(&crypt, got);
+        timer = stats_begin();
+        uint8_t *out = fileio_reserve(&writer, cap);
+        stats_end(STAGE_WRITE, timer);
+        ok = encrypt == true ? rsa_encrypt_update(&crypt, out, cap, &len, data, got)
+                             : rsa_decrypt_update(&crypt, out, cap, &len, data, got);
+        fileio_commit(&writer, len);
+        got = 0;
+        timer = stats_begin();
+    }
+    if (ok == true) {
+        cap = encrypt == true ? rsa_encrypt_bound(&crypt, 0) : rsa_decrypt_bound(&crypt, 0);
+        uint8_t *out = fileio_reserve(&writer, cap);
+        ok = encrypt == true ? rsa_encrypt_final(&crypt, out, cap, &len)
+                             : rsa_decrypt_final(&crypt, out, cap, &len);
+        fileio_commit(&writer, len);
+    }
+
+    rsa_crypt_clear(&crypt);
+    rsa_ctx_file_done(ctx, &reader, &writer, header != NULL ? CONTAINER_HEADER_SIZE : 0, 0);
+    return ok;
+}
+
+// Encrypts the specified infile to the specified outfile under a public key context
+// Same block layout and output as rsa_encrypt_file, blocks are imported straight out of the input
+void rsa_ctx_encrypt_file(rsa_key_ctx *ctx, FILE *infile, FILE *outfile) {
+    rsa_ctx_file_crypt(ctx, infile, outfile, true, RSA_FORMAT_HEX, NULL);
+    return;
+}
+
+// Decrypts the specified infile to the specified outfile under a private key context
+// Same output as rsa_decrypt_file, stops at the first line that isn't a hex number
+// Returns false if it stopped at such a line, the lines before it are still written
+bool rsa_ctx_decrypt_file(rsa_key_ctx *ctx, FILE *infile, FILE *outfile) {
+    return rsa_ctx_file_crypt(ctx, infile, outfile, false, RSA_FORMAT_HEX, NULL);
+}
+
+// Encrypts the specified infile into a binary container written to outfile
+// Blocks are imported straight out of the input and exported straight into the output buffer
+// Returns false if n is too small for the container, blocks must be wider than the footer
+bool rsa_ctx_encrypt_file_bin(rsa_key_ctx *ctx, FILE *infile, FILE *outfile) {
+    return rsa_ctx_file_crypt(ctx, infile, outfile, true, RSA_FORMAT_BIN, NULL);
+}
+
+// Encrypts infile into a hybrid container written to outfile
+// Only a random AEAD key goes through RSA, the data is sealed with ChaCha20-Poly1305 in records
+// Returns false if n is too small for a block or no random key could be drawn
+bool rsa_ctx_encrypt_file_hybrid(rsa_key_ctx *ctx, FILE *infile, FILE *outfile) {
+    return rsa_ctx_file_crypt(ctx, infile, outfile, true, RSA_FORMAT_HYBRID, NULL);
+}
+
+// Decrypts a binary container of either mode from infile and writes the plaintext to outfile
+// Returns false if the container was made for another key, is truncated, or is corrupt
+bool rsa_ctx_decrypt_file_bin(rsa_key_ctx *ctx, FILE *infile, FILE *outfile) {
+    return rsa_ctx_file_crypt(ctx, infile, outfile, false, RSA_FORMAT_BIN, NULL);
+}
+
+// Decrypts only the plaintext bytes [offset, offset + length) of a binary container
+// infile must be seekable, only the blocks covering the range are read and decrypted
+// Returns false if the container doesn't match the key, is hybrid, or can't be seeked
+bool rsa_ctx_decrypt_range(
+    rsa_key_ctx *ctx, FILE *infile, FILE *outfile, uint64_t offset, uint64_t length) {
+    container_header header;
+    uint64_t total;
+    uint64_t payload = ctx->k - 1; // Plaintext bytes per block
+    uint64_t end;
+    bool ok = true;
+    uint8_t *block;
+
+    if (ctx->width <= CONTAINER_FOOTER_SIZE || rsa_ctx_check_header(ctx, infile, &header) == false
+        || header.mode != CONTAINER_MODE_BLOCKS) {
+        return false;
+    }
+    if (container_read_footer(&total, infile) == false) {
+        return false;
+    }
+    if (offset >= total || length == 0) { // Nothing to decrypt
+        return true;
+    }
+    end = length > total - offset ? total : offset + length;
+
+    uint64_t first = offset / payload;
+    uint64_t last = (end - 1) / payload;
+    if (fseeko(infile, CONTAINER_HEADER_SIZE + first * ctx->width, SEEK_SET) != 0) {
+        return false;
+    }
+
+    block = (uint8_t *) malloc(ctx->width);
+    ctx->bytes_read = 0;
+    ctx->bytes_written = 0;
+    for (uint64_t i = first; i <= last; i++) {
+        if (fread(block, sizeof(uint8_t), ctx->width, infile) != ctx->width) {
+            ok = false;
+            break;
+        }
+        size_t j = 0;
+        if (rsa_ctx_decrypt_block(ctx, block, &j) == false) {
+            ok = false;
+            break;
+        }
+        uint64_t start = i * payload; // Plaintext offset of this block
+        uint64_t from = offset > start ? offset - start : 0;
+        uint64_t to = end - start < j ? end - start : j;
+        if (to > from) {
+            fwrite(&ctx->buffer[1 + from], sizeof(uint8_t), to - from, outfile);
+            ctx->bytes_written += to - from;
+        }
+        ctx->bytes_read += ctx->width;
+    }
+
+    free(block);
+    return ok;
+}
+
+// Blocks handed to a worker at a time by the threaded file functions
+#define RSA_BATCH_BLOCKS 64
+
+// Batches in flight per worker thread, bounds memory no matter how large the input is
+#define RSA_BATCH_SLOTS 4
+
+// State shared by the reader and writer callbacks of the threaded file functions
+typedef struct {
+    fileio_reader reader;
+    fileio_writer writer;
+    size_t width; // Ciphertext block width, for reading binary containers
+    uint8_t *line; // Ciphertext line that didn't fit in the last batch, NULL if there is none
+    size_t line_len;
+    bool stop; // A malformed block was seen, nothing after it is written
+    uint64_t total; // Plaintext bytes read or written so far
+    bool footer; // The footer of a binary container has been read into footer_bytes
+    uint8_t footer_bytes[CONTAINER_FOOTER_SIZE];
+} rsa_stream;
+
+// Hands the batch the next in_cap bytes of input, pointing into the mapping when there is one
+// Streamed input is copied since the reader reuses its buffer on the next call
+static size_t rsa_stream_read(rsa_stream *stream, pipeline_batch *batch) {
+    uint8_t *data;
+    size_t got = fileio_read(&stream->reader, &data, batch->in_cap);
+
+    if (fileio_mapped(&stream->reader) == true) {
+        batch->in = data;
+    } else {
+        memcpy(batch->in, data, got);
+    }
+    return got;
+}
+
+// Reader for encryption, fills the batch with whole blocks of k - 1 bytes of plaintext
+static bool rsa_read_plain(void *arg, pipeline_batch *batch) {
+    rsa_stream *stream = (rsa_stream *) arg;
+
+    batch->in_len = rsa_stream_read(stream, batch);
+    stream->total += batch->in_len;
+    return batch->in_len == batch->in_cap;
+}
+
+// Worker for encryption, same blocks as rsa_ctx_encrypt_file and rsa_ctx_encrypt_file_bin
+// format picks between hex lines and fixed-width binary blocks
+static void rsa_work_encrypt(rsa_key_ctx *ctx, pipeline_batch *batch, rsa_format format) {
+    size_t group = MBEXP_LANES * (ctx->k - 1); // Plaintext bytes exponentiated together
+
+    for (size_t i = 0; i < batch->in_len; i += group) {
+        size_t len = batch->in_len - i < group ? batch->in_len - i : group;
+        batch->out_len += rsa_ctx_encrypt_blocks(
+            ctx, batch->out + batch->out_len, batch->in + i, len, format);
+    }
+    return;
+}
+
+// Worker for encryption to hex lines
+static void rsa_work_encrypt_hex(void *worker, pipeline_batch *batch) {
+    rsa_work_encrypt((rsa_key_ctx *) worker, batch, RSA_FORMAT_HEX);
+    return;
+}
+
+// Worker for encryption to a binary container
+static void rsa_work_encrypt_bin(void *worker, pipeline_batch *batch) {
+    rsa_work_encrypt((rsa_key_ctx *) worker, batch, RSA_FORMAT_BIN);
+    return;
+}
+
+// Reader for decryption, fills the batch with up to RSA_BATCH_BLOCKS ciphertext lines
+// Lines are copied, since the next read may reuse the buffer they came from
+static bool rsa_read_cipher(void *arg, pipeline_batch *batch) {
+    rsa_stream *stream = (rsa_stream *) arg;
+    size_t lines = 0;
+    uint8_t *line;
+    size_t len;
+
+    while (lines < RSA_BATCH_BLOCKS) {
+        if (stream->line == NULL) {
+            if (fileio_read_line(&stream->reader, &line, &len) == false) {
+                return false;
+            }
+        } else {
+            line = stream->line;
+            len = stream->line_len;
+            stream->line = NULL;
+        }
+
+        if (batch->in_len + len + 1 > batch->in_cap) {
+            if (batch->in_len > 0) { // Save the line for the next batch
+                stream->line = line;
+                stream->line_len = len;
+                return true;
+            }
+            batch->in_cap = len + 1; // A single overlong line gets a batch of its own
+            batch->in_buf = (uint8_t *) realloc(batch->in_buf, batch->in_cap);
+            batch->in = batch->in_buf;
+        }
+        memcpy(batch->in + batch->in_len, line, len);
+        batch->in_len += len;
+        batch->in[batch->in_len++] = '\n';
+        lines += 1;
+    }
+    return true;
+}
+
+// Reader for decryption of a binary container, fills the batch with whole fixed-width blocks
+// Blocks start on multiples of width, so the footer always ends up whole in the last batch
+static bool rsa_read_blocks(void *arg, pipeline_batch *batch) {
+    rsa_stream *stream = (rsa_stream *) arg;
+    size_t got = rsa_stream_read(stream, batch);
+    size_t rest = got % stream->width;
+
+    batch->in_len = got - rest;
+    if (rest == CONTAINER_FOOTER_SIZE) {
+        memcpy(stream->footer_bytes, batch->in + batch->in_len, CONTAINER_FOOTER_SIZE);
+        stream->footer = true;
+    }
+    return got == batch->in_cap;
+}
+
+// Worker for decryption of hex lines, same output as rsa_ctx_decrypt_file
+// Lines are imported MBEXP_LANES at a time and decrypted as a group
+static void rsa_work_decrypt_hex(void *worker, pipeline_batch *batch) {
+    rsa_key_ctx *ctx = (rsa_key_ctx *) worker;
+    char *line = (char *) batch->in;
+    char *end = line + batch->in_len;
+
+    while (line < end && batch->failed == false) {
+        size_t count = 0;
+        uint64_t timer = stats_begin();
+        while (line < end && count < MBEXP_LANES) {
+            char *text = line;
+            char *newline = memchr(line, '\n', end - line);
+            line = newline + 1;
+            if (newline == text) { // gmp_fscanf skips blank lines, so do the same
+                continue;
+            }
+            if (hex_decode(ctx->lanes_in[count], text, newline - text) == false) {
+                batch->failed = true; // The lines before the bad one are still written
+                break;
+            }
+            count += 1;
+        }
+        stats_end(STAGE_IMPORT, timer);
+
+        rsa_ctx_pow_many(ctx, ctx->lanes_out, ctx->lanes_in, count);
+        for (size_t i = 0; i < count; i++) {
+            size_t j = rsa_ctx_export_plain(ctx, ctx->lanes_out[i]);
+            memcpy(batch->out + batch->out_len, &ctx->buffer[1], j);
+            batch->out_len += j;
+        }
+    }
+    return;
+}
+
+// Worker for decryption of binary blocks, same output as rsa_ctx_decrypt_file_bin
+static void rsa_work_decrypt_bin(void *worker, pipeline_batch *batch) {
+    rsa_key_ctx *ctx = (rsa_key_ctx *) worker;
+    size_t blocks = batch->in_len / ctx->width;
+
+    for (size_t i = 0; i < blocks && batch->failed == false; i += MBEXP_LANES) {
+        size_t count = blocks - i < MBEXP_LANES ? blocks - i : MBEXP_LANES;
+        size_t written = 0;
+        uint8_t *in = batch->in + i * ctx->width;
+        if (rsa_ctx_decrypt_blocks(ctx, batch->out + batch->out_len, in, count, &written) == false) {
+            batch->failed = true; // The blocks before the bad one are still written
+        }
+        batch->out_len += written;
+    }
+    return;
+}
+
+// Writer shared by both directions, writes batches in order until a malformed one
+static void rsa_write_batch(void *arg, pipeline_batch *batch) {
+    rsa_stream *stream = (rsa_stream *) arg;
+
+    if (stream->stop == true) {
+        return;
+    }
+    fileio_write(&stream->writer, batch->out, batch->out_len);
+    stream->total += batch->out_len;
+    if (batch->failed == true) {
+        stream->stop = true;
+    }
+    return;
+}
+
+// Runs the threaded pipeline for one direction and format with a key context per worker
+// Returns false if the input was malformed or the container doesn't belong to this key
+static bool rsa_ctx_file_threads(rsa_key_ctx *ctx, FILE *infile, FILE *outfile, int threads,
+    bool encrypt, rsa_format format) {
+    rsa_key_ctx *contexts;
+    void **workers;
+    rsa_stream in = { .width = ctx->width };
+    rsa_stream out = { .width = ctx->width };
+    size_t width = ctx->width;
+    container_header header;
+    uint64_t length = 0;
+    bool ok = true;
+    pipeline_config config;
+
+    if (encrypt == true && format == RSA_FORMAT_HYBRID) { // Already fast enough on one thread
+        return rsa_ctx_encrypt_file_hybrid(ctx, infile, outfile);
+    }
+    if (format == RSA_FORMAT_BIN) {
+        if (encrypt == false && rsa_ctx_check_header(ctx, infile, &header) == false) {
+            return false;
+        } else if (encrypt == false && header.mode == CONTAINER_MODE_HYBRID) { // Fast on one thread
+            uint8_t packed[CONTAINER_HEADER_SIZE];
+            container_pack_header(&header, packed);
+            return rsa_ctx_file_crypt(ctx, infile, outfile, false, RSA_FORMAT_BIN, packed);
+        }
+        if (width <= CONTAINER_FOOTER_SIZE) { // Hybrid containers have no such limit
+            return false;
+        }
+        if (encrypt == true) {
+            rsa_ctx_header(ctx, &header);
+            container_write_header(&header, outfile);
+        }
+    }
+
+    contexts = (rsa_key_ctx *) calloc(threads, sizeof(rsa_key_ctx));
+    workers = (void **) calloc(threads, sizeof(void *));
+    for (int i = 0; i < threads; i++) {
+        rsa_ctx_copy(&contexts[i], ctx);
+        workers[i] = &contexts[i];
+    }
+
+    config.threads = threads;
+    config.slots = RSA_BATCH_SLOTS * threads;
+    config.workers = workers;
+    config.read_arg = &in;
+    config.write = rsa_write_batch;
+    config.write_arg = &out;
+    if (encrypt == true) { // k - 1 plaintext bytes become at most 2 * width hex digits and a newline
+        config.in_cap = RSA_BATCH_BLOCKS * (ctx->k - 1);
+        config.out_cap = RSA_BATCH_BLOCKS * (2 * width + 1) + 1;
+        config.read = rsa_read_plain;
+        config.work = format == RSA_FORMAT_BIN ? rsa_work_encrypt_bin : rsa_work_encrypt_hex;
+    } else if (format == RSA_FORMAT_BIN) { // Every block becomes at most width - 1 bytes
+        config.in_cap = RSA_BATCH_BLOCKS * width;
+        config.out_cap = RSA_BATCH_BLOCKS * width;
+        config.read = rsa_read_blocks;
+        config.work = rsa_work_decrypt_bin;
+    } else { // A hex line of up to 2 * width digits becomes at most width - 1 bytes
+        config.in_cap = RSA_BATCH_BLOCKS * (2 * width + 2);
+        config.out_cap = RSA_BATCH_BLOCKS * width;
+        config.read = rsa_read_cipher;
+        config.work = rsa_work_decrypt_hex;
+    }
+
+    fileio_reader_init(&in.reader, infile);
+    fileio_writer_init(&out.writer, outfile);
+    pipeline_run(&config);
+    fileio_flush(&out.writer);
+
+    if (format == RSA_FORMAT_BIN && encrypt == true) {
+        container_write_footer(in.total, outfile);
+    } else if (format == RSA_FORMAT_BIN) {
+        ok = in.footer == true && container_parse_footer(&length, in.footer_bytes)
+             && length == out.total;
+    } else if (encrypt == false) {
+        ok = out.stop == false;
+    }
+
+    ctx->bytes_read = in.reader.bytes;
+    ctx->bytes_written = out.writer.bytes;
+    if (format == RSA_FORMAT_BIN) {
+        ctx->bytes_read += encrypt == true ? 0 : CONTAINER_HEADER_SIZE;
+        ctx->bytes_written += encrypt == true ? CONTAINER_HEADER_SIZE + CONTAINER_FOOTER_SIZE : 0;
+    }
+    STATS_ADD(STAT_BYTES_READ, ctx->bytes_read);
+    STATS_ADD(STAT_BYTES_WRITTEN, ctx->bytes_written);
+    for (int i = 0; i < threads; i++) {
+        rsa_ctx_clear(&contexts[i]);
+    }
+    fileio_writer_clear(&out.writer);
+    fileio_reader_clear(&in.reader);
+    free(contexts);
+    free(workers);
+    return ok;
+}
+
+// Encrypts infile to outfile like rsa_ctx_encrypt_file or rsa_ctx_encrypt_file_bin
+// Spreads the blocks over threads workers, the reader thread and in-order writer keep the output
+// identical to the single threaded one
+// Returns false if n is too small for the binary container
+bool rsa_ctx_encrypt_file_threads(
+    rsa_key_ctx *ctx, FILE *infile, FILE *outfile, int threads, rsa_format format) {
+    return rsa_ctx_file_threads(ctx, infile, outfile, threads, true, format);
+}
+
+// Decrypts infile to outfile like rsa_ctx_decrypt_file or rsa_ctx_decrypt_file_bin
+// Spreads the blocks over threads workers, the reader thread and in-order writer keep the output
+// identical to the single threaded one
+// Returns false if the input is malformed or the container was made for another key
+bool rsa_ctx_decrypt_file_threads(
+    rsa_key_ctx *ctx, FILE *infile, FILE *outfile, int threads, rsa_format format) {
+    return rsa_ctx_file_threads(ctx, infile, outfile, threads, false, format);
+}
+
+// Random exponents in a batch screen have this many bits, a forged batch passes with odds 2^-64
+// unless its signatures are off by a factor of -1
+#define RSA_BATCH_EXPONENT_BITS 64
+
+// Rounds of the sign check after a batch screen, a negated signature passes each with odds 1/2
+#define RSA_BATCH_SIGN_ROUNDS 64
+
+// Ranges of at most this many pairs are verified one at a time instead of bisected further, the
+// sign rounds alone cost as many exponentiations by e
+#define RSA_BATCH_MIN RSA_BATCH_SIGN_ROUNDS
+
+// Turns a message of len bytes into a number for signing, with the 0xFF prefix the file blocks use
+// Returns false if the message is longer than the k - 1 bytes that fit below n
+bool rsa_import_message(mpz_t m, uint8_t *msg, size_t len, size_t k) {
+    if (len > k - 1) {
+        return false;
+    }
+    mpz_import(m, len, 1, sizeof(uint8_t), 1, 0, msg);
+    for (size_t i = 0; i < 8; i++) { // Same number as importing 0xFF followed by the message
+        mpz_setbit(m, 8 * len + i);
+    }
+    return true;
+}
+
+// Signs count messages under one private key context, s[i] = m[i]^d (mod n)
+// The context's Montgomery constants and exponent recoding are shared by every message
+void rsa_sign_batch(mpz_t s[], mpz_t m[], size_t count, rsa_key_ctx *ctx) {
+    rsa_ctx_pow_many(ctx, s, m, count); // Groups of messages share the SIMD lanes
+    return;
+}
+
+// Verifies the pairs in [lo, hi) one at a time, skipping pairs already marked invalid
+static void rsa_verify_each(
+    bool valid[], mpz_t m[], mpz_t s[], size_t lo, size_t hi, rsa_key_ctx *ctx, mpz_t t) {
+    for (size_t i = lo; i < hi; i++) {
+        if (valid[i] == true) {
+            rsa_ctx_pow(ctx, t, s[i]); // Computes t = s^e (mod n)
+            valid[i] = mpz_cmp(t, m[i]) == 0;
+        }
+    }
+    return;
+}
+
+// Randomized batch screen of the pairs in [lo, hi) that are still marked valid
+// With random r[i], checks (prod s[i]^r[i])^e = prod m[i]^r[i] (mod n) using one exponentiation by e
+// This only screens: n - s[i] raises to -m[i], and the -1 cancels whenever the r[i] of the negated
+// pairs add up to an even number, so a range that passes still needs rsa_verify_sign
+// Each r[i] is recoded once into rec and used for both of its pair's powers, in the workspace ws
+static bool rsa_verify_screen(bool valid[], mpz_t m[], mpz_t s[], size_t lo, size_t hi,
+    rsa_key_ctx *ctx, mpz_t a, mpz_t b, mpz_t r, mpz_t t, mont_exp *rec, mont_ws *ws) {
+    mpz_set_ui(a, 1);
+    mpz_set_ui(b, 1);
+
+    for (size_t i = lo; i < hi; i++) {
+        if (valid[i] == false) {
+            continue;
+        }
+        do { // r = 0 would leave the pair out, its parity is left random
+            mpz_urandomb(r, state, RSA_BATCH_EXPONENT_BITS);
+        } while (mpz_sgn(r) == 0);
+
+        mont_exp_set(rec, r);
+        mont_ws_fit(ws, &ctx->mont_n, rec->window); // Grows only for the first pair
+        mont_pow_exp(t, s[i], rec, &ctx->mont_n, ws);
+        mpz_mul(a, a, t);
+        mpz_mod(a, a, ctx->n); // a = prod s[i]^r[i] (mod n)
+        mont_pow_exp(t, m[i], rec, &ctx->mont_n, ws);
+        mpz_mul(b, b, t);
+        mpz_mod(b, b, ctx->n); // b = prod m[i]^r[i] (mod n)
+    }
+
+    rsa_ctx_pow(ctx, t, a);
+    return mpz_cmp(t, b) == 0;
+}
+
+// Settles the sign of the pairs in [lo, hi) that passed rsa_verify_screen, so s[i]^e = +-m[i]
+// Each round checks (prod s[i])^e = prod m[i] (mod n) over a random subset of the pairs, which
+// fails with odds 1/2 however many signatures are negated, so a forged range passes every round
+// with odds 2^-RSA_BATCH_SIGN_ROUNDS
+static bool rsa_verify_sign(bool valid[], mpz_t m[], mpz_t s[], size_t lo, size_t hi,
+    rsa_key_ctx *ctx, mpz_t a, mpz_t b, mpz_t t) {
+    for (int round = 0; round < RSA_BATCH_SIGN_ROUNDS; round++) {
+        mpz_set_ui(a, 1);
+        mpz_set_ui(b, 1);
+        for (size_t i = lo; i < hi; i++) {
+            if (valid[i] == true && gmp_urandomb_ui(state, 1) == 1) {
+                mpz_mul(a, a, s[i]);
+                mpz_mod(a, a, ctx->n); // a = prod s[i] (mod n) over the subset
+                mpz_mul(b, b, m[i]);
+                mpz_mod(b, b, ctx->n);
+            }
+        }
+        rsa_ctx_pow(ctx, t, a);
+        if (mpz_cmp(t, b) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Verifies the pairs in [lo, hi) with one batch screen and the sign rounds, bisecting on failure
+// to find the bad pairs
+static void rsa_verify_range(bool valid[], mpz_t m[], mpz_t s[], size_t lo, size_t hi,
+    rsa_key_ctx *ctx, mpz_t a, mpz_t b, mpz_t r, mpz_t t, mont_exp *rec, mont_ws *ws) {
+    if (hi - lo <= RSA_BATCH_MIN) {
+        rsa_verify_each(valid, m, s, lo, hi, ctx, t);
+        return;
+    }
+    if (rsa_verify_screen(valid, m, s, lo, hi, ctx, a, b, r, t, rec, ws) == true
+        && rsa_verify_sign(valid, m, s, lo, hi, ctx, a, b, t) == true) {
+        return;
+    }
+    size_t mid = lo + (hi - lo) / 2;
+    rsa_verify_range(valid, m, s, lo, mid, ctx, a, b, r, t, rec, ws);
+    rsa_verify_range(valid, m, s, mid, hi, ctx, a, b, r, t, rec, ws);
+    return;
+}
+
+// Verifies count signatures under one public key context, valid[i] is set to rsa_verify's answer
+// Large exponents use a randomized batch check drawing from the global random state, a forged
+// signature slips through with odds about 2^-64
+// Returns true only if every signature verified
+bool rsa_verify_batch(bool valid[], mpz_t m[], mpz_t s[], size_t count, rsa_key_ctx *ctx) {
+    bool all = true;
+    mpz_t a, b, r, t;
+    mpz_inits(a, b, r, t, NULL);
+
+    for (size_t i = 0; i < count; i++) { // t = s^e (mod n) is below n, so m must be too
+        valid[i] = mpz_sgn(m[i]) >= 0 && mpz_cmp(m[i], ctx->n) < 0;
+    }
+
+    // The batch screen costs two exponentiations by r per pair, only worth it when e is larger
+    if (ctx->mont == true && ctx->crt == false
+        && mpz_sizeinbase(ctx->exponent, 2) > 2 * RSA_BATCH_EXPONENT_BITS) {
+        mont_exp rec; // Shared by every pair and range, so the screen allocates nothing per pair
+        mont_ws ws;
+        mont_exp_reserve(&rec, RSA_BATCH_EXPONENT_BITS);
+        mont_ws_init(&ws, &ctx->mont_n, 1);
+        rsa_verify_range(valid, m, s, 0, count, ctx, a, b, r, t, &rec, &ws);
+        mont_ws_clear(&ws);
+        mont_exp_clear(&rec);
+    } else {
+        rsa_verify_each(valid, m, s, 0, count, ctx, t);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        all = all && valid[i];
+    }
+    mpz_clears(a, b, r, t, NULL);
+    return all;
+}
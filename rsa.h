@@ -4,19 +4,130 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <gmp.h>
+#include "aead.h"
+#include "container.h"
+#include "mbexp.h"
+#include "mont.h"
+#include "numtheory.h"
+
+// Primes a multi-prime key (RFC 8017) can have past p and q
+#define RSA_EXTRA_PRIMES 2
+#define RSA_PRIMES_MAX (2 + RSA_EXTRA_PRIMES)
+
+// Ciphertext layouts written by the file functions, hex lines or the binary container in container.h
+// with RSA blocks or with RSA wrapping only the key of a ChaCha20-Poly1305 stream
+typedef enum { RSA_FORMAT_HEX, RSA_FORMAT_BIN, RSA_FORMAT_HYBRID } rsa_format;
+
+// Everything needed to run one RSA key over many blocks, built once per key
+// Holds either a single exponent over n (public key, or private key without CRT components)
+// or the two half-size exponents dp over p and dq over q (private key with CRT components)
+// A multi-prime key adds an exponent over each extra prime r_i, its residue joins the others by
+// Garner's formula like in RFC 8017
+typedef struct {
+    mpz_t n;
+    bool crt; // True if the p and q halves below are in use
+    bool mont; // False if n could not be put in Montgomery form, pow_mod is used instead
+    mpz_t exponent; // e or d, used when crt is false
+    mpz_t p, q, dp, dq, qinv;
+    mont_ctx mont_n, mont_p, mont_q; // Reduction constants for n, p and q
+    mont_exp exp_n, exp_p, exp_q; // Recoded e or d, dp and dq
+    mont_ws ws_n, ws_p, ws_q; // Scratch space for each of the exponentiations
+    numtheory_ws ws; // Scratch space for pow_mod_ws when mont is false
+    bool mb; // True if groups of blocks go through the SIMD lanes of mbexp.h
+    mbexp_ctx mb_n, mb_p, mb_q; // The exponentiations above, MBEXP_LANES bases at a time
+    mpz_t lanes_in[MBEXP_LANES], lanes_out[MBEXP_LANES]; // A group of blocks for the file paths
+    mpz_t lanes_p[MBEXP_LANES]; // p halves of a CRT group
+    size_t extra; // Primes past p and q, 0 for a two-prime key
+    mpz_t r[RSA_EXTRA_PRIMES], dr[RSA_EXTRA_PRIMES]; // Extra prime r_i and d mod (r_i - 1)
+    mpz_t tr[RSA_EXTRA_PRIMES]; // CRT coefficient (p q r_3 ... r_(i-1))^-1 mod r_i
+    mpz_t rprod[RSA_EXTRA_PRIMES]; // p q r_3 ... r_(i-1)
+    mont_ctx mont_r[RSA_EXTRA_PRIMES];
+    mont_exp exp_r[RSA_EXTRA_PRIMES];
+    mont_ws ws_r[RSA_EXTRA_PRIMES];
+    mbexp_ctx mb_r[RSA_EXTRA_PRIMES];
+    mpz_t mr[RSA_EXTRA_PRIMES]; // Residues modulo the extra primes of the current block
+    mpz_t lanes_r[RSA_EXTRA_PRIMES][MBEXP_LANES]; // Residues of a CRT group
+    size_t k; // Block size (log2(n) - 1) / 8
+    size_t width; // Bytes in a binary ciphertext block
+    uint8_t *buffer; // k + 1 bytes, one block of plaintext with room for a malformed block
+    mpz_t m, c; // Message and ciphertext of the current block in the file paths
+    mpz_t m1, m2; // Halves of the CRT path
+    uint64_t bytes_read, bytes_written; // Bytes moved by the last file function
+    bool verified; // Set once a signature has verified under this key
+    mpz_t verified_m, verified_s; // The message and signature that verified
+} rsa_key_ctx;
+
+// Where an incremental encryption or decryption is in its input
+typedef enum {
+    RSA_CRYPT_HEADER, // Nothing written or read yet
+    RSA_CRYPT_KEY, // Hybrid key blocks
+    RSA_CRYPT_DATA, // Plaintext, RSA blocks, hex lines, or hybrid record lengths
+    RSA_CRYPT_RECORD, // The ciphertext and tag of a hybrid record
+    RSA_CRYPT_FOOTER, // Decrypt has read the last hybrid record and wants the footer
+    RSA_CRYPT_DONE
+} rsa_crypt_stage;
+
+// State of an incremental encryption or decryption, see rsa_encrypt_init and rsa_decrypt_init
+// Input arrives in spans of any size, whatever doesn't make up a whole block, line, or record
+// yet is carried over in pending, which is allocated once by init
+typedef struct {
+    rsa_key_ctx *ctx;
+    rsa_format format; // Decrypt is given HEX or BIN, the container header may make it HYBRID
+    rsa_crypt_stage stage;
+    bool failed; // Malformed input or too little output space was seen, nothing more is produced
+    uint8_t *pending;
+    size_t pending_len;
+    size_t pending_cap;
+    size_t record; // Ciphertext bytes of the hybrid record being read
+    bool final; // The hybrid record being read is the last one
+    uint64_t index; // Hybrid records or key blocks handled so far
+    size_t lines; // Hex lines imported into ctx->lanes_in that wait to be decrypted as a group
+    uint64_t total; // Plaintext bytes consumed or produced so far
+    uint8_t aad[CONTAINER_HEADER_SIZE]; // Packed container header
+    uint8_t key[AEAD_KEY_SIZE]; // Hybrid session key
+} rsa_crypt;
 
 void rsa_make_pub(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters);
 
+void rsa_make_pub_threads(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters,
+    int threads, uint64_t seed);
+
+void rsa_make_pub_multi(mpz_t primes[], size_t count, mpz_t n, mpz_t e, uint64_t nbits,
+    uint64_t iters, int threads, uint64_t seed);
+
+void rsa_make_pub_many(mpz_t primes[], mpz_t n[], mpz_t e[], size_t count, size_t per_key,
+    uint64_t nbits, uint64_t iters, int threads, uint64_t seed);
+
+uint64_t rsa_pool_bits(uint64_t nbits);
+
+bool rsa_make_pub_pool(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, FILE *pool);
+
 void rsa_write_pub(mpz_t n, mpz_t e, mpz_t s, char username[], FILE *pbfile);
 
 void rsa_read_pub(mpz_t n, mpz_t e, mpz_t s, char username[], FILE *pbfile);
 
 void rsa_make_priv(mpz_t d, mpz_t e, mpz_t p, mpz_t q);
 
+void rsa_make_priv_multi(mpz_t d, mpz_t e, mpz_t primes[], size_t count);
+
 void rsa_write_priv(mpz_t n, mpz_t d, FILE *pvfile);
 
 void rsa_read_priv(mpz_t n, mpz_t d, FILE *pvfile);
 
+void rsa_make_crt(mpz_t dp, mpz_t dq, mpz_t qinv, mpz_t d, mpz_t p, mpz_t q);
+
+void rsa_write_priv_crt(
+    mpz_t n, mpz_t d, mpz_t p, mpz_t q, mpz_t dp, mpz_t dq, mpz_t qinv, FILE *pvfile);
+
+bool rsa_read_priv_crt(
+    mpz_t n, mpz_t d, mpz_t p, mpz_t q, mpz_t dp, mpz_t dq, mpz_t qinv, FILE *pvfile);
+
+void rsa_make_crt_extra(mpz_t dr[], mpz_t tr[], mpz_t d, mpz_t primes[], size_t count);
+
+void rsa_write_priv_extra(mpz_t r[], mpz_t dr[], mpz_t tr[], size_t extra, FILE *pvfile);
+
+size_t rsa_read_priv_extra(mpz_t r[], mpz_t dr[], mpz_t tr[], FILE *pvfile);
+
 void rsa_encrypt(mpz_t c, mpz_t m, mpz_t e, mpz_t n);
 
 void rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e);
@@ -25,6 +136,82 @@ void rsa_decrypt(mpz_t m, mpz_t c, mpz_t d, mpz_t n);
 
 void rsa_decrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t d);
 
+void rsa_decrypt_crt(mpz_t m, mpz_t c, mpz_t p, mpz_t q, mpz_t dp, mpz_t dq, mpz_t qinv);
+
+void rsa_decrypt_file_crt(FILE *infile, FILE *outfile, mpz_t n, mpz_t p, mpz_t q, mpz_t dp,
+    mpz_t dq, mpz_t qinv);
+
 void rsa_sign(mpz_t s, mpz_t m, mpz_t d, mpz_t n);
 
+void rsa_sign_crt(mpz_t s, mpz_t m, mpz_t p, mpz_t q, mpz_t dp, mpz_t dq, mpz_t qinv);
+
 bool rsa_verify(mpz_t m, mpz_t s, mpz_t e, mpz_t n);
+
+void rsa_ctx_init_pub(rsa_key_ctx *ctx, mpz_t n, mpz_t e);
+
+void rsa_ctx_init_priv(rsa_key_ctx *ctx, mpz_t n, mpz_t d);
+
+void rsa_ctx_init_crt(
+    rsa_key_ctx *ctx, mpz_t n, mpz_t p, mpz_t q, mpz_t dp, mpz_t dq, mpz_t qinv);
+
+void rsa_ctx_init_multi(rsa_key_ctx *ctx, mpz_t n, mpz_t p, mpz_t q, mpz_t dp, mpz_t dq,
+    mpz_t qinv, mpz_t r[], mpz_t dr[], mpz_t tr[], size_t extra);
+
+void rsa_ctx_copy(rsa_key_ctx *dst, rsa_key_ctx *src);
+
+void rsa_ctx_clear(rsa_key_ctx *ctx);
+
+void rsa_ctx_encrypt(rsa_key_ctx *ctx, mpz_t c, mpz_t m);
+
+void rsa_ctx_decrypt(rsa_key_ctx *ctx, mpz_t m, mpz_t c);
+
+void rsa_ctx_sign(rsa_key_ctx *ctx, mpz_t s, mpz_t m);
+
+bool rsa_ctx_verify(rsa_key_ctx *ctx, mpz_t m, mpz_t s);
+
+void rsa_ctx_encrypt_file(rsa_key_ctx *ctx, FILE *infile, FILE *outfile);
+
+bool rsa_ctx_decrypt_file(rsa_key_ctx *ctx, FILE *infile, FILE *outfile);
+
+bool rsa_encrypt_init(rsa_crypt *crypt, rsa_key_ctx *ctx, rsa_format format);
+
+size_t rsa_encrypt_bound(rsa_crypt *crypt, size_t len);
+
+bool rsa_encrypt_update(
+    rsa_crypt *crypt, uint8_t *out, size_t out_cap, size_t *out_len, uint8_t *in, size_t len);
+
+bool rsa_encrypt_final(rsa_crypt *crypt, uint8_t *out, size_t out_cap, size_t *out_len);
+
+bool rsa_decrypt_init(rsa_crypt *crypt, rsa_key_ctx *ctx, rsa_format format);
+
+size_t rsa_decrypt_bound(rsa_crypt *crypt, size_t len);
+
+bool rsa_decrypt_update(
+    rsa_crypt *crypt, uint8_t *out, size_t out_cap, size_t *out_len, uint8_t *in, size_t len);
+
+bool rsa_decrypt_final(rsa_crypt *crypt, uint8_t *out, size_t out_cap, size_t *out_len);
+
+void rsa_crypt_clear(rsa_crypt *crypt);
+
+rsa_format rsa_detect_format(FILE *infile);
+
+bool rsa_ctx_encrypt_file_bin(rsa_key_ctx *ctx, FILE *infile, FILE *outfile);
+
+bool rsa_ctx_decrypt_file_bin(rsa_key_ctx *ctx, FILE *infile, FILE *outfile);
+
+bool rsa_ctx_encrypt_file_hybrid(rsa_key_ctx *ctx, FILE *infile, FILE *outfile);
+
+bool rsa_ctx_decrypt_range(
+    rsa_key_ctx *ctx, FILE *infile, FILE *outfile, uint64_t offset, uint64_t length);
+
+bool rsa_ctx_encrypt_file_threads(
+    rsa_key_ctx *ctx, FILE *infile, FILE *outfile, int threads, rsa_format format);
+
+bool rsa_ctx_decrypt_file_threads(
+    rsa_key_ctx *ctx, FILE *infile, FILE *outfile, int threads, rsa_format format);
+
+bool rsa_import_message(mpz_t m, uint8_t *msg, size_t len, size_t k);
+
+void rsa_sign_batch(mpz_t s[], mpz_t m[], size_t count, rsa_key_ctx *ctx);
+
+bool rsa_verify_batch(bool valid[], mpz_t m[], mpz_t s[], size_t count, rsa_key_ctx *ctx);
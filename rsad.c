@@ -0,0 +1,464 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <gmp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include "daemon.h"
+#include "hex.h"
+#include "numtheory.h"
+#include "rsa.h"
+#include "stats.h"
+
+#define OPTIONS "hn:s:t:q:c:v"
+
+#define RSAD_KEYS_MAX 16 // Private keys one daemon can serve
+#define RSAD_BATCH (2 * MBEXP_LANES) // Requests a worker takes off the queue at a time
+
+// One request from the moment its connection has read it until the answer is ready
+typedef struct {
+    uint8_t op;
+    uint8_t key;
+    uint8_t *payload;
+    size_t len;
+    uint8_t status;
+    uint8_t *answer; // malloc'd by the worker, NULL if the answer is empty
+    size_t answer_len;
+    uint64_t start; // rsad_now when the request was read
+    bool done;
+    pthread_cond_t cond; // Signaled once done is set
+} rsad_request;
+
+// State shared by the connection threads and the workers, all of it under lock
+typedef struct {
+    rsa_key_ctx keys[RSAD_KEYS_MAX]; // Read once at startup, every worker copies them
+    size_t key_count;
+    pthread_mutex_t lock;
+    pthread_cond_t work; // Signaled when requests are queued
+    pthread_cond_t room; // Signaled when the queue or the connection slots free up
+    rsad_request **queue; // Ring of waiting requests
+    size_t queue_cap, queue_head, queue_len;
+    size_t connections, connections_max;
+    daemon_histogram latency[2]; // Decrypt and sign, from reading the request to its answer
+} rsad_server;
+
+// A worker thread with its own contexts for every key
+typedef struct {
+    rsad_server *server;
+    rsa_key_ctx keys[RSAD_KEYS_MAX];
+    mpz_t m[RSAD_BATCH], s[RSAD_BATCH];
+} rsad_worker;
+
+// A connection thread and the socket it serves
+typedef struct {
+    rsad_server *server;
+    int fd;
+} rsad_connection;
+
+static volatile sig_atomic_t rsad_stop = 0;
+
+// Prints out the help message
+void help_message(void) {
+    printf("SYNOPSIS\n");
+    printf("   Serves decrypt and sign requests over a Unix-domain socket.\n");
+    printf("   Keys are read once at startup, decrypt --daemon sends requests to it.\n");
+    printf("\n");
+    printf("USAGE\n");
+    printf("   ./rsad [-hv] [-t threads] [-q queue] [-c connections] [-s socket] -n privkey\n");
+    printf("\n");
+    printf("OPTIONS\n");
+    printf("   -h              Display program help and usage.\n");
+    printf("   -v              Print the latency histograms and counters on exit.\n");
+    printf("   -n pvfile       Private key file, may be given more than once, the first is\n");
+    printf("                   key 0 (default: rsa.priv).\n");
+    printf("   -s socket       Socket to listen on (default: %s). It is made 0600, so only\n",
+        DAEMON_SOCKET);
+    printf("                   this user can connect, like the key files keygen writes.\n");
+    printf("   -t threads      Worker threads (default: 1).\n");
+    printf("   -q queue        Requests waiting for a worker at most (default: 256).\n");
+    printf("   -c connections  Connections served at once at most (default: 64).\n");
+    exit(0);
+}
+
+// Stops the accept loop, the signal interrupts accept
+static void rsad_signal(int signal) {
+    (void) signal;
+    rsad_stop = 1;
+}
+
+// Returns a monotonic time in nanoseconds
+static uint64_t rsad_now(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Decrypts a whole ciphertext with the incremental functions, its first byte gives the format
+// Hex input answers with the lines before the first malformed one, as decrypt writes them
+static void rsad_decrypt(rsa_key_ctx *ctx, rsad_request *request) {
+    rsa_crypt crypt;
+    rsa_format format = request->len > 0 && request->payload[0] == CONTAINER_MAGIC[0]
+                            ? RSA_FORMAT_BIN
+                            : RSA_FORMAT_HEX;
+    size_t len = 0, more = 0, cap;
+    bool ok = rsa_decrypt_init(&crypt, ctx, format);
+
+    if (ok == true) {
+        cap = rsa_decrypt_bound(&crypt, request->len);
+        request->answer = (uint8_t *) malloc(cap);
+        ok = rsa_decrypt_update(&crypt, request->answer, cap, &len, request->payload, request->len);
+    }
+    if (ok == true) {
+        cap = rsa_decrypt_bound(&crypt, 0);
+        request->answer = (uint8_t *) realloc(request->answer, len + cap);
+        ok = rsa_decrypt_final(&crypt, request->answer + len, cap, &more);
+    }
+    rsa_crypt_clear(&crypt);
+
+    if ((ok == false && (format != RSA_FORMAT_HEX || request->answer == NULL))
+        || len + more > DAEMON_PAYLOAD_MAX) {
+        free(request->answer);
+        request->answer = NULL;
+        request->status = DAEMON_FAILED;
+        return;
+    }
+    request->answer_len = len + more;
+    request->status = DAEMON_OK;
+    return;
+}
+
+// Signs the messages of every sign request for one key in a batch as one rsa_sign_batch call
+// so they share the SIMD lanes, messages too long for the key fail on their own
+static void rsad_sign(rsad_worker *worker, rsad_request *batch[], size_t count, uint8_t key) {
+    rsa_key_ctx *ctx = &worker->keys[key];
+    rsad_request *signing[RSAD_BATCH];
+    size_t total = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        rsad_request *request = batch[i];
+        if (request->op != DAEMON_OP_SIGN || request->key != key) {
+            continue;
+        }
+        if (rsa_import_message(worker->m[total], request->payload, request->len, ctx->k)
+            == false) {
+            request->status = DAEMON_FAILED;
+            continue;
+        }
+        signing[total++] = request;
+    }
+    if (total == 0) {
+        return;
+    }
+
+    rsa_sign_batch(worker->s, worker->m, total, ctx);
+    for (size_t i = 0; i < total; i++) { // Same hex sign writes, without the newline
+        char *hex = (char *) malloc(hex_size(worker->s[i]));
+        signing[i]->answer = (uint8_t *) hex;
+        signing[i]->answer_len = hex_encode(hex, worker->s[i]);
+        signing[i]->status = DAEMON_OK;
+    }
+    return;
+}
+
+// Takes up to RSAD_BATCH queued requests at a time, runs them, and wakes their connections
+// Requests that arrive together are coalesced: sign requests for the same key are signed as one
+// batch, decrypt requests run one after another and batch their own blocks
+static void *rsad_work(void *arg) {
+    rsad_worker *worker = (rsad_worker *) arg;
+    rsad_server *server = worker->server;
+    rsad_request *batch[RSAD_BATCH];
+    bool signs[RSAD_KEYS_MAX];
+
+    while (true) {
+        size_t count = 0;
+        pthread_mutex_lock(&server->lock);
+        while (server->queue_len == 0) {
+            pthread_cond_wait(&server->work, &server->lock);
+        }
+        while (count < RSAD_BATCH && server->queue_len > 0) {
+            batch[count++] = server->queue[server->queue_head];
+            server->queue_head = (server->queue_head + 1) % server->queue_cap;
+            server->queue_len -= 1;
+        }
+        pthread_cond_broadcast(&server->room);
+        pthread_mutex_unlock(&server->lock);
+
+        memset(signs, 0, sizeof(signs));
+        for (size_t i = 0; i < count; i++) {
+            if (batch[i]->op == DAEMON_OP_DECRYPT) {
+                rsad_decrypt(&worker->keys[batch[i]->key], batch[i]);
+            } else if (signs[batch[i]->key] == false) { // First sign request for this key
+                signs[batch[i]->key] = true;
+                rsad_sign(worker, batch, count, batch[i]->key);
+            }
+        }
+
+        uint64_t now = rsad_now();
+        pthread_mutex_lock(&server->lock);
+        for (size_t i = 0; i < count; i++) {
+            daemon_histogram_add(&server->latency[batch[i]->op - 1], now - batch[i]->start);
+            batch[i]->done = true;
+            pthread_cond_signal(&batch[i]->cond);
+        }
+        pthread_mutex_unlock(&server->lock);
+    }
+    return NULL;
+}
+
+// Writes the latency histograms and the queue and connection load into a malloc'd answer
+static void rsad_stats(rsad_server *server, rsad_request *request) {
+    char *text = NULL;
+    FILE *out = open_memstream(&text, &request->answer_len);
+
+    pthread_mutex_lock(&server->lock);
+    daemon_histogram_print(&server->latency[DAEMON_OP_DECRYPT - 1], "decrypt", out);
+    daemon_histogram_print(&server->latency[DAEMON_OP_SIGN - 1], "sign", out);
+    fprintf(out, "queue: %zu of %zu, connections: %zu of %zu\n", server->queue_len,
+        server->queue_cap, server->connections, server->connections_max);
+    pthread_mutex_unlock(&server->lock);
+    fclose(out);
+
+    request->answer = (uint8_t *) text;
+    request->status = DAEMON_OK;
+    return;
+}
+
+// Puts a request on the queue and waits until a worker has answered it
+// A full queue blocks the connection, which stops reading its socket until there is room
+static void rsad_submit(rsad_server *server, rsad_request *request) {
+    pthread_mutex_lock(&server->lock);
+    while (server->queue_len == server->queue_cap) {
+        pthread_cond_wait(&server->room, &server->lock);
+    }
+    request->start = rsad_now();
+    request->done = false;
+    server->queue[(server->queue_head + server->queue_len) % server->queue_cap] = request;
+    server->queue_len += 1;
+    pthread_cond_signal(&server->work);
+    while (request->done == false) {
+        pthread_cond_wait(&request->cond, &server->lock);
+    }
+    pthread_mutex_unlock(&server->lock);
+    return;
+}
+
+// Reads requests from one connection and answers them in order until the client hangs up
+// A payload over DAEMON_PAYLOAD_MAX is answered with DAEMON_BAD_REQUEST and ends the connection
+static void *rsad_serve(void *arg) {
+    rsad_connection *connection = (rsad_connection *) arg;
+    rsad_server *server = connection->server;
+    uint8_t header[DAEMON_HEADER_SIZE];
+    uint32_t length;
+    rsad_request request;
+
+    memset(&request, 0, sizeof(rsad_request));
+    pthread_cond_init(&request.cond, NULL);
+    while (daemon_read_full(connection->fd, header, DAEMON_HEADER_SIZE) == true) {
+        daemon_parse_header(header, &length, &request.op, &request.key);
+        request.answer = NULL;
+        request.answer_len = 0;
+        request.status = DAEMON_BAD_REQUEST;
+        if (length > DAEMON_PAYLOAD_MAX) {
+            daemon_pack_header(header, 0, request.status, 0);
+            daemon_write_full(connection->fd, header, DAEMON_HEADER_SIZE);
+            break;
+        }
+        request.len = length;
+        request.payload = (uint8_t *) malloc(length > 0 ? length : 1);
+        if (daemon_read_full(connection->fd, request.payload, length) == false) {
+            free(request.payload);
+            break;
+        }
+
+        if (request.op == DAEMON_OP_STATS) {
+            rsad_stats(server, &request);
+        } else if (request.op != DAEMON_OP_DECRYPT && request.op != DAEMON_OP_SIGN) {
+            request.status = DAEMON_BAD_REQUEST;
+        } else if (request.key >= server->key_count) {
+            request.status = DAEMON_BAD_KEY;
+        } else {
+            rsad_submit(server, &request);
+        }
+
+        daemon_pack_header(header, request.answer_len, request.status, 0);
+        bool sent = daemon_write_full(connection->fd, header, DAEMON_HEADER_SIZE)
+                    && daemon_write_full(connection->fd, request.answer, request.answer_len);
+        free(request.payload);
+        free(request.answer);
+        if (sent == false) {
+            break;
+        }
+    }
+
+    close(connection->fd);
+    pthread_cond_destroy(&request.cond);
+    free(connection);
+    pthread_mutex_lock(&server->lock);
+    server->connections -= 1;
+    pthread_cond_broadcast(&server->room);
+    pthread_mutex_unlock(&server->lock);
+    return NULL;
+}
+
+// Reads a private key file into ctx, returns false if it can't be opened
+static bool rsad_load_key(rsa_key_ctx *ctx, char *path) {
+    FILE *pvfile = fopen(path, "r");
+    mpz_t n, d, p, q, dp, dq, qinv;
+    mpz_t r[RSA_EXTRA_PRIMES], dr[RSA_EXTRA_PRIMES], tr[RSA_EXTRA_PRIMES]; // Multi-prime keys
+
+    if (pvfile == NULL) {
+        return false;
+    }
+    mpz_inits(n, d, p, q, dp, dq, qinv, NULL);
+    for (size_t i = 0; i < RSA_EXTRA_PRIMES; i++) {
+        mpz_inits(r[i], dr[i], tr[i], NULL);
+    }
+    if (rsa_read_priv_crt(n, d, p, q, dp, dq, qinv, pvfile) == true) {
+        size_t extra = rsa_read_priv_extra(r, dr, tr, pvfile);
+        rsa_ctx_init_multi(ctx, n, p, q, dp, dq, qinv, r, dr, tr, extra);
+    } else {
+        rsa_ctx_init_priv(ctx, n, d);
+    }
+    mpz_clears(n, d, p, q, dp, dq, qinv, NULL);
+    for (size_t i = 0; i < RSA_EXTRA_PRIMES; i++) {
+        mpz_clears(r[i], dr[i], tr[i], NULL);
+    }
+    fclose(pvfile);
+    return true;
+}
+
+// Main program, loads the keys, starts the workers, and accepts connections until SIGINT or SIGTERM
+int main(int argc, char **argv) {
+    int opt = 0;
+    char *key_paths[RSAD_KEYS_MAX];
+    size_t key_count = 0;
+    char *socket_path = DAEMON_SOCKET;
+    int threads = 1;
+    size_t queue_cap = 256;
+    size_t connections_max = 64;
+    bool verbose = false;
+    rsad_server server;
+    rsad_worker *workers;
+    pthread_t thread;
+    struct sigaction action;
+    sigset_t signals;
+    int listener;
+
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'h': help_message(); return -1;
+        case 'n':
+            if (key_count == RSAD_KEYS_MAX) {
+                printf("At most %d keys can be served.\n", RSAD_KEYS_MAX);
+                return -1;
+            }
+            key_paths[key_count++] = optarg;
+            break;
+        case 's': socket_path = optarg; break;
+        case 't': threads = atoi(optarg); break;
+        case 'q': queue_cap = strtoull(optarg, NULL, 10); break;
+        case 'c': connections_max = strtoull(optarg, NULL, 10); break;
+        case 'v': verbose = true; break;
+        }
+    }
+    if (key_count == 0) {
+        key_paths[key_count++] = "rsa.priv";
+    }
+    threads = threads < 1 ? 1 : threads;
+    queue_cap = queue_cap < 1 ? 1 : queue_cap;
+    connections_max = connections_max < 1 ? 1 : connections_max;
+
+    stats_init(verbose); // Counters and stage timers, or a trace if RSA_TRACE is set
+
+    memset(&server, 0, sizeof(rsad_server));
+    for (size_t i = 0; i < key_count; i++) {
+        if (rsad_load_key(&server.keys[i], key_paths[i]) == false) {
+            printf("Error opening pvfile %s.\n", key_paths[i]);
+            return -1;
+        }
+        server.key_count += 1;
+    }
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.work, NULL);
+    pthread_cond_init(&server.room, NULL);
+    server.queue = (rsad_request **) malloc(queue_cap * sizeof(rsad_request *));
+    server.queue_cap = queue_cap;
+    server.connections_max = connections_max;
+
+    listener = daemon_listen(socket_path);
+    if (listener < 0) {
+        printf("Error listening on %s, another rsad may be running there.\n", socket_path);
+        return -1;
+    }
+
+    // Only the main thread takes SIGINT and SIGTERM, so they are sure to interrupt accept
+    signal(SIGPIPE, SIG_IGN); // A client that hangs up early must not end the daemon
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    workers = (rsad_worker *) calloc(threads, sizeof(rsad_worker));
+    for (int i = 0; i < threads; i++) {
+        workers[i].server = &server;
+        for (size_t k = 0; k < server.key_count; k++) {
+            rsa_ctx_copy(&workers[i].keys[k], &server.keys[k]);
+        }
+        for (size_t j = 0; j < RSAD_BATCH; j++) {
+            mpz_inits(workers[i].m[j], workers[i].s[j], NULL);
+        }
+        pthread_create(&thread, NULL, rsad_work, &workers[i]);
+        pthread_detach(thread);
+    }
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = rsad_signal; // No SA_RESTART, accept returns EINTR instead
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+
+    while (rsad_stop == 0) {
+        pthread_mutex_lock(&server.lock);
+        while (server.connections == server.connections_max) { // Leave the rest in the backlog
+            pthread_cond_wait(&server.room, &server.lock);
+        }
+        pthread_mutex_unlock(&server.lock);
+
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR) {
+                printf("Error accepting a connection: %s.\n", strerror(errno));
+            }
+            continue;
+        }
+        rsad_connection *connection = (rsad_connection *) malloc(sizeof(rsad_connection));
+        connection->server = &server;
+        connection->fd = fd;
+        pthread_mutex_lock(&server.lock);
+        server.connections += 1;
+        pthread_mutex_unlock(&server.lock);
+        pthread_create(&thread, NULL, rsad_serve, connection);
+        pthread_detach(thread);
+    }
+
+    close(listener);
+    unlink(socket_path);
+    if (verbose == true) {
+        pthread_mutex_lock(&server.lock);
+        daemon_histogram_print(&server.latency[DAEMON_OP_DECRYPT - 1], "decrypt", stdout);
+        daemon_histogram_print(&server.latency[DAEMON_OP_SIGN - 1], "sign", stdout);
+        pthread_mutex_unlock(&server.lock);
+        stats_print(stdout);
+    }
+    stats_finish();
+    // Workers and connections may still be running, returning from main ends them with the process
+    return 0;
+}
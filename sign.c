@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <gmp.h>
+#include <unistd.h>
+#include "numtheory.h"
+#include "randstate.h"
+#include "rsa.h"
+#include "hex.h"
+
+#define OPTIONS "hi:o:n:v"
+
+// Messages read and signed at a time
+#define BATCH 1024
+
+// Prints out help message when called for in the getopt() loop
+void help_message(void) {
+    printf("SYNOPSIS\n");
+    printf("   Signs messages using an RSA private key.\n");
+    printf("   Each line of the input is one message, signatures are checked by verify.\n");
+    printf("\n");
+    printf("USAGE\n");
+    printf("   ./sign [-hv] [-i infile] [-o outfile] -n privkey\n");
+    printf("\n");
+    printf("OPTIONS\n");
+    printf("   -h              Display program help and usage.\n");
+    printf("   -v              Display verbose program output.\n");
+    printf("   -i infile       Input file of messages, one per line (default: stdin).\n");
+    printf("   -o outfile      Output file for signatures, one per line (default: stdout).\n");
+    printf("   -n pvfile       Private key file (default: rsa.priv).\n");
+    exit(0);
+}
+
+// Main function that holds the implementation of signing messages
+int main(int argc, char **argv) {
+    int opt = 0;
+    FILE *infile = stdin;
+    FILE *outfile = stdout;
+    FILE *pvfile;
+    char *pvfile_path = "rsa.priv";
+    bool verbose = false;
+    bool crt;
+    rsa_key_ctx ctx;
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    size_t count = 0;
+    size_t total = 0;
+    mpz_t m[BATCH], s[BATCH];
+
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'h': help_message(); return -1;
+        case 'i': infile = fopen(optarg, "r"); break;
+        case 'o': outfile = fopen(optarg, "w"); break;
+        case 'n': pvfile_path = optarg; break;
+        case 'v': verbose = true; break;
+        }
+    }
+
+    pvfile = fopen(pvfile_path, "r"); // Open private key file
+
+    if (pvfile == NULL) {
+        printf("Error opening pvfile.\n");
+        return -1;
+    }
+    if (infile == NULL || outfile == NULL) {
+        printf("Error opening infile or outfile.\n");
+        return -1;
+    }
+
+    mpz_t n, d, p, q, dp, dq, qinv;
+    mpz_inits(n, d, p, q, dp, dq, qinv, NULL);
+    mpz_t r[RSA_EXTRA_PRIMES], dr[RSA_EXTRA_PRIMES], tr[RSA_EXTRA_PRIMES]; // Multi-prime keys
+    size_t extra = 0;
+    for (size_t i = 0; i < RSA_EXTRA_PRIMES; i++) {
+        mpz_inits(r[i], dr[i], tr[i], NULL);
+    }
+
+    crt = rsa_read_priv_crt(n, d, p, q, dp, dq, qinv, pvfile); // Read in the private key
+    if (crt == true) { // A multi-prime key has more primes after the CRT components
+        extra = rsa_read_priv_extra(r, dr, tr, pvfile);
+        rsa_ctx_init_multi(&ctx, n, p, q, dp, dq, qinv, r, dr, tr, extra);
+    } else {
+        rsa_ctx_init_priv(&ctx, n, d);
+    }
+
+    for (size_t i = 0; i < BATCH; i++) {
+        mpz_inits(m[i], s[i], NULL);
+    }
+
+    while (true) {
+        len = getline(&line, &line_cap, infile);
+        if (len > 0 && line[len - 1] == '\n') { // The newline isn't part of the message
+            len -= 1;
+        }
+        if (len >= 0) {
+            if (rsa_import_message(m[count], (uint8_t *) line, len, ctx.k) == false) {
+                printf("Message on line %zu is too long for this key.\n", total + count + 1);
+                return -1;
+            }
+            count += 1;
+        }
+
+        if (count == BATCH || (len < 0 && count > 0)) { // Sign a full batch, or what's left at the end
+            rsa_sign_batch(s, m, count, &ctx);
+            for (size_t i = 0; i < count; i++) {
+                hex_write(outfile, s[i]);
+            }
+            total += count;
+            count = 0;
+        }
+        if (len < 0) {
+            break;
+        }
+    }
+
+    if (verbose == true) {
+        gmp_printf("n (%d bits) = %Zd\n", mpz_sizeinbase(n, 2), n);
+        printf("signed %zu messages\n", total);
+    }
+
+    for (size_t i = 0; i < BATCH; i++) {
+        mpz_clears(m[i], s[i], NULL);
+    }
+    free(line);
+    rsa_ctx_clear(&ctx);
+
+    fclose(infile); // Close all the opened files
+    fclose(outfile);
+    fclose(pvfile);
+
+    mpz_clears(n, d, p, q, dp, dq, qinv, NULL);
+    for (size_t i = 0; i < RSA_EXTRA_PRIMES; i++) {
+        mpz_clears(r[i], dr[i], tr[i], NULL);
+    }
+}
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+#include "stats.h"
+
+bool stats_enabled = false;
+
+static _Atomic uint64_t counters[STAT_COUNT];
+static _Atomic uint64_t stage_ns[STAGE_COUNT];
+static _Atomic uint64_t stage_calls[STAGE_COUNT];
+
+static const char *counter_names[STAT_COUNT] = { "exponentiations", "modular multiplications",
+    "strong probable prime tests", "strong Lucas tests", "candidates sieved out",
+    "rejected by trial division", "rejected by base 2", "rejected by final test", "e retries",
+    "blocks", "bytes read", "bytes written" };
+
+static const char *stage_names[STAGE_COUNT] = { "read", "import", "exponentiate", "export",
+    "write", "make_prime", "cipher" };
+
+// One complete event of the Chrome trace, times in nanoseconds since stats_init
+typedef struct {
+    uint64_t start;
+    uint64_t duration;
+    uint32_t tid;
+    uint8_t stage;
+} trace_event;
+
+static FILE *trace_file; // NULL unless STATS_TRACE_ENV names a file
+static trace_event *trace_events;
+static size_t trace_count;
+static size_t trace_cap;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic uint32_t next_tid = 1;
+static _Thread_local uint32_t tid; // Small id of this thread in the trace, 0 until its first event
+static uint64_t epoch;
+
+// Returns the monotonic clock in nanoseconds
+static uint64_t now_ns(void) {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+// Turns the counters and stage timers on if verbose is set or a trace file is asked for
+// Call before any threads start
+void stats_init(bool verbose) {
+    char *path = getenv(STATS_TRACE_ENV);
+
+    if (path != NULL && path[0] != '\0') {
+        trace_file = fopen(path, "w");
+        if (trace_file == NULL) {
+            printf("Error opening trace file %s.\n", path);
+        }
+    }
+    stats_enabled = verbose == true || trace_file != NULL;
+    epoch = now_ns();
+    return;
+}
+
+void stats_add(stat_counter c, uint64_t n) {
+    atomic_fetch_add_explicit(&counters[c], n, memory_order_relaxed);
+    return;
+}
+
+uint64_t stats_get(stat_counter c) {
+    return atomic_load_explicit(&counters[c], memory_order_relaxed);
+}
+
+// Returns the start time of a stage, or 0 without reading the clock when stats are off
+uint64_t stats_begin(void) {
+    return stats_enabled == true ? now_ns() : 0;
+}
+
+// Adds the time since start to the stage total, and records a trace event if tracing
+void stats_end(stat_stage stage, uint64_t start) {
+    if (stats_enabled == false) {
+        return;
+    }
+    uint64_t stop = now_ns();
+    atomic_fetch_add_explicit(&stage_ns[stage], stop - start, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stage_calls[stage], 1, memory_order_relaxed);
+    if (trace_file == NULL) {
+        return;
+    }
+
+    if (tid == 0) {
+        tid = atomic_fetch_add(&next_tid, 1);
+    }
+    pthread_mutex_lock(&trace_lock);
+    if (trace_count == trace_cap && trace_cap < STATS_TRACE_MAX) {
+        trace_cap = trace_cap == 0 ? 4096 : 2 * trace_cap;
+        trace_events = (trace_event *) realloc(trace_events, trace_cap * sizeof(trace_event));
+    }
+    if (trace_count < trace_cap) {
+        trace_events[trace_count++] = (trace_event) { start - epoch, stop - start, tid, stage };
+    }
+    pthread_mutex_unlock(&trace_lock);
+    return;
+}
+
+// Prints the nonzero counters and the time spent in each stage
+void stats_print(FILE *outfile) {
+    if (stats_enabled == false) {
+        return;
+    }
+    for (int c = 0; c < STAT_COUNT; c++) {
+        uint64_t value = stats_get(c);
+        if (value > 0) {
+            fprintf(outfile, "%-29s %" PRIu64 "\n", counter_names[c], value);
+        }
+    }
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        uint64_t calls = atomic_load(&stage_calls[s]);
+        if (calls > 0) {
+            fprintf(outfile, "stage %-23s %.3f ms over %" PRIu64 " calls\n", stage_names[s],
+                atomic_load(&stage_ns[s]) / 1e6, calls);
+        }
+    }
+    return;
+}
+
+// Writes the trace events as Chrome trace-event JSON, viewable in chrome://tracing or Perfetto
+// Call after every thread has finished
+void stats_finish(void) {
+    if (trace_file == NULL) {
+        return;
+    }
+    fprintf(trace_file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    for (size_t i = 0; i < trace_count; i++) {
+        trace_event *ev = &trace_events[i];
+        fprintf(trace_file,
+            "%s\n{\"name\": \"%s\", \"cat\": \"rsa\", \"ph\": \"X\", \"pid\": 1, \"tid\": %" PRIu32
+            ", \"ts\": %.3f, \"dur\": %.3f}",
+            i == 0 ? "" : ",", stage_names[ev->stage], ev->tid, ev->start / 1e3,
+            ev->duration / 1e3);
+    }
+    fprintf(trace_file, "\n]}\n");
+    fclose(trace_file);
+    trace_file = NULL;
+    free(trace_events);
+    trace_events = NULL;
+    trace_count = 0;
+    trace_cap = 0;
+    return;
+}
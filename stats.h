@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Environment variable naming the file a Chrome trace-event JSON dump is written to
+#define STATS_TRACE_ENV "RSA_TRACE"
+
+// Trace events kept in memory at most, later ones are only counted in the stage totals
+#define STATS_TRACE_MAX (1 << 20)
+
+typedef enum {
+    STAT_EXPONENTIATIONS, // pow_mod, pow_mod_ui, and mont_pow_exp calls
+    STAT_MODMULS, // Modular multiplications and squarings inside them
+    STAT_MR_ROUNDS, // Strong probable prime tests, base 2 included
+    STAT_LUCAS_TESTS,
+    STAT_SIEVED, // make_prime candidates a small prime divides
+    STAT_REJECT_TRIAL, // is_prime rejections by trial division
+    STAT_REJECT_BASE2, // ... by the base 2 strong probable prime test
+    STAT_REJECT_FINAL, // ... by the strong Lucas test or the random-base rounds
+    STAT_E_RETRIES, // Primes or random exponents drawn again because e didn't fit
+    STAT_BLOCKS, // Blocks encrypted or decrypted by the file functions
+    STAT_BYTES_READ,
+    STAT_BYTES_WRITTEN,
+    STAT_COUNT
+} stat_counter;
+
+typedef enum {
+    STAGE_READ,
+    STAGE_IMPORT,
+    STAGE_EXPONENTIATE,
+    STAGE_EXPORT,
+    STAGE_WRITE,
+    STAGE_PRIME, // One make_prime call or search round
+    STAGE_CIPHER, // One ChaCha20-Poly1305 record of a hybrid container
+    STAGE_COUNT
+} stat_stage;
+
+// Set by stats_init, everything else does nothing while it is false
+extern bool stats_enabled;
+
+// Counts n more of counter c, costs one predictable branch when stats are off
+#define STATS_ADD(c, n)                                                                            \
+    do {                                                                                           \
+        if (stats_enabled) {                                                                       \
+            stats_add(c, n);                                                                       \
+        }                                                                                          \
+    } while (0)
+
+void stats_init(bool verbose);
+
+void stats_add(stat_counter c, uint64_t n);
+
+uint64_t stats_get(stat_counter c);
+
+uint64_t stats_begin(void);
+
+void stats_end(stat_stage stage, uint64_t start);
+
+void stats_print(FILE *outfile);
+
+void stats_finish(void);
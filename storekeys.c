@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <gmp.h>
+#include <string.h>
+#include <unistd.h>
+#include "container.h"
+#include "keystore.h"
+#include "rsa.h"
+
+#define OPTIONS "hac:f:k:lv"
+
+// Prints out the help message
+void help_message(void) {
+    printf("SYNOPSIS\n");
+    printf("   Builds and appends to a keystore, the public keys of many users in one file.\n");
+    printf("   encrypt -u user --keystore file encrypts to a key in it.\n");
+    printf("\n");
+    printf("USAGE\n");
+    printf("   ./storekeys [-hlv] [-a] [-f listfile] [-c container] -k keystore [pbfile ...]\n");
+    printf("\n");
+    printf("OPTIONS\n");
+    printf("   -h              Display program help and usage.\n");
+    printf("   -v              Display verbose program output.\n");
+    printf("   -k keystore     Keystore file (default: rsa.keystore).\n");
+    printf("   -a              Append to the keystore instead of replacing it. A key for a user\n");
+    printf("                   already in it replaces the old one.\n");
+    printf("   -f listfile     Also store the public key files named in listfile, one per line.\n");
+    printf("   -l              List the users in the keystore.\n");
+    printf("   -c container    Print the user a binary or hybrid ciphertext was encrypted for.\n");
+    exit(0);
+}
+
+// Reads the public key file at path and makes its record, if its signature verifies
+// Returns NULL and says why if the key can't be stored
+static keystore_record *read_key(char *path, bool verbose) {
+    FILE *pbfile = fopen(path, "r");
+    char username[4096] = "";
+    keystore_record *record = NULL;
+    rsa_key_ctx ctx;
+    mpz_t n, e, s, m;
+
+    if (pbfile == NULL) {
+        printf("Skipping %s, it can't be opened.\n", path);
+        return NULL;
+    }
+    mpz_inits(n, e, s, m, NULL);
+    rsa_read_pub(n, e, s, username, pbfile);
+    fclose(pbfile);
+
+    if (mpz_cmp_ui(n, 3) < 0 || mpz_even_p(n) || mpz_sgn(e) <= 0
+        || mpz_set_str(m, username, 62) != 0) {
+        printf("Skipping %s, it isn't a public key file.\n", path);
+    } else if (strlen(username) >= KEYSTORE_NAME_MAX) {
+        printf("Skipping %s, usernames are at most %d characters.\n", path, KEYSTORE_NAME_MAX - 1);
+    } else {
+        rsa_ctx_init_pub(&ctx, n, e); // Only keys whose owner signed them go in
+        if (rsa_ctx_verify(&ctx, m, s) == true) {
+            record = keystore_record_make(n, e, s, username);
+        } else {
+            printf("Skipping %s, its signature doesn't verify.\n", path);
+        }
+        rsa_ctx_clear(&ctx);
+    }
+    if (record != NULL && verbose == true) {
+        printf("stored %s for %s\n", path, username);
+    }
+    mpz_clears(n, e, s, m, NULL);
+    return record;
+}
+
+// Adds record to the end of the growing list *records
+static void add_record(keystore_record ***records, size_t *count, size_t *cap,
+    keystore_record *record) {
+    if (*count == *cap) {
+        *cap = *cap == 0 ? 64 : 2 * *cap;
+        *records = (keystore_record **) realloc(*records, *cap * sizeof(keystore_record *));
+    }
+    (*records)[(*count)++] = record;
+    return;
+}
+
+// Prints the username, key size, and fingerprint of every record in the keystore
+static void list_keys(keystore *ks) {
+    for (keystore_record *record = keystore_next(ks, NULL); record != NULL;
+         record = keystore_next(ks, record)) {
+        mpz_t n, e, s;
+
+        keystore_key(record, n, e, s);
+        printf("%s %zu %016" PRIx64 "\n", record->username, mpz_sizeinbase(n, 2),
+            record->fingerprint);
+    }
+    return;
+}
+
+// Main program, writes the keystore if keys are given and then answers -l and -c from it
+int main(int argc, char **argv) {
+    int opt = 0;
+    char *keystore_path = "rsa.keystore";
+    char *list_path = NULL;
+    char *container_path = NULL;
+    bool append = false;
+    bool list = false;
+    bool verbose = false;
+    keystore_record **records = NULL;
+    size_t count = 0;
+    size_t cap = 0;
+    size_t added = 0; // Records read from key files, they are freed at the end
+    keystore ks;
+    int status = 0;
+
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'h': help_message(); return -1;
+        case 'a': append = true; break;
+        case 'c': container_path = optarg; break;
+        case 'f': list_path = optarg; break;
+        case 'k': keystore_path = optarg; break;
+        case 'l': list = true; break;
+        case 'v': verbose = true; break;
+        }
+    }
+
+    if (optind < argc || list_path != NULL || append == true) {
+        int lock = keystore_lock(keystore_path); // Held from reading the old keys to the rename
+        keystore old;
+        bool have_old = false;
+
+        if (lock < 0) {
+            printf("Error locking keystore %s.\n", keystore_path);
+            return -1;
+        }
+        if (append == true && access(keystore_path, F_OK) == 0) {
+            have_old = keystore_open(&old, keystore_path);
+            if (have_old == false) {
+                printf("Error opening keystore %s.\n", keystore_path);
+                keystore_unlock(lock);
+                return -1;
+            }
+            for (keystore_record *record = keystore_next(&old, NULL); record != NULL;
+                 record = keystore_next(&old, record)) { // Old records are written from the map
+                add_record(&records, &count, &cap, record);
+            }
+        }
+        size_t first_new = count;
+        for (int i = optind; i < argc; i++) {
+            keystore_record *record = read_key(argv[i], verbose);
+            if (record != NULL) {
+                add_record(&records, &count, &cap, record);
+            }
+        }
+        if (list_path != NULL) {
+            FILE *listfile = fopen(list_path, "r");
+            char *line = NULL;
+            size_t line_cap = 0;
+            ssize_t len;
+
+            if (listfile == NULL) {
+                printf("Error opening list file %s.\n", list_path);
+                status = -1;
+            }
+            while (listfile != NULL && (len = getline(&line, &line_cap, listfile)) >= 0) {
+                while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+                    line[--len] = '\0';
+                }
+                if (len == 0) {
+                    continue;
+                }
+                keystore_record *record = read_key(line, verbose);
+                if (record != NULL) {
+                    add_record(&records, &count, &cap, record);
+                }
+            }
+            free(line);
+            if (listfile != NULL) {
+                fclose(listfile);
+            }
+        }
+        added = count - first_new;
+
+        if (status == 0 && keystore_write(keystore_path, records, count) == false) {
+            printf("Error writing keystore %s.\n", keystore_path);
+            status = -1;
+        }
+        keystore_unlock(lock);
+        if (verbose == true) {
+            printf("stored %zu new keys\n", added);
+        }
+        for (size_t i = first_new; i < count; i++) {
+            free(records[i]);
+        }
+        free(records);
+        if (have_old == true) {
+            keystore_close(&old);
+        }
+        if (status != 0) {
+            return status;
+        }
+    }
+
+    if (list == false && container_path == NULL) {
+        return 0;
+    }
+    if (keystore_open(&ks, keystore_path) == false) {
+        printf("Error opening keystore %s.\n", keystore_path);
+        return -1;
+    }
+    if (list == true) {
+        list_keys(&ks);
+    }
+    if (container_path != NULL) {
+        FILE *container = fopen(container_path, "r");
+        container_header header;
+
+        if (container == NULL || container_read_header(&header, container) == false) {
+            printf("%s isn't a binary or hybrid ciphertext.\n", container_path);
+            status = -1;
+        } else {
+            keystore_record *record = keystore_find_fingerprint(&ks, header.fingerprint);
+            if (record != NULL) {
+                printf("%s\n", record->username);
+            } else {
+                printf("No key in %s matches %s.\n", keystore_path, container_path);
+                status = -1;
+            }
+        }
+        if (container != NULL) {
+            fclose(container);
+        }
+    }
+    keystore_close(&ks);
+    return status;
+}
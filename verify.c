@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <gmp.h>
+#include <unistd.h>
+#include <time.h>
+#include "numtheory.h"
+#include "randstate.h"
+#include "rsa.h"
+
+#define OPTIONS "hi:s:o:n:v"
+
+// Messages read and verified at a time
+#define BATCH 1024
+
+// Prints out help message when called for in the getopt() loop
+void help_message(void) {
+    printf("SYNOPSIS\n");
+    printf("   Verifies RSA signatures made by the sign program.\n");
+    printf("   Prints valid or invalid for each message, exits with 1 if any are invalid.\n");
+    printf("\n");
+    printf("USAGE\n");
+    printf("   ./verify [-hv] [-i infile] -s sigfile [-o outfile] -n pubkey\n");
+    printf("\n");
+    printf("OPTIONS\n");
+    printf("   -h              Display program help and usage.\n");
+    printf("   -v              Display verbose program output.\n");
+    printf("   -i infile       Input file of messages, one per line (default: stdin).\n");
+    printf("   -s sigfile      Signatures from sign, one per line.\n");
+    printf("   -o outfile      Output file for the results (default: stdout).\n");
+    printf("   -n pbfile       Public key file (default: rsa.pub).\n");
+    exit(0);
+}
+
+// Seeds the random state used for the batch check from /dev/urandom
+// The batch exponents must not be predictable, so the time is only a last resort
+static uint64_t random_seed(void) {
+    uint64_t seed = time(NULL) ^ getpid();
+    FILE *urandom = fopen("/dev/urandom", "r");
+
+    if (urandom != NULL) {
+        if (fread(&seed, sizeof(seed), 1, urandom) != 1) {
+            seed = time(NULL) ^ getpid();
+        }
+        fclose(urandom);
+    }
+    return seed;
+}
+
+// Verifies a batch of messages and prints one result line for each
+// Returns the number of valid signatures
+static size_t verify_batch(
+    FILE *outfile, bool valid[], mpz_t m[], mpz_t s[], size_t count, rsa_key_ctx *ctx) {
+    size_t good = 0;
+
+    rsa_verify_batch(valid, m, s, count, ctx);
+    for (size_t i = 0; i < count; i++) {
+        fprintf(outfile, "%s\n", valid[i] == true ? "valid" : "invalid");
+        good += valid[i] == true ? 1 : 0;
+    }
+    return good;
+}
+
+// Main function that holds the implementation of verifying signatures
+int main(int argc, char **argv) {
+    int opt = 0;
+    FILE *infile = stdin;
+    FILE *sigfile = NULL;
+    FILE *outfile = stdout;
+    FILE *pbfile;
+    char *pbfile_path = "rsa.pub";
+    bool verbose = false;
+    char username[32];
+    rsa_key_ctx ctx;
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    size_t count = 0;
+    size_t total = 0;
+    size_t good = 0;
+    bool valid[BATCH];
+    mpz_t m[BATCH], s[BATCH];
+
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'h': help_message(); return -1;
+        case 'i': infile = fopen(optarg, "r"); break;
+        case 's': sigfile = fopen(optarg, "r"); break;
+        case 'o': outfile = fopen(optarg, "w"); break;
+        case 'n': pbfile_path = optarg; break;
+        case 'v': verbose = true; break;
+        }
+    }
+
+    pbfile = fopen(pbfile_path, "r"); // open the public key file
+
+    if (pbfile == NULL) {
+        printf("Error opening pbfile.\n");
+        return -1;
+    }
+    if (infile == NULL || sigfile == NULL || outfile == NULL) {
+        printf("Error opening infile, sigfile, or outfile.\n");
+        return -1;
+    }
+
+    mpz_t n, e, key_s;
+    mpz_inits(n, e, key_s, NULL);
+
+    rsa_read_pub(n, e, key_s, username, pbfile); // Only n and e are needed here
+    rsa_ctx_init_pub(&ctx, n, e);
+    randstate_init(random_seed());
+
+    for (size_t i = 0; i < BATCH; i++) {
+        mpz_inits(m[i], s[i], NULL);
+    }
+
+    while (true) {
+        len = getline(&line, &line_cap, infile);
+        if (len > 0 && line[len - 1] == '\n') { // The newline isn't part of the message
+            len -= 1;
+        }
+        if (len >= 0) {
+            if (gmp_fscanf(sigfile, "%Zx\n", s[count]) != 1) {
+                printf("Missing signature for line %zu.\n", total + count + 1);
+                return -1;
+            }
+            if (rsa_import_message(m[count], (uint8_t *) line, len, ctx.k) == false) {
+                mpz_set(m[count], n); // Too long to have been signed, this can never verify
+            }
+            count += 1;
+        }
+
+        if (count == BATCH || (len < 0 && count > 0)) { // Verify a full batch, or what's left
+            good += verify_batch(outfile, valid, m, s, count, &ctx);
+            total += count;
+            count = 0;
+        }
+        if (len < 0) {
+            break;
+        }
+    }
+
+    if (verbose == true) {
+        gmp_printf("n (%d bits) = %Zd\n", mpz_sizeinbase(n, 2), n);
+        gmp_printf("e (%d bits) = %Zd\n", mpz_sizeinbase(e, 2), e);
+        printf("verified %zu of %zu signatures\n", good, total);
+    }
+
+    for (size_t i = 0; i < BATCH; i++) {
+        mpz_clears(m[i], s[i], NULL);
+    }
+    free(line);
+    rsa_ctx_clear(&ctx);
+    randstate_clear();
+
+    fclose(infile); // Close all the opened files
+    fclose(sigfile);
+    fclose(outfile);
+    fclose(pbfile);
+
+    mpz_clears(n, e, key_s, NULL);
+    return good == total ? 0 : 1;
+}